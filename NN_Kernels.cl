@@ -43,6 +43,100 @@ float4 cross_entropy(float4 t, float4 y)
     return ( t * log(y + epsilon) + (ones - t) * log (ones - y + epsilon) );
 }
 
+float cross_entropy_element(float t, float y)
+{
+    return t * log(y + epsilon.x) + (1.0f - t) * log(1.0f - y + epsilon.x);
+}
+
+/*
+ * Access to buffers that can be stored in floats or in halfs (16 bits).
+ * The values are always operated in float, the halfs are only a storage
+ * format (vload_half/vstore_half do not require the cl_khr_fp16 extension).
+ * idx is given in elements.
+ */
+float load_float(__global const void *p, int idx, int isHalf)
+{
+    return isHalf ? vload_half(idx, (__global const half *) p) :
+                    ((__global const float *) p)[idx];
+}
+
+void store_float(__global void *p, int idx, float value, int isHalf)
+{
+    if(isHalf) vstore_half(value, idx, (__global half *) p);
+    else ((__global float *) p)[idx] = value;
+}
+
+// 4 consecutive elements starting at idx (no alignment required)
+float4 load_float4(__global const void *p, int idx, int isHalf)
+{
+    return isHalf ? vload_half4(0, (__global const half *) p + idx) :
+                    vload4(0, (__global const float *) p + idx);
+}
+
+void store_float4(__global void *p, int idx, float4 value, int isHalf)
+{
+    if(isHalf) vstore_half4(value, 0, (__global half *) p + idx);
+    else vstore4(value, 0, (__global float *) p + idx);
+}
+
+/*
+ * Counter-based random numbers (Philox-2x32-10, Salmon et al. 2011): the
+ * result depends only on the counter and the key, so any kernel can
+ * regenerate the same number without storing it.
+ */
+uint2 philox2x32_10(uint2 counter, uint key)
+{
+    for(int round = 0; round < 10; round++) {
+        const uint hi = mul_hi(0xD256D193u, counter.x);
+        const uint lo = 0xD256D193u * counter.x;
+        counter = (uint2)(hi ^ key ^ counter.y, lo);
+        key += 0x9E3779B9u;
+    }
+    return counter;
+}
+
+/*
+ * Dropout mask of the element (row, col) of a layer: kept with probability
+ * keepThreshold / 2^32. seed identifies the layer and the training step.
+ */
+bool dropout_keep(int row, int col, uint seed, uint keepThreshold)
+{
+    return philox2x32_10((uint2)(row, col), seed).x < keepThreshold;
+}
+
+/*
+ * Tree reductions of the values given by the local_size work-items that share
+ * srow. Every work-item gets the result. srow can be reused after the call.
+ * local_size must be a power of 2.
+ */
+float local_reduce_max(__local float *srow, int lid, int local_size,
+                       float value)
+{
+    srow[lid] = value;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for(int s = local_size >> 1; s > 0; s >>= 1) {
+        if(lid < s) srow[lid] = fmax(srow[lid], srow[lid + s]);
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    const float result = srow[0];
+    barrier(CLK_LOCAL_MEM_FENCE);
+    return result;
+}
+
+float local_reduce_sum(__local float *srow, int lid, int local_size,
+                       float value)
+{
+    srow[lid] = value;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for(int s = local_size >> 1; s > 0; s >>= 1) {
+        if(lid < s) srow[lid] += srow[lid + s];
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    const float result = srow[0];
+    barrier(CLK_LOCAL_MEM_FENCE);
+    return result;
+}
+
 /* Matrix A is cached into local memory block */
 /* Required global threads = (colsC / 4, rowsC / 4) 
  * Required sizes: rowsC, colsC, rowsA, colsA, rowsB, colsB
@@ -65,7 +159,9 @@ __kernel void matrixMultiplicationSigmoidKernelLocal
                               int BInColMajorOrder,
                               int sumToMatrixC,
                               float multPrevVal,
-                              float multSum)
+                              float multSum,
+                              __global float4 *derivative,
+                              int offsetDerivative)
 {
     const int gid0 = get_global_id(0);
     const int gid1 = get_global_id(1);
@@ -219,6 +315,15 @@ __kernel void matrixMultiplicationSigmoidKernelLocal
 
     // end of calculation of sigmoid function
     
+    // Multiply by the derivative of the sigmoid (backpropagation of deltas)
+    if(derivative != NULL) {
+        const int4 derivativePos = globalPos - offsetC + offsetDerivative;
+        sum0 *= sigmoid_derivative(derivative[derivativePos.x]);
+        sum1 *= sigmoid_derivative(derivative[derivativePos.y]);
+        sum2 *= sigmoid_derivative(derivative[derivativePos.z]);
+        sum3 *= sigmoid_derivative(derivative[derivativePos.w]);
+    }
+    
     /* Write 16 values to matrixC */
     if(sumToMatrixC) {
         const float4 a = matrixC[globalPos.x] * multPrevVal;
@@ -238,208 +343,1037 @@ __kernel void matrixMultiplicationSigmoidKernelLocal
     }
 }
 
-/* Substracts element by element. NDRange of one dimension. 
- * Take care that every element is a float4 element.
+/*
+ * Tile configuration of matrixMultiplicationSigmoidKernelTiled. The host
+ * overrides these values through the build options of the program.
+ */
+#ifndef GEMM_TSM
+#define GEMM_TSM 64     // rows of C calculated by a work-group
+#endif
+#ifndef GEMM_TSN
+#define GEMM_TSN 64     // cols of C calculated by a work-group
+#endif
+#ifndef GEMM_TSK
+#define GEMM_TSK 16     // depth of the tiles of A and B
+#endif
+#ifndef GEMM_WPTM
+#define GEMM_WPTM 8     // rows of C calculated by a work-item (registers)
+#endif
+#ifndef GEMM_WPTN
+#define GEMM_WPTN 8     // cols of C calculated by a work-item (registers)
+#endif
+
+#define GEMM_RTSM (GEMM_TSM / GEMM_WPTM)      // local size in dimension 1
+#define GEMM_RTSN (GEMM_TSN / GEMM_WPTN)      // local size in dimension 0
+#define GEMM_THREADS (GEMM_RTSM * GEMM_RTSN)
+#define GEMM_LPTA ((GEMM_TSK * GEMM_TSM) / GEMM_THREADS)  // loads of A per work-item
+#define GEMM_LPTB ((GEMM_TSK * GEMM_TSN) / GEMM_THREADS)  // loads of B per work-item
+
+/*
+ * Loads the tile number "tile" of the block of rows of A that starts in
+ * offsetM into Asub. Asub is stored as Asub[k][m] independently of the
+ * order of A in global memory. Elements outside of A are loaded as 0.
+ */
+void gemm_load_tile_A(__global const void *A,
+                      int AIsHalf,
+                      __local float *Asub,
+                      int offsetA,
+                      int tile,
+                      int offsetM,
+                      int rowsA,
+                      int colsA,
+                      int AInColMajorOrder,
+                      int tid)
+{
+    for(int l = 0; l < GEMM_LPTA; l++) {
+        const int id = l * GEMM_THREADS + tid;
+        int m, k;
+        float v;
+        if(!AInColMajorOrder) {
+            // consecutive work-items read consecutive columns
+            m = id / GEMM_TSK;
+            k = id % GEMM_TSK;
+        } else {
+            // consecutive work-items read consecutive rows
+            m = id % GEMM_TSM;
+            k = id / GEMM_TSM;
+        }
+        const int row = offsetM + m;
+        const int col = tile * GEMM_TSK + k;
+        if(row < rowsA && col < colsA) {
+            v = load_float(A, AInColMajorOrder ? offsetA + col * rowsA + row :
+                                                 offsetA + row * colsA + col,
+                           AIsHalf);
+        } else {
+            v = 0.0f;
+        }
+        Asub[k * GEMM_TSM + m] = v;
+    }
+}
+
+/*
+ * Loads the tile number "tile" of the block of cols of B that starts in
+ * offsetN into Bsub. Bsub is stored as Bsub[k][n] independently of the
+ * order of B in global memory. Elements outside of B are loaded as 0.
+ */
+void gemm_load_tile_B(__global const void *B,
+                      int BIsHalf,
+                      __local float *Bsub,
+                      int offsetB,
+                      int tile,
+                      int offsetN,
+                      int rowsB,
+                      int colsB,
+                      int BInColMajorOrder,
+                      int tid)
+{
+    for(int l = 0; l < GEMM_LPTB; l++) {
+        const int id = l * GEMM_THREADS + tid;
+        int n, k;
+        float v;
+        if(!BInColMajorOrder) {
+            n = id % GEMM_TSN;
+            k = id / GEMM_TSN;
+        } else {
+            k = id % GEMM_TSK;
+            n = id / GEMM_TSK;
+        }
+        const int row = tile * GEMM_TSK + k;
+        const int col = offsetN + n;
+        if(row < rowsB && col < colsB) {
+            v = load_float(B, BInColMajorOrder ? offsetB + col * rowsB + row :
+                                                 offsetB + row * colsB + col,
+                           BIsHalf);
+        } else {
+            v = 0.0f;
+        }
+        Bsub[k * GEMM_TSN + n] = v;
+    }
+}
+
+/*
+ * Second generation of the matrix multiplication. Same operation and
+ * epilogue (bias, sigmoid, sigmoid derivative, sumToC) than matrixMultiplicationSigmoidKernelLocal
+ * but both A and B are staged in local memory and double buffered: while
+ * a tile is multiplied the next one is being loaded, so only one barrier
+ * per tile is required. Every work-item calculates a block of
+ * GEMM_WPTM x GEMM_WPTN elements of C in registers.
+ *
+ * Any size is valid: the tiles at the edges of the matrices are loaded
+ * with zeros outside of A and B and only the elements inside of C are
+ * written.
+ *
+ * Required global size = (ceil(colsC / GEMM_TSN) * GEMM_RTSN,
+ *                         ceil(rowsC / GEMM_TSM) * GEMM_RTSM)
+ * Required local size = (GEMM_RTSN, GEMM_RTSM)
+ * Offsets are given in elements (not in float4's).
+ *
+ * A, B, C and derivative can be stored in halfs: bits GEMM_HALF_A,
+ * GEMM_HALF_B, GEMM_HALF_C and GEMM_HALF_DERIVATIVE of storage. The tiles
+ * and the accumulation are always in float.
+ *
+ * Inverted dropout with a mask generated from (row, col, dropoutSeed),
+ * never stored (dropoutMode):
+ *   GEMM_DROPOUT_MASK: the dropped elements of C are 0 and the kept ones
+ *   are divided by keepProbability (activations in FF)
+ *   GEMM_DROPOUT_DERIVATIVE: the same mask applied to the sigmoid
+ *   derivative of derivative, being derivative the masked activations
+ *   (deltas in BP)
+ */
+#define GEMM_HALF_A 1
+#define GEMM_HALF_B 2
+#define GEMM_HALF_C 4
+#define GEMM_HALF_DERIVATIVE 8
+
+#define GEMM_DROPOUT_NONE 0
+#define GEMM_DROPOUT_MASK 1
+#define GEMM_DROPOUT_DERIVATIVE 2
+
+__kernel __attribute__((reqd_work_group_size(GEMM_RTSN, GEMM_RTSM, 1)))
+void matrixMultiplicationSigmoidKernelTiled(__global const void *matrixA,
+                                            __global const void *matrixB,
+                                            __global void *matrixC,
+                                            __global const float *bias,
+                                            int rowsC,
+                                            int colsC,
+                                            int colsA,
+                                            int offsetA,
+                                            int offsetB,
+                                            int offsetC,
+                                            int offsetBias,
+                                            int calcSigmoid,
+                                            int AInColMajorOrder,
+                                            int BInColMajorOrder,
+                                            int sumToMatrixC,
+                                            float multPrevVal,
+                                            float multSum,
+                                            __global const void *derivative,
+                                            int offsetDerivative,
+                                            int storage,
+                                            int dropoutMode,
+                                            uint dropoutSeed,
+                                            uint keepThreshold,
+                                            float keepProbability)
+{
+    const int AIsHalf = storage & GEMM_HALF_A;
+    const int BIsHalf = storage & GEMM_HALF_B;
+    const int CIsHalf = storage & GEMM_HALF_C;
+    const int derivativeIsHalf = storage & GEMM_HALF_DERIVATIVE;
+    
+    __local float Asub[2][GEMM_TSK * GEMM_TSM];
+    __local float Bsub[2][GEMM_TSK * GEMM_TSN];
+
+    const int tidn = get_local_id(0);
+    const int tidm = get_local_id(1);
+    const int tid = tidm * GEMM_RTSN + tidn;
+    const int offsetM = GEMM_TSM * get_group_id(1);
+    const int offsetN = GEMM_TSN * get_group_id(0);
+    
+    float acc[GEMM_WPTM][GEMM_WPTN];
+    for(int wm = 0; wm < GEMM_WPTM; wm++)
+        for(int wn = 0; wn < GEMM_WPTN; wn++)
+            acc[wm][wn] = 0.0f;
+
+    const int numTiles = (colsA + GEMM_TSK - 1) / GEMM_TSK;
+    
+    // first tile
+    gemm_load_tile_A(matrixA, AIsHalf, Asub[0], offsetA, 0, offsetM,
+                     rowsC, colsA, AInColMajorOrder, tid);
+    gemm_load_tile_B(matrixB, BIsHalf, Bsub[0], offsetB, 0, offsetN,
+                     colsA, colsC, BInColMajorOrder, tid);
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for(int t = 0; t < numTiles; t++) {
+        const int cur = t & 1;
+        
+        // prefetch of the next tile into the other buffer
+        if(t + 1 < numTiles) {
+            gemm_load_tile_A(matrixA, AIsHalf, Asub[1 - cur], offsetA, t + 1,
+                             offsetM, rowsC, colsA, AInColMajorOrder, tid);
+            gemm_load_tile_B(matrixB, BIsHalf, Bsub[1 - cur], offsetB, t + 1,
+                             offsetN, colsA, colsC, BInColMajorOrder, tid);
+        }
+        
+        for(int k = 0; k < GEMM_TSK; k++) {
+            float Breg[GEMM_WPTN];
+            for(int wn = 0; wn < GEMM_WPTN; wn++)
+                Breg[wn] = Bsub[cur][k * GEMM_TSN + tidn + wn * GEMM_RTSN];
+            
+            for(int wm = 0; wm < GEMM_WPTM; wm++) {
+                const float Areg = Asub[cur][k * GEMM_TSM + tidm + wm * GEMM_RTSM];
+                for(int wn = 0; wn < GEMM_WPTN; wn++)
+                    acc[wm][wn] = mad(Areg, Breg[wn], acc[wm][wn]);
+            }
+        }
+        // the next tile is loaded and the current one is not used anymore
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    
+    for(int wm = 0; wm < GEMM_WPTM; wm++) {
+        const int row = offsetM + tidm + wm * GEMM_RTSM;
+        if(row >= rowsC) break;
+        for(int wn = 0; wn < GEMM_WPTN; wn++) {
+            const int col = offsetN + tidn + wn * GEMM_RTSN;
+            if(col >= colsC) break;
+            float sum = acc[wm][wn];
+            
+            if(bias != NULL) sum += bias[offsetBias + col];
+            
+            if(calcSigmoid) sum = 1.0f / (1.0f + exp(-sum));
+            
+            if(derivative != NULL) {
+                float a = load_float(derivative,
+                                     offsetDerivative + row*colsC + col,
+                                     derivativeIsHalf);
+                if(dropoutMode == GEMM_DROPOUT_DERIVATIVE) {
+                    if(dropout_keep(row, col, dropoutSeed, keepThreshold)) {
+                        // the activation was divided by keepProbability
+                        a *= keepProbability;
+                        sum *= a * (1.0f - a) / keepProbability;
+                    } else {
+                        sum = 0.0f;
+                    }
+                } else {
+                    sum *= a * (1.0f - a);
+                }
+            }
+            
+            if(dropoutMode == GEMM_DROPOUT_MASK) {
+                sum = dropout_keep(row, col, dropoutSeed, keepThreshold) ?
+                      sum / keepProbability : 0.0f;
+            }
+            
+            const int idx = offsetC + row * colsC + col;
+            if(sumToMatrixC) {
+                sum = multPrevVal * load_float(matrixC, idx, CIsHalf) +
+                      multSum * sum;
+            }
+            store_float(matrixC, idx, sum, CIsHalf);
+        }
+    }
+}
+
+/* Substracts element by element: R = scale*(A - B). NDRange of one
+ * dimension.
+ * Every work-item calculates 4 consecutive elements (vload4/vstore4, so
+ * the offsets do not have to be aligned) and the last one the remaining
+ * n % 4 elements.
  * The dimension should be the total number of elements divided by 4
- * This function is used to calculate the deltas of the output layer.
+ * rounded up. Offsets given in elements.
+ * A, B and R can be stored in halfs (bits 1, 2 and 4 of storage).
+ * This function is used to calculate the deltas of the output layer
+ * (scale is the loss scaling factor).
  */
-__kernel void elementWiseSubstractKernel(__global float4 *A,
-                                         __global float4 *B,
-                                         __global float4* R,
+__kernel void elementWiseSubstractKernel(__global const void *A,
+                                         __global const void *B,
+                                         __global void *R,
+                                         int n,
                                          int offset_A,
                                          int offset_B,
-                                         int offset_R)
+                                         int offset_R,
+                                         int storage,
+                                         float scale)
 {
-    const int i = get_global_id(0);
-    
-    const float4 a = A[offset_A + i];
-    const float4 b = B[offset_B + i];
+    const int i = get_global_id(0) * 4;
+    const int halfA = storage & 1;
+    const int halfB = storage & 2;
+    const int halfR = storage & 4;
     
-    R[offset_R + i] =  a - b;
+    if(i + 4 <= n) {
+        const float4 a = load_float4(A, offset_A + i, halfA);
+        const float4 b = load_float4(B, offset_B + i, halfB);
+        store_float4(R, offset_R + i, scale * (a - b), halfR);
+    } else {
+        for(int j = i; j < n; j++) {
+            const float a = load_float(A, offset_A + j, halfA);
+            const float b = load_float(B, offset_B + j, halfB);
+            store_float(R, offset_R + j, scale * (a - b), halfR);
+        }
+    }
 }
 
-/* Adds element by element. NDRange of one dimension. 
- * Take care that every element is a float4 element.
- * The dimension should be the total number of elements divided by 4
- * This function is used to calculate the deltas of the output layer.
+/* Adds element by element: R = mult_A*A + mult_B*B. Same NDRange and
+ * offsets than elementWiseSubstractKernel.
  */
-__kernel void elementWiseSumKernel(__global float4* A,
-                                   __global float4* B,
-                                   __global float4* R,
+__kernel void elementWiseSumKernel(__global const float *A,
+                                   __global const float *B,
+                                   __global float *R,
+                                   int n,
                                    int offset_A,
                                    int offset_B,
                                    int offset_R,
                                    float mult_A,
                                    float mult_B)
 {
-    const int i = get_global_id(0);
-    
-    const float4 a = mult_A*A[offset_A + i];
-    const float4 b = mult_B*B[offset_B + i];
+    const int i = get_global_id(0) * 4;
     
-    R[offset_R + i] =  a + b;
+    if(i + 4 <= n) {
+        const float4 a = mult_A * vload4(0, A + offset_A + i);
+        const float4 b = mult_B * vload4(0, B + offset_B + i);
+        vstore4(a + b, 0, R + offset_R + i);
+    } else {
+        for(int j = i; j < n; j++) {
+            R[offset_R + j] = mult_A * A[offset_A + j] + mult_B * B[offset_B + j];
+        }
+    }
 }
 
-
+/* del = del * act * (1 - act). Same NDRange and offsets than
+ * elementWiseSubstractKernel.
+ */
 __kernel void elementWiseMultiplicationBySigmoidDerivativeKernel(
-                                         __global float4 *del,
-                                         __global float4 *act,
+                                         __global float *del,
+                                         __global const float *act,
+                                         int n,
                                          int offset_del,
                                          int offset_act)
 {
-    int i = get_global_id(0);
+    const int i = get_global_id(0) * 4;
 
-    float4 a = sigmoid_derivative(act[offset_act + i]);
-    
-    del[offset_del + i] *= a;
+    if(i + 4 <= n) {
+        const float4 a = sigmoid_derivative(vload4(0, act + offset_act + i));
+        const float4 d = vload4(0, del + offset_del + i);
+        vstore4(d * a, 0, del + offset_del + i);
+    } else {
+        for(int j = i; j < n; j++) {
+            const float a = act[offset_act + j];
+            del[offset_del + j] *= a * (1.0f - a);
+        }
+    }
 }
 
+/*
+ * Every work-group sums the cross entropy of its part of the n elements of
+ * t and y (grid-stride, two elements per work-item and iteration) and
+ * writes it in output[group].
+ * Required local size: power of 2. Offsets given in elements.
+ * y can be stored in halfs (halfY).
+ */
+__kernel void crossEntropyKernelLocal(__global const float *t, 
+                                      __global const void *y, 
+                                      __global float *output, 
+                                      __local float *sdata,
+                                      int n,
+                                      int offset_t,
+                                      int offset_y,
+                                      int halfY)
+{
+    const int lid = get_local_id(0);
+    const int lsz = get_local_size(0);
+    const int stride = get_num_groups(0) * lsz * 2;
+    
+    float sum = 0.0f;
+    for(int i = get_group_id(0) * lsz * 2 + lid; i < n; i += stride) {
+        sum += cross_entropy_element(t[offset_t + i],
+                                     load_float(y, offset_y + i, halfY));
+        if(i + lsz < n) {
+            sum += cross_entropy_element(t[offset_t + i + lsz],
+                                         load_float(y, offset_y + i + lsz,
+                                                    halfY));
+        }
+    }
+    
+    sum = local_reduce_sum(sdata, lid, lsz, sum);
+    if(lid == 0) output[get_group_id(0)] = sum;
+}
 
-__kernel void crossEntropyKernelLocal(__global float4* t, 
-                                      __global float4* y, 
-                                      __global float4* output, 
-                                      __local float4* sdata,
-                                      int offset_y)
+/*
+ * Same than crossEntropyKernelLocal for the sum of the squares of the n
+ * elements of W.
+ */
+__kernel void level2RegularizationKernelLocal(__global const float *W, 
+                                              __global float *O, 
+                                              __local float *sdata,
+                                              int n,
+                                              int offset_W)
 {
-    // load shared mem
-    unsigned int tid = get_local_id(0);
-    unsigned int bid = get_group_id(0);
-    unsigned int gid = get_global_id(0);
+    const int lid = get_local_id(0);
+    const int lsz = get_local_size(0);
+    const int stride = get_num_groups(0) * lsz * 2;
+    
+    float sum = 0.0f;
+    for(int i = get_group_id(0) * lsz * 2 + lid; i < n; i += stride) {
+        const float w1 = W[offset_W + i];
+        sum += w1 * w1;
+        if(i + lsz < n) {
+            const float w2 = W[offset_W + i + lsz];
+            sum += w2 * w2;
+        }
+    }
+    
+    sum = local_reduce_sum(sdata, lid, lsz, sum);
+    if(lid == 0) O[get_group_id(0)] = sum;
+}
 
-    unsigned int localSize = get_local_size(0);
-    unsigned int stride = gid * 2;
+// Al finalizar la función se obtiene un vector de output de tamaño igual al número de grupos
+// que hay que sumar, obteniendo el resultado final
+
+/*
+ * Row blocked softmax (in place) of z. Every work-group calculates
+ * get_local_size(1) rows and every row is calculated by get_local_size(0)
+ * work-items that stride over its columns. The maximum of the row is
+ * substracted before the exponential (numerically stable).
+ * Required local size: (power of 2, power of 2).
+ * Global size: (local_size(0), rows rounded up to local_size(1)).
+ * sdata: local_size(0) * local_size(1) floats. Offsets given in elements.
+ * z can be stored in halfs (halfZ).
+ */
+__kernel void softmaxKernelRows(__global void *z,
+                                __local float *sdata,
+                                int rows,
+                                int cols,
+                                int offset_z,
+                                int halfZ)
+{
+    const int lid = get_local_id(0);
+    const int lsz = get_local_size(0);
+    const int row = get_global_id(1);
+    __local float *srow = sdata + get_local_id(1) * lsz;
     
-    float4 y1 = y[offset_y + stride];
-    float4 t1 = t[stride];
-    float4 i1 = cross_entropy(t1, y1);
+    const bool valid = row < rows;
+    const int z0 = offset_z + row * cols;
     
-    float4 y2 = y[offset_y + stride + 1];
-    float4 t2 = t[stride + 1];
-    float4 i2 = cross_entropy(t2, y2);
+    float maximum = -INFINITY;
+    if(valid) {
+        for(int j = lid; j < cols; j += lsz) {
+            maximum = fmax(maximum, load_float(z, z0 + j, halfZ));
+        }
+    }
+    maximum = local_reduce_max(srow, lid, lsz, maximum);
     
-    sdata[tid] = i1 + i2;
-
-    barrier(CLK_LOCAL_MEM_FENCE);
+    float sum = 0.0f;
+    if(valid) {
+        for(int j = lid; j < cols; j += lsz) {
+            sum += exp(load_float(z, z0 + j, halfZ) - maximum);
+        }
+    }
+    sum = local_reduce_sum(srow, lid, lsz, sum);
     
-    // do reduction in shared mem
-    for(unsigned int s = localSize >> 1; s > 0; s >>= 1) 
-    {
-        if(tid < s) 
-        {
-            sdata[tid] += sdata[tid + s];
+    if(valid) {
+        const float inv_sum = 1.0f / sum;
+        for(int j = lid; j < cols; j += lsz) {
+            const float y = exp(load_float(z, z0 + j, halfZ) - maximum) * inv_sum;
+            store_float(z, z0 + j, y, halfZ);
         }
-        barrier(CLK_LOCAL_MEM_FENCE);
     }
+}
 
-    // write result for this block to global mem
-    if(tid == 0) output[bid] = sdata[0];	
+/*
+ * First pass of the softmax of rows with more columns than the work-group
+ * size. Every work-group calculates the maximum and the sum of
+ * exp(z - maximum) of a chunk of local_size columns of one row and stores
+ * them in partials[row * chunks + chunk].
+ * Required local size: (power of 2, 1).
+ * Global size: (chunks * local_size, rows), chunks = ceil(cols / local_size)
+ * z can be stored in halfs (halfZ).
+ */
+__kernel void softmaxPartialKernel(__global const void *z,
+                                   __global float2 *partials,
+                                   __local float *sdata,
+                                   int cols,
+                                   int offset_z,
+                                   int halfZ)
+{
+    const int j = get_global_id(0);
+    const int row = get_global_id(1);
+    const int lid = get_local_id(0);
+    const int lsz = get_local_size(0);
+    const int chunks = get_num_groups(0);
+    
+    const float x = (j < cols) ? load_float(z, offset_z + row * cols + j, halfZ) :
+                                 -INFINITY;
+    const float maximum = local_reduce_max(sdata, lid, lsz, x);
+    const float e = (j < cols) ? exp(x - maximum) : 0.0f;
+    const float sum = local_reduce_sum(sdata, lid, lsz, e);
+    
+    if(lid == 0) partials[row * chunks + get_group_id(0)] = (float2)(maximum, sum);
 }
 
-__kernel void level2RegularizationKernelLocal(__global float4* W, 
-                                              __global float4* O, 
-                                              __local float4* sdata)
+/*
+ * Second pass: combines the partials of the row (sum_i s_i*exp(m_i - M),
+ * being M the maximum of the m_i) and normalizes the chunk in place.
+ * Same sizes than softmaxPartialKernel.
+ */
+__kernel void softmaxNormalizeKernel(__global void *z,
+                                     __global const float2 *partials,
+                                     __local float *sdata,
+                                     int cols,
+                                     int offset_z,
+                                     int halfZ)
 {
-    // load shared mem
-    unsigned int tid = get_local_id(0);
-    unsigned int bid = get_group_id(0);
-    unsigned int gid = get_global_id(0);
+    const int j = get_global_id(0);
+    const int row = get_global_id(1);
+    const int lid = get_local_id(0);
+    const int lsz = get_local_size(0);
+    const int chunks = get_num_groups(0);
+    
+    float maximum = -INFINITY;
+    float sum = 0.0f;
+    for(int c = lid; c < chunks; c += lsz) {
+        const float2 p = partials[row * chunks + c];
+        const float m = fmax(maximum, p.x);
+        sum = sum * exp(maximum - m) + p.y * exp(p.x - m);
+        maximum = m;
+    }
+    
+    const float row_maximum = local_reduce_max(sdata, lid, lsz, maximum);
+    if(lid < chunks) sum *= exp(maximum - row_maximum);
+    const float row_sum = local_reduce_sum(sdata, lid, lsz, sum);
+    
+    if(j < cols) {
+        const int idx = offset_z + row * cols + j;
+        const float y = exp(load_float(z, idx, halfZ) - row_maximum) / row_sum;
+        store_float(z, idx, y, halfZ);
+    }
+}
 
-    unsigned int localSize = get_local_size(0);
-    unsigned int stride = gid * 2;
+/*
+ * Output layer of the training in one pass. For every row of logits z:
+ *  - softmax (numerically stable, the maximum of the row is substracted)
+ *    written in place in z
+ *  - deltas of the output layer: deltaScale * (y - t) (deltaScale is the
+ *    loss scaling factor)
+ *  - if calcCE, cross entropy of the rows of the work-group, reduced into
+ *    ce_partial[group]
+ * Row blocked like softmaxKernelRows: get_local_size(1) rows per work-group,
+ * get_local_size(0) work-items per row.
+ * Required local size: (power of 2, power of 2).
+ * Global size: (local_size(0), rows rounded up to local_size(1)).
+ * sdata: local_size(0) * local_size(1) floats. Offsets given in elements.
+ * z and deltas can be stored in halfs (halfZ, halfDeltas).
+ */
+__kernel void softmaxDeltaCrossEntropyKernel(__global void *z,
+                                             __global const float *t,
+                                             __global void *deltas,
+                                             __global float *ce_partial,
+                                             __local float *sdata,
+                                             int rows,
+                                             int cols,
+                                             int offset_z,
+                                             int offset_t,
+                                             int offset_deltas,
+                                             int calcCE,
+                                             int halfZ,
+                                             int halfDeltas,
+                                             float deltaScale)
+{
+    const int lid = get_local_id(0);
+    const int lsz = get_local_size(0);
+    const int row = get_global_id(1);
+    __local float *srow = sdata + get_local_id(1) * lsz;
+    
+    const bool valid = row < rows;
+    const int z0 = offset_z + row * cols;
+    const int t0 = offset_t + row * cols;
+    const int d0 = offset_deltas + row * cols;
     
-    float4 w1 = W[stride];
-    float4 i1 = w1*w1;
+    float maximum = -INFINITY;
+    if(valid) {
+        for(int j = lid; j < cols; j += lsz) {
+            maximum = fmax(maximum, load_float(z, z0 + j, halfZ));
+        }
+    }
+    maximum = local_reduce_max(srow, lid, lsz, maximum);
     
-    float4 w2 = W[stride + 1];
-    float4 i2 = w2*w2;
+    float sum = 0.0f;
+    if(valid) {
+        for(int j = lid; j < cols; j += lsz) {
+            sum += exp(load_float(z, z0 + j, halfZ) - maximum);
+        }
+    }
+    sum = local_reduce_sum(srow, lid, lsz, sum);
     
-    sdata[tid] = i1 + i2;
+    float ce = 0.0f;
+    if(valid) {
+        const float inv_sum = 1.0f / sum;
+        for(int j = lid; j < cols; j += lsz) {
+            const float y = exp(load_float(z, z0 + j, halfZ) - maximum) * inv_sum;
+            const float target = t[t0 + j];
+            store_float(z, z0 + j, y, halfZ);
+            store_float(deltas, d0 + j, deltaScale * (y - target), halfDeltas);
+            ce += cross_entropy_element(target, y);
+        }
+    }
+    
+    if(calcCE) {
+        // reduction of the whole work-group
+        const int flat = get_local_id(1) * lsz + lid;
+        ce = local_reduce_sum(sdata, flat, lsz * get_local_size(1), ce);
+        if(flat == 0) ce_partial[get_group_id(1)] = ce;
+    }
+}
 
-    barrier(CLK_LOCAL_MEM_FENCE);
+/*
+ * One level of the device reduction: every work-group sums its part of the
+ * n floats of input (starting at offset) and writes it in output[group].
+ * Every work-item adds two elements per iteration and the work-groups
+ * stride over the input, so any number of groups can be launched.
+ * Required local size: power of 2.
+ */
+__kernel void reduceSumKernel(__global const float *input,
+                              __global float *output,
+                              __local float *sdata,
+                              int n,
+                              int offset)
+{
+    const int lid = get_local_id(0);
+    const int lsz = get_local_size(0);
+    const int stride = get_num_groups(0) * lsz * 2;
     
-    // do reduction in shared mem
-    for(unsigned int s = localSize >> 1; s > 0; s >>= 1) 
-    {
-        if(tid < s) 
-        {
-            sdata[tid] += sdata[tid + s];
+    float sum = 0.0f;
+    for(int i = get_group_id(0) * lsz * 2 + lid; i < n; i += stride) {
+        sum += input[offset + i];
+        if(i + lsz < n) sum += input[offset + i + lsz];
+    }
+    
+    sum = local_reduce_sum(sdata, lid, lsz, sum);
+    if(lid == 0) output[get_group_id(0)] = sum;
+}
+
+/* 
+ *  Sums the values of all the rows: 
+ *  bias_inc = multExisting*bias_inc + multNew*sum of rows of A
+ *  Every work-group reduces ROWSUM_TSC columns. Its ROWSUM_RS rows of
+ *  work-items sum the rows lid1, lid1 + ROWSUM_RS, ... (consecutive
+ *  work-items read consecutive columns) and the partial sums are reduced in
+ *  local memory.
+ *  Required local size = (ROWSUM_TSC, ROWSUM_RS). 2 dimensional NDRange =
+ *  (number of columns of A rounded up to ROWSUM_TSC, ROWSUM_RS).
+ *  Offsets given in elements. A can be stored in halfs (halfA).
+ */
+#ifndef ROWSUM_TSC
+#define ROWSUM_TSC 16   // set by the host through the build options
+#endif
+#ifndef ROWSUM_RS
+#define ROWSUM_RS 16    // power of 2
+#endif
+
+__kernel __attribute__((reqd_work_group_size(ROWSUM_TSC, ROWSUM_RS, 1)))
+void rowSumKernel(__global const void *matrixA,
+                  __global float *bias_inc,
+                  int nrRowsA,
+                  int nrColsA,
+                  int offsetA,
+                  int offsetBias,
+                  float multExisting,
+                  float multNew,
+                  int halfA)
+{
+    __local float partial[ROWSUM_RS][ROWSUM_TSC];
+    
+    const int lc = get_local_id(0);
+    const int lr = get_local_id(1);
+    const int col = get_global_id(0);
+    
+    float result = 0.0f;
+    if(col < nrColsA) {
+        for(int i = lr; i < nrRowsA; i += ROWSUM_RS) {
+            result += load_float(matrixA, offsetA + i*nrColsA + col, halfA);
         }
+    }
+    
+    partial[lr][lc] = result;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for(int s = ROWSUM_RS >> 1; s > 0; s >>= 1) {
+        if(lr < s) partial[lr][lc] += partial[lr + s][lc];
         barrier(CLK_LOCAL_MEM_FENCE);
     }
-
-    // write result for this block to global mem
-    if(tid == 0) O[bid] = sdata[0];	
+    
+    if(lr == 0 && col < nrColsA) {
+        // the previous value is not read if it is not used (gradients)
+        const float a = (multExisting == 0.0f) ? 0.0f :
+                        multExisting*bias_inc[offsetBias + col];
+        const float b = multNew*partial[0][lc];
+        
+        bias_inc[offsetBias + col] = a + b;
+    }
 }
 
+/* 
+ *  Multiplies the n elements of matrix by scalar. Same NDRange and offsets
+ *  than elementWiseSubstractKernel.
+ */
+__kernel void matrixScalarMultiplicationKernel
+                          (__global float *matrix,
+                           float scalar,
+                           int n,
+                           int offset)
+{
+    const int i = get_global_id(0) * 4;
+    
+    if(i + 4 <= n) {
+        vstore4(scalar * vload4(0, matrix + offset + i), 0, matrix + offset + i);
+    } else {
+        for(int j = i; j < n; j++) matrix[offset + j] *= scalar;
+    }
+}
 
-// Al finalizar la función se obtiene un vector de output de tamaño igual al número de grupos
-// que hay que sumar, obteniendo el resultado final
+/*
+ *  Copy of n floats of src into dst stored in halfs (round to nearest
+ *  even). Same NDRange than elementWiseSubstractKernel. Offsets given in
+ *  elements.
+ */
+__kernel void floatToHalfKernel(__global const float *src,
+                                __global half *dst,
+                                int n,
+                                int offset_src,
+                                int offset_dst)
+{
+    const int i = get_global_id(0) * 4;
+    
+    if(i + 4 <= n) {
+        vstore_half4_rte(vload4(0, src + offset_src + i), 0, dst + offset_dst + i);
+    } else {
+        for(int j = i; j < n; j++) {
+            vstore_half_rte(src[offset_src + j], offset_dst + j, dst);
+        }
+    }
+}
 
 /*
- * Calculates a softmax of local_size float4's => local_size*4 float elements 
- * Required local_size = number of output elements of the softmax to calculate divided by 4
- * Required global size = all the elements / 4 (floats4)
+ *  Symmetric int8 quantization of n values: dst = round(src * invScale)
+ *  saturated to [-127, 127]. src can be stored in halfs (halfSrc).
+ *  1 dimensional NDRange = n. Offsets given in elements.
  */
-__kernel void softmaxKernelLocal(__global float4* z, 
-                                 __local float4* sdata,
-                                 int offset_z)
+__kernel void quantizeKernel(__global const void *src,
+                             __global char *dst,
+                             int n,
+                             int offset_src,
+                             int offset_dst,
+                             float invScale,
+                             int halfSrc)
 {
-    // load shared mem
-    unsigned int lid = get_local_id(0);
-    unsigned int gid = get_global_id(0);
+    const int i = get_global_id(0);
+    if(i >= n) return;
+    
+    const float q = load_float(src, offset_src + i, halfSrc) * invScale;
+    dst[offset_dst + i] = convert_char_sat_rte(clamp(q, -127.0f, 127.0f));
+}
+
+/*
+ * Int8 inference matrix multiplication: C = A * B with A (rowsC x colsA)
+ * and B (colsA x colsC) quantized in int8 (row major) and accumulated in
+ * int32. Epilogue:
+ *   - dequantization: sum * scaleA * scaleB[col] (scaleA of the whole A,
+ *     scaleB per column of B)
+ *   - + bias[col] and sigmoid (if calcSigmoid)
+ *   - C quantized to int8 with invScaleC (if quantizeC) or stored in
+ *     floats (halfs if halfC)
+ * Any size is valid. scaleB uses the same offset than bias.
+ * Required global size = (colsC, rowsC) rounded up to INT8_TS
+ * Required local size = (INT8_TS, INT8_TS)
+ */
+#ifndef INT8_TS
+#define INT8_TS 16      // set by the host through the build options
+#endif
 
-    unsigned int localSize = get_local_size(0);
+__kernel __attribute__((reqd_work_group_size(INT8_TS, INT8_TS, 1)))
+void matrixMultiplicationInt8Kernel(__global const char *matrixA,
+                                    __global const char *matrixB,
+                                    __global void *matrixC,
+                                    __global const float *bias,
+                                    __global const float *scaleB,
+                                    int rowsC,
+                                    int colsC,
+                                    int colsA,
+                                    int offsetA,
+                                    int offsetB,
+                                    int offsetC,
+                                    int offsetBias,
+                                    float scaleA,
+                                    int calcSigmoid,
+                                    int quantizeC,
+                                    float invScaleC,
+                                    int halfC)
+{
+    __local char Asub[INT8_TS][INT8_TS];
+    __local char Bsub[INT8_TS][INT8_TS];
     
-    unsigned int idx = offset_z + gid;
+    const int col = get_global_id(0);
+    const int row = get_global_id(1);
+    const int lc = get_local_id(0);
+    const int lr = get_local_id(1);
     
-    sdata[lid] = exp(z[idx]);
-    barrier(CLK_LOCAL_MEM_FENCE);
+    int acc = 0;
+    const int numTiles = (colsA + INT8_TS - 1) / INT8_TS;
+    for(int t = 0; t < numTiles; t++) {
+        const int ka = t * INT8_TS + lc;
+        const int kb = t * INT8_TS + lr;
+        Asub[lr][lc] = (row < rowsC && ka < colsA) ?
+                       matrixA[offsetA + row * colsA + ka] : 0;
+        Bsub[lr][lc] = (kb < colsA && col < colsC) ?
+                       matrixB[offsetB + kb * colsC + col] : 0;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        
+        for(int k = 0; k < INT8_TS; k++) {
+            acc += mul24((int) Asub[lr][k], (int) Bsub[k][lc]);
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    
+    if(row >= rowsC || col >= colsC) return;
     
-    // calculate the sum of all the elements
-    float4 sum = (float4) (0.0f);
-    for(int i = 0; i < localSize; i++) {
-        sum += sdata[i];
+    float sum = (float) acc * scaleA * scaleB[offsetBias + col] +
+                bias[offsetBias + col];
+    if(calcSigmoid) sum = 1.0f / (1.0f + exp(-sum));
+    
+    const int idx = offsetC + row * colsC + col;
+    if(quantizeC) {
+        ((__global char *) matrixC)[idx] =
+                    convert_char_sat_rte(clamp(sum * invScaleC, -127.0f, 127.0f));
+    } else {
+        store_float(matrixC, idx, sum, halfC);
     }
+}
+
+/*
+ * Dropout: copies between a matrix of the whole network (all, colsAll
+ * columns) and the matrix of the selected neurons (compact, rows x cols):
+ *   scatter == 0 (gather): compact[r][c] = all[rowIdx[r]][colIdx[c]]
+ *   scatter == 1: all[rowIdx[r]][colIdx[c]] = compact[r][c]
+ * The same copy is done between allInc and compactInc if they are not NULL
+ * (weight increments). rowIdx == NULL selects always the row 0 (bias).
+ * 2 dimensional NDRange = (cols, rows). Offsets given in elements.
+ */
+__kernel void dropoutGatherScatterKernel(__global float *all,
+                                         __global float *compact,
+                                         __global float *allInc,
+                                         __global float *compactInc,
+                                         __global const uint *rowIdx,
+                                         __global const uint *colIdx,
+                                         int colsAll,
+                                         int cols,
+                                         int offsetAll,
+                                         int offsetCompact,
+                                         int offsetRowIdx,
+                                         int offsetColIdx,
+                                         int scatter)
+{
+    const int c = get_global_id(0);
+    const int r = get_global_id(1);
     
-    float total = sum.x + sum.y + sum.z + sum.w;
+    const int rowAll = (rowIdx != NULL) ? rowIdx[offsetRowIdx + r] : 0;
+    const int idxAll = offsetAll + rowAll * colsAll + colIdx[offsetColIdx + c];
+    const int idxCompact = offsetCompact + r * cols + c;
     
-    z[idx] = sdata[lid]/total;
+    if(scatter) {
+        all[idxAll] = compact[idxCompact];
+        if(allInc != NULL) allInc[idxAll] = compactInc[idxCompact];
+    } else {
+        compact[idxCompact] = all[idxAll];
+        if(allInc != NULL) compactInc[idxCompact] = allInc[idxAll];
+    }
 }
 
-/* 
- *  1 dimensional NDRange = number of columns of floats / 4 
- *  Sums the values of all the rows
+/*
+ *  Minibatch gather: row r of dst = row idx[r] of src (training set resident
+ *  in the device, rows of cols elements). dst can be stored in halfs
+ *  (halfDst). 2 dimensional NDRange = (cols, rows). Offsets given in elements.
  */
-__kernel void rowSumKernel(__global float4 * matrixA,
-                           __global float4 *bias_inc,
-                           int nrRowsA,
-                           float multExisting,
-                           float multNew)
+__kernel void gatherRowsKernel(__global const float *src,
+                               __global void *dst,
+                               __global const uint *idx,
+                               int cols,
+                               int offset_dst,
+                               int offset_idx,
+                               int halfDst)
 {
-    const int gid = get_global_id(0);
-    const int gsz = get_global_size(0);
+    const int c = get_global_id(0);
+    const int r = get_global_id(1);
+    
+    const float value = src[idx[offset_idx + r] * cols + c];
+    store_float(dst, offset_dst + r * cols + c, value, halfDst);
+}
 
-    float4 result = (float4) (0.0f);
-    for(int i = 0; i < nrRowsA; i++) {
-        const int idx = i*gsz + gid;
-        result += matrixA[idx];
+#define OPTIMIZER_MOMENTUM 0
+#define OPTIMIZER_NESTEROV 1
+
+/*
+ * Update rules of the optimizer: new parameters w and state v (increment)
+ * from the gradient g (L2 term included). A new rule is a new case; rules
+ * that require more state (Adam, RMSProp) add their buffers to
+ * optimizerUpdateKernel.
+ *   MOMENTUM: v = momentum*v - lr*g; w += v
+ *   NESTEROV: w is kept in the lookahead point (w + momentum*v), so the
+ *             gradient is already the one of the lookahead point
+ *             (Sutskever 2013 reformulated, Bengio 2012):
+ *             v' = momentum*v - lr*g; w += (1 + momentum)*v' - momentum*v
+ */
+void optimizer_rule(int rule, float4 g, float4 *w, float4 *v,
+                    float lr, float momentum)
+{
+    const float4 v_prev = *v;
+    *v = momentum * v_prev - lr * g;
+    switch(rule) {
+        case OPTIMIZER_NESTEROV:
+            *w += (1.0f + momentum) * *v - momentum * v_prev;
+            break;
+        default:    // OPTIMIZER_MOMENTUM
+            *w += *v;
     }
+}
 
-    const float4 a = multExisting*bias_inc[gid];
-    const float4 b = multNew*result;
+/*
+ *  Fused optimizer step of n parameters: reads once the parameter, the state
+ *  and the gradient and writes once the parameter and the state.
+ *    g = gradScale*gradient + l2*w
+ *  The three buffers have the same layout (same offset). Same NDRange than
+ *  elementWiseSubstractKernel. Offsets given in elements.
+ */
+__kernel void optimizerUpdateKernel(__global float *w,
+                                    __global float *state,
+                                    __global const float *gradient,
+                                    int n,
+                                    int offset,
+                                    int rule,
+                                    float lr,
+                                    float momentum,
+                                    float l2,
+                                    float gradScale)
+{
+    const int i = get_global_id(0) * 4;
     
-    bias_inc[gid] = a + b;
+    if(i + 4 <= n) {
+        float4 wv = vload4(0, w + offset + i);
+        float4 v = vload4(0, state + offset + i);
+        const float4 g = gradScale * vload4(0, gradient + offset + i) +
+                         l2 * wv;
+        optimizer_rule(rule, g, &wv, &v, lr, momentum);
+        vstore4(wv, 0, w + offset + i);
+        vstore4(v, 0, state + offset + i);
+    } else {
+        // one element in every component
+        for(int j = offset + i; j < offset + n; j++) {
+            float4 wv = (float4)(w[j]);
+            float4 v = (float4)(state[j]);
+            const float4 g = (float4)(gradScale * gradient[j] + l2 * w[j]);
+            optimizer_rule(rule, g, &wv, &v, lr, momentum);
+            w[j] = wv.x;
+            state[j] = v.x;
+        }
+    }
 }
 
-/* 
- *  1 dimensional NDRange = number of columns of floats / 4 
- *  Sums the values of all the rows
+/*
+ * Classification results of rows x cols outputs. Every work-item calculates
+ * the argmax (first maximum) of one row of the predictions y and of the
+ * one-hot targets t:
+ *  - the rows with the same argmax are reduced in the work-group and added
+ *    to correct[offset_correct] (one atomic per work-group)
+ *  - if calcConfusion, confusion[offset_confusion + target*cols + prediction]
+ *    is incremented (cols x cols matrix)
+ * The counters are only incremented (cleared by the host).
+ * Required local size: power of 2. sdata: local size floats.
+ * Global size: rows rounded up to the local size. Offsets given in elements.
+ * y can be stored in halfs (halfY).
  */
-__kernel void matrixScalarMultiplicationKernel
-                          (__global float4 * matrix,
-                           float scalar)
+__kernel void classificationKernel(__global const void *y,
+                                   __global const float *t,
+                                   __global uint *correct,
+                                   __global uint *confusion,
+                                   __local float *sdata,
+                                   int rows,
+                                   int cols,
+                                   int offset_y,
+                                   int offset_t,
+                                   int offset_correct,
+                                   int offset_confusion,
+                                   int calcConfusion,
+                                   int halfY)
 {
-    const int gid = get_global_id(0);
-    matrix[gid] *= scalar;
+    const int row = get_global_id(0);
+    const int lid = get_local_id(0);
+    
+    float hit = 0.0f;
+    if(row < rows) {
+        const int y0 = offset_y + row * cols;
+        const int t0 = offset_t + row * cols;
+        float max_y = load_float(y, y0, halfY);
+        float max_t = t[t0];
+        int prediction = 0;
+        int target = 0;
+        for(int j = 1; j < cols; j++) {
+            const float vy = load_float(y, y0 + j, halfY);
+            const float vt = t[t0 + j];
+            if(vy > max_y) {
+                max_y = vy;
+                prediction = j;
+            }
+            if(vt > max_t) {
+                max_t = vt;
+                target = j;
+            }
+        }
+        if(prediction == target) hit = 1.0f;
+        if(calcConfusion) {
+            atomic_inc(&confusion[offset_confusion + target * cols + prediction]);
+        }
+    }
+    
+    // exact in float up to 2^24 rows per work-group
+    hit = local_reduce_sum(sdata, lid, get_local_size(0), hit);
+    if(lid == 0 && hit > 0.0f) {
+        atomic_add(&correct[offset_correct], (uint) hit);
+    }
 }
 
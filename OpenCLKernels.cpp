@@ -5,59 +5,93 @@
  * Created on 23 de octubre de 2014, 10:25
  */
 
+#include <algorithm>
 #include <string>
 #include <vector>
 #include <iostream>
+#include <sstream>
 #include <boost/math/common_factor.hpp>
 
 #include "OpenCLKernels.hpp"
 #include "common.hpp"
 
+// Kernel sources embedded at build time. NN_Kernels.inc is generated from
+// NN_Kernels.cl by the Makefile as a raw string literal.
+const char * const OpenCLKernels::kernelSource =
+#include "NN_Kernels.inc"
+;
+
 OpenCLKernels::~OpenCLKernels() {
+    delete classificationKernel;
+    delete optimizerUpdateKernel;
+    delete gatherRowsKernel;
+    delete dropoutGatherScatterKernel;
+    delete matrixMultiplicationInt8Kernel;
+    delete quantizeKernel;
+    delete floatToHalfKernel;
     delete matrixScalarMultiplicationKernel;
     delete rowSumKernel;
-    delete softmaxKernelLocal;
+    delete softmaxDeltaCrossEntropyKernel;
+    delete softmaxNormalizeKernel;
+    delete softmaxPartialKernel;
+    delete softmaxKernelRows;
+    delete softmaxPartials;
+    delete reduceSumKernel;
+    delete reductionResult;
+    delete reductionScratch[1];
+    delete reductionScratch[0];
     delete elementWiseMultiplicationBySigmoidDerivativeKernel;
     delete crossEntropyKernelLocal;
     delete level2RegularizationKernelLocal;
     delete elementWiseSubstractKernel;
     delete elementWiseSumKernel;
+    delete tuner;
+    for (cl::Kernel *k : gemmTileKernels) delete k;
+    for (cl::Program *p : gemmTilePrograms) delete p;
+    delete matrixMultiplicationSigmoidKernelTiled;
     delete matrixMultiplicationSigmoidKernel;
     delete program;
 }
 
 void OpenCLKernels::opencl_init() {
-    // create a CL program using kernel source
-    std::string sourceString;
-    readfile(sourceFile, sourceString);
+    maxWorkGroupSize =
+        devices[device_id].getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+    localMemSize = devices[device_id].getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
     
-    cl::Program::Sources sources;
-    sources.push_back(std::make_pair(sourceString.c_str(), 0));
-    // don't need to specify length as we used a null terminated string
-
-    // create the OpenCL program
-    program = new cl::Program(context, sources);
-    
-    try {
-        program->build(devices);
-    } catch(const cl::Error &e) {
-        // get compilation log in case of failure
-     std::cout << "Build Status: "
-        << program->getBuildInfo<CL_PROGRAM_BUILD_STATUS>(devices[device_id])
-        << std::endl;
-     std::cout << "Build Options:\t"
-        << program->getBuildInfo<CL_PROGRAM_BUILD_OPTIONS>(devices[device_id])
-        << std::endl;
-     std::cout << "Build Log:\t "
-        << program->getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[device_id])
-        << std::endl;
+    // fixed work-group sizes (reqd_work_group_size) of rowSumKernel and
+    // matrixMultiplicationInt8Kernel within the limit of the device
+    while (rowSumTileCols*rowSumRowSplit > maxWorkGroupSize) {
+        if (rowSumRowSplit > 1) rowSumRowSplit /= 2;
+        else rowSumTileCols /= 2;
     }
+    while (int8TileSize*int8TileSize > maxWorkGroupSize) int8TileSize /= 2;
+    
+    program = build_program(build_options(gemmTiles[0]));
+    // the other tile configurations are built if the tuner uses them
+    gemmTilePrograms.assign(gemmTiles.size(), nullptr);
+    gemmTileKernels.assign(gemmTiles.size(), nullptr);
     
     lds = true;
+    
+    tuner = new kernel_tuner(devices[device_id]);
+    
+    // the first level of runReduceSum launches at most local size groups
+    const size_t scratch_bytes =
+        pow2_local_size(reduceSumLocalSize) * sizeof(cl_float);
+    reductionScratch[0] = new cl::Buffer(context, CL_MEM_READ_WRITE,
+                                         scratch_bytes);
+    reductionScratch[1] = new cl::Buffer(context, CL_MEM_READ_WRITE,
+                                         scratch_bytes);
+    reductionResult = new cl::Buffer(context, CL_MEM_READ_WRITE,
+                                     sizeof(cl_float));
+    
     try {
       matrixMultiplicationSigmoidKernel =
           new cl::Kernel(*program,
                            matrixMultiplicationSigmoidKernel_name.c_str());
+      matrixMultiplicationSigmoidKernelTiled =
+          new cl::Kernel(*program,
+                           matrixMultiplicationSigmoidKernelTiled_name.c_str());
       elementWiseSubstractKernel =
             new cl::Kernel(*program,
                            elementWiseSubstractKernel_name.c_str());
@@ -77,9 +111,25 @@ void OpenCLKernels::opencl_init() {
       elementWiseMultiplicationBySigmoidDerivativeKernel =
             new cl::Kernel(*program,
                            elementWiseMultiplicationBySigmoidDerivativeKernel_name.c_str());
-      softmaxKernelLocal =
+      softmaxKernelRows =
+              new cl::Kernel(*program,
+                             softmaxKernelRows_name.c_str());
+      
+      softmaxPartialKernel =
+              new cl::Kernel(*program,
+                             softmaxPartialKernel_name.c_str());
+      
+      softmaxNormalizeKernel =
+              new cl::Kernel(*program,
+                             softmaxNormalizeKernel_name.c_str());
+      
+      softmaxDeltaCrossEntropyKernel =
+              new cl::Kernel(*program,
+                             softmaxDeltaCrossEntropyKernel_name.c_str());
+      
+      reduceSumKernel =
               new cl::Kernel(*program,
-                             softmaxKernelLocal_name.c_str());
+                             reduceSumKernel_name.c_str());
       
       rowSumKernel =
               new cl::Kernel(*program,
@@ -89,13 +139,180 @@ void OpenCLKernels::opencl_init() {
               new cl::Kernel(*program,
                              matrixScalarMultiplicationKernel_name.c_str());
       
+      floatToHalfKernel = 
+              new cl::Kernel(*program,
+                             floatToHalfKernel_name.c_str());
+      
+      dropoutGatherScatterKernel = 
+              new cl::Kernel(*program,
+                             dropoutGatherScatterKernel_name.c_str());
+      
+      gatherRowsKernel = 
+              new cl::Kernel(*program,
+                             gatherRowsKernel_name.c_str());
+      
+      optimizerUpdateKernel = 
+              new cl::Kernel(*program,
+                             optimizerUpdateKernel_name.c_str());
+      
+      quantizeKernel = 
+              new cl::Kernel(*program,
+                             quantizeKernel_name.c_str());
+      
+      matrixMultiplicationInt8Kernel = 
+              new cl::Kernel(*program,
+                             matrixMultiplicationInt8Kernel_name.c_str());
+      
+      classificationKernel = 
+              new cl::Kernel(*program,
+                             classificationKernel_name.c_str());
+      
     } catch(const cl::Error &e) {
         std::cout << e.err() << e.what() << std::endl;
     }
 }
 
+std::string OpenCLKernels::build_options(const gemm_tile &tile) const {
+    std::ostringstream options;
+    options << "-D GEMM_TSM=" << tile.tileM
+            << " -D GEMM_TSN=" << tile.tileN
+            << " -D GEMM_TSK=" << tile.tileK
+            << " -D GEMM_WPTM=" << tile.workPerItemM
+            << " -D GEMM_WPTN=" << tile.workPerItemN
+            << " -D ROWSUM_TSC=" << rowSumTileCols
+            << " -D ROWSUM_RS=" << rowSumRowSplit
+            << " -D INT8_TS=" << int8TileSize;
+    return options.str();
+}
+
+cl::Program * OpenCLKernels::build_program(const std::string &options) {
+    const std::string sourceString(kernelSource);
+    const std::vector<cl::Device> device(1, devices[device_id]);
+    
+    // a previous compilation for the same device, driver, options and
+    // source avoids compiling again
+    program_cache cache(devices[device_id], sourceString, options);
+    cl::Program *p = cache.load(context);
+    if (p != nullptr) return p;
+    
+    // create a CL program using kernel source
+    cl::Program::Sources sources;
+    sources.push_back(std::make_pair(sourceString.c_str(), 0));
+    // don't need to specify length as we used a null terminated string
+
+    // create the OpenCL program
+    p = new cl::Program(context, sources);
+    
+    try {
+        p->build(device, options.c_str());
+        cache.save(*p);
+    } catch(const cl::Error &e) {
+        // get compilation log in case of failure
+     std::cout << "Build Status: "
+        << p->getBuildInfo<CL_PROGRAM_BUILD_STATUS>(devices[device_id])
+        << std::endl;
+     std::cout << "Build Options:\t"
+        << p->getBuildInfo<CL_PROGRAM_BUILD_OPTIONS>(devices[device_id])
+        << std::endl;
+     std::cout << "Build Log:\t "
+        << p->getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[device_id])
+        << std::endl;
+    }
+    return p;
+}
+
+cl::Kernel & OpenCLKernels::tiled_gemm_kernel(size_t tile) {
+    if (tile == 0) return *matrixMultiplicationSigmoidKernelTiled;
+    if (gemmTileKernels[tile] == nullptr) {
+        if (gemmTilePrograms[tile] == nullptr) {
+            gemmTilePrograms[tile] = build_program(
+                                        build_options(gemmTiles[tile]));
+        }
+        // throws if the build failed (the tuner discards the tile)
+        gemmTileKernels[tile] = new cl::Kernel(
+                        *gemmTilePrograms[tile],
+                        matrixMultiplicationSigmoidKernelTiled_name.c_str());
+    }
+    return *gemmTileKernels[tile];
+}
+
+bool OpenCLKernels::gemm_tile_supported(const gemm_tile &tile) const {
+    const size_t threads = (tile.tileM / tile.workPerItemM) *
+                           (tile.tileN / tile.workPerItemN);
+    // double buffered tiles of A and B
+    const size_t local_bytes = 2 * tile.tileK * (tile.tileM + tile.tileN) *
+                               sizeof(cl_float);
+    return threads <= maxWorkGroupSize && local_bytes <= localMemSize;
+}
+
+compute_event OpenCLKernels::launch(const cl::Kernel &kernel,
+                                const cl::NDRange &global,
+                                const cl::NDRange &local,
+                                const std::vector<compute_event> *waitList) {
+    const std::vector<cl::Event> events = to_cl_events(waitList);
+    cl::Event event;
+    queue.enqueueNDRangeKernel(kernel,
+                               cl::NullRange,
+                               global,
+                               local,
+                               &events,
+                               &event);
+    if (prof != nullptr) {
+        prof->record(kernel.getInfo<CL_KERNEL_FUNCTION_NAME>(), event);
+    }
+    if (synchronous) event.wait();
+    return to_compute_event(event);
+}
+
+cl_uint OpenCLKernels::tune(const std::string &key,
+                            const std::vector<cl_uint> &candidates,
+                            const std::function<void(cl_uint)> &trial) {
+    profiler *p = prof;
+    prof = nullptr;
+    const cl_uint winner = tuner->tune(key, candidates, trial, queue);
+    prof = p;
+    return winner;
+}
+
+compute_event OpenCLKernels::marker(
+                            const std::vector<compute_event> *waitList) {
+    // an empty wait list waits for all the previous commands
+    const std::vector<cl::Event> events = to_cl_events(waitList);
+    cl::Event event;
+    queue.enqueueMarkerWithWaitList(&events, &event);
+    return to_compute_event(event);
+}
+
+void OpenCLKernels::flush() {
+    queue.flush();
+}
+
+void OpenCLKernels::wait(const std::vector<compute_event> &waitList) {
+    const std::vector<cl::Event> events = to_cl_events(&waitList);
+    if (!events.empty()) cl::Event::waitForEvents(events);
+}
+
+compute_event OpenCLKernels::runCopy(
+            matrix_float const &src,
+            matrix_float const &dst,
+            const std::vector<compute_event> *waitList) {
+    assert(src.rows*src.cols == dst.rows*dst.cols);
+    assert(!src.isHalf() && !dst.isHalf());
+    
+    const std::vector<cl::Event> events = to_cl_events(waitList);
+    cl::Event event;
+    queue.enqueueCopyBuffer(device_buffer(src), device_buffer(dst),
+                            src.offset*sizeof(cl_float),
+                            dst.offset*sizeof(cl_float),
+                            src.rows*src.cols*sizeof(cl_float),
+                            &events, &event);
+    if (prof != nullptr) prof->record("copyBuffer", event);
+    if (synchronous) event.wait();
+    return to_compute_event(event);
+}
+
 /*
- * Requirements to use this function: All the sizes must be multiple of 16. TESTED (OK)
+ * Any size is valid. TESTED (OK)
  * 
  * setBias = true --> Fixes the first column to 1 (used when calculating activations in order
  * to use the first neuron of the layer as bias (output = 1.0 always)
@@ -105,27 +322,147 @@ void OpenCLKernels::opencl_init() {
  * sumToC = true --> instead of assigning the result of A*B to C, makes the next operation:
  * 
  *  C = multPrevVal * Cprevious + multSum * Ccalculated
+ * 
+ * sigmoidDerivative != nullptr --> before being stored the result is multiplied
+ * element by element by a*(1-a), being a the values of sigmoidDerivative
+ * (same size than C). Used in backpropagation to save a pass over C.
+ * 
+ * The tiled kernel (A and B cached in local memory) is used unless
+ * setTiledGemm(false) has been called and the sizes and offsets are valid
+ * for matrixMultiplicationSigmoidKernelLocal.
+ * 
+ * Any of A, B, C and sigmoidDerivative can be stored in halfs (only
+ * supported by the tiled kernel). The accumulation is always in floats.
+ * 
+ * dropout != nullptr --> inverted dropout mask of the result (FF) or of
+ * the sigmoid derivative (BP) generated by the kernel (only tiled kernel).
  */
- void OpenCLKernels::
-     runMatrixMultiplicationSigmoid(matrix_cl_float const &A,
-                                    matrix_cl_float const &B,
-                                    matrix_cl_float const &C,
-                                    matrix_cl_float *bias,
+ compute_event OpenCLKernels::
+     runMatrixMultiplicationSigmoid(matrix_float const &A,
+                                    matrix_float const &B,
+                                    matrix_float const &C,
+                                    matrix_float *bias,
                                     bool calcSigmoid,
                                     bool sumToC,
                                     cl_float multPrevVal,
-                                    cl_float multSum) {  
-     // It's correct, cols and rows are in this order
-    const size_t global_size[2] = {size_t(C.cols/4),
-                                   size_t(C.rows/4)};
-    
+                                    cl_float multSum,
+                                    matrix_float const *sigmoidDerivative,
+                                    dropout_mask const *dropout,
+                                    const std::vector<compute_event> *waitList) {  
     // Check size compatibility
     assert(C.rows == A.rows && C.cols == B.cols && A.cols == B.rows);
     
-    // Check A and B sizes are multiple of 16
-    assert((global_size[0] % 4 == 0 ) && (global_size[1] % 4 == 0));
+    assert(sigmoidDerivative == nullptr ||
+           (sigmoidDerivative->rows == C.rows &&
+            sigmoidDerivative->cols == C.cols));
     
-    size_t blocksize = 4;
+    // configuration gemmTiledConfiguration + t is the tiled kernel with
+    // the tile t, any lower value is the blocksize of
+    // matrixMultiplicationSigmoidKernelLocal
+    assert(dropout == nullptr || !dropout->derivative ||
+           sigmoidDerivative != nullptr);
+    
+    const bool legacy = legacy_gemm_supported(A, B, C, bias,
+                                              sigmoidDerivative, dropout);
+    cl_uint configuration = default_gemm_configuration(A, C, legacy);
+    
+    // only the tiled kernel can be used if legacy == false
+    const std::vector<cl_uint> candidates = gemm_configurations(A, C, legacy);
+    if (autotuning && candidates.size() > 1) {
+        std::ostringstream key;
+        // storage of A, B, C and the derivative (halfs) and epilogue
+        // (bias, sigmoid, derivative) change the best configuration
+        const cl_int derivativeHalf = (sigmoidDerivative == nullptr)?0:
+                                      sigmoidDerivative->isHalf();
+        key << "gemm:"
+            << A.rows << "x" << A.cols << "x" << C.cols << ":"
+            << A.colMajorOrdered << B.colMajorOrdered << ":" << legacy << ":"
+            << A.isHalf() << B.isHalf() << C.isHalf() << derivativeHalf
+            << ":" << (bias != nullptr) << calcSigmoid
+            << (sigmoidDerivative != nullptr);
+        if (!tuner->lookup(key.str(), configuration)) {
+            // sumToC trials modify C. Keep a copy to restore it after
+            // every trial (C can be stored in halfs).
+            const size_t element = C.data.deviceElementSize();
+            const size_t c_bytes = C.rows*C.cols*element;
+            cl::Buffer backup(context, CL_MEM_READ_WRITE, c_bytes);
+            const std::vector<cl::Event> events = to_cl_events(waitList);
+            queue.enqueueCopyBuffer(device_buffer(C), backup,
+                                    C.offset*element, 0, c_bytes,
+                                    &events);
+            auto trial = [&](cl_uint conf) {
+                if (conf >= gemmTiledConfiguration) {
+                    runMatrixMultiplicationSigmoidTiled(A, B, C, bias,
+                            calcSigmoid, sumToC, multPrevVal, multSum,
+                            sigmoidDerivative, nullptr,
+                            conf - gemmTiledConfiguration, nullptr);
+                } else {
+                    runMatrixMultiplicationSigmoidLocal(A, B, C, bias,
+                            calcSigmoid, sumToC, multPrevVal, multSum,
+                            sigmoidDerivative, conf, nullptr);
+                }
+                if (sumToC) {
+                    queue.enqueueCopyBuffer(backup, device_buffer(C),
+                                            0, C.offset*element,
+                                            c_bytes);
+                }
+            };
+            configuration = tune(key.str(), candidates, trial);
+        }
+    }
+    
+    if (configuration >= gemmTiledConfiguration) {
+        return runMatrixMultiplicationSigmoidTiled(A, B, C, bias, calcSigmoid,
+                                                   sumToC, multPrevVal,
+                                                   multSum, sigmoidDerivative,
+                                                   dropout,
+                                                   configuration -
+                                                   gemmTiledConfiguration,
+                                                   waitList);
+    }
+    return runMatrixMultiplicationSigmoidLocal(A, B, C, bias, calcSigmoid,
+                                               sumToC, multPrevVal, multSum,
+                                               sigmoidDerivative,
+                                               configuration, waitList);
+}
+
+/*
+ * matrixMultiplicationSigmoidKernelLocal works with float4's and blocks of
+ * 4x4 float4's: all the sizes must be multiple of 16 and all the offsets
+ * multiple of 4. The tiled kernel accepts any size and storage.
+ */
+bool OpenCLKernels::legacy_gemm_supported(
+                        matrix_float const &A,
+                        matrix_float const &B,
+                        matrix_float const &C,
+                        matrix_float const *bias,
+                        matrix_float const *sigmoidDerivative,
+                        dropout_mask const *dropout) const {
+    if (dropout != nullptr) return false;
+    if (A.isHalf() || B.isHalf() || C.isHalf() ||
+        (sigmoidDerivative != nullptr && sigmoidDerivative->isHalf())) {
+        return false;
+    }
+    return C.rows % 16 == 0 && C.cols % 16 == 0 && A.cols % 16 == 0 &&
+           A.offset % 4 == 0 && B.offset % 4 == 0 && C.offset % 4 == 0 &&
+           (bias == nullptr || bias->offset % 4 == 0) &&
+           (sigmoidDerivative == nullptr || sigmoidDerivative->offset % 4 == 0);
+}
+
+/*
+ * Launch configuration used when the tuner is not active
+ */
+cl_uint OpenCLKernels::default_gemm_configuration(matrix_float const &A,
+                                                  matrix_float const &C,
+                                                  bool legacy) {
+    if (tiledGemm || !legacy) {
+        return gemmTiledConfiguration;
+    }
+    
+    const size_t global_size[2] = {size_t(C.cols/4),
+                                   size_t(C.rows/4)};
+    
+    cl_uint blocksize = 4;
     
     // if possible use a greater blocksize
     if((global_size[0] % 8 == 0) &&
@@ -137,16 +474,66 @@ void OpenCLKernels::opencl_init() {
     else if(global_size[0] == 1 || global_size[1] == 1)
         blocksize = 1;
     
+    return blocksize;
+}
+
+/*
+ * All the valid launch configurations for the sizes of the matrices
+ */
+std::vector<cl_uint> OpenCLKernels::gemm_configurations(
+                                        matrix_float const &A,
+                                        matrix_float const &C,
+                                        bool legacy) {
+    std::vector<cl_uint> configurations;
+    if (tiledGemm || !legacy) {
+        for (size_t t = 0; t < gemmTiles.size(); t++) {
+            // the default one is always a candidate
+            if (t == 0 || gemm_tile_supported(gemmTiles[t])) {
+                configurations.push_back(gemmTiledConfiguration + t);
+            }
+        }
+    }
+    if (!legacy) return configurations;
+    
+    const size_t global_size[2] = {size_t(C.cols/4),
+                                   size_t(C.rows/4)};
+    for (cl_uint blocksize = 1; blocksize <= 16; blocksize *= 2) {
+        if (global_size[0] % blocksize == 0 &&
+            global_size[1] % blocksize == 0 &&
+            (A.cols/4) % blocksize == 0 &&
+            blocksize*blocksize <= maxWorkGroupSize) {
+            configurations.push_back(blocksize);
+        }
+    }
+    return configurations;
+}
+
+compute_event OpenCLKernels::
+     runMatrixMultiplicationSigmoidLocal(matrix_float const &A,
+                                         matrix_float const &B,
+                                         matrix_float const &C,
+                                         matrix_float *bias,
+                                         bool calcSigmoid,
+                                         bool sumToC,
+                                         cl_float multPrevVal,
+                                         cl_float multSum,
+                                         matrix_float const *sigmoidDerivative,
+                                         size_t blocksize,
+                                         const std::vector<compute_event> *waitList) {
+     // It's correct, cols and rows are in this order
+    const size_t global_size[2] = {size_t(C.cols/4),
+                                   size_t(C.rows/4)};
+    
     // float4 elements in kernel
     const size_t local_size[2] = { blocksize, blocksize };
 
     // -----------------------------------------------------------------------
     // Setting kernel arguments
     // -----------------------------------------------------------------------
-    matrixMultiplicationSigmoidKernel->setArg(0, *(A.data.deviceData));
-    matrixMultiplicationSigmoidKernel->setArg(1, *(B.data.deviceData));
-    matrixMultiplicationSigmoidKernel->setArg(2, *(C.data.deviceData));
-    matrixMultiplicationSigmoidKernel->setArg(3, (bias==nullptr)?cl::Buffer(0):*(bias->data.deviceData));
+    matrixMultiplicationSigmoidKernel->setArg(0, device_buffer(A));
+    matrixMultiplicationSigmoidKernel->setArg(1, device_buffer(B));
+    matrixMultiplicationSigmoidKernel->setArg(2, device_buffer(C));
+    matrixMultiplicationSigmoidKernel->setArg(3, (bias==nullptr)?cl::Buffer(0):device_buffer(*bias));
     matrixMultiplicationSigmoidKernel->setArg(4, A.cols);
     matrixMultiplicationSigmoidKernel->setArg(5, A.offset/4);
     matrixMultiplicationSigmoidKernel->setArg(6, B.offset/4);
@@ -166,6 +553,11 @@ void OpenCLKernels::opencl_init() {
           multPrevVal); // If sumToC== true value that multiplies the result previous to sum
     matrixMultiplicationSigmoidKernel->setArg(15,
           multSum); // If sumToC== true value that multiplies the result previous to sum
+    matrixMultiplicationSigmoidKernel->setArg(16,
+          (sigmoidDerivative==nullptr)?cl::Buffer(0):
+          device_buffer(*sigmoidDerivative)); // activations of the derivative
+    matrixMultiplicationSigmoidKernel->setArg(17,
+          (sigmoidDerivative==nullptr)?0:sigmoidDerivative->offset/4);
     
     // -----------------------------------------------------------------------
     // Define ndrange iteration space: global and local sizes based on
@@ -175,304 +567,841 @@ void OpenCLKernels::opencl_init() {
     // how work is devided among work-groups and work-items.
     // -----------------------------------------------------------------------
     
-    const cl::NDRange offset = cl::NullRange;
     const cl::NDRange global(global_size[0], global_size[1]);
     const cl::NDRange local(local_size[0], local_size[1]);
-    queue.enqueueNDRangeKernel(*matrixMultiplicationSigmoidKernel,
-                               offset,
-                               global,
-                               local);
-    queue.finish();
+    return launch(*matrixMultiplicationSigmoidKernel, global, local, waitList);
 }
 
 
-void OpenCLKernels::runElementWiseSubstract(
-            matrix_cl_float const &tm,
-            matrix_cl_float const &ym,
-            matrix_cl_float &em) {
+/*
+ * Same operation than runMatrixMultiplicationSigmoid using the kernel that
+ * stages A and B tiles in local memory with the tile configuration
+ * gemmTiles[tile]. Any size is valid, the edge tiles are bounds checked.
+ */
+compute_event OpenCLKernels::
+     runMatrixMultiplicationSigmoidTiled(matrix_float const &A,
+                                         matrix_float const &B,
+                                         matrix_float const &C,
+                                         matrix_float *bias,
+                                         bool calcSigmoid,
+                                         bool sumToC,
+                                         cl_float multPrevVal,
+                                         cl_float multSum,
+                                         matrix_float const *sigmoidDerivative,
+                                         dropout_mask const *dropout,
+                                         size_t tile,
+                                         const std::vector<compute_event> *waitList) {
+    cl::Kernel &kernel = tiled_gemm_kernel(tile);
+    const gemm_tile &t = gemmTiles[tile];
+    kernel.setArg(0, device_buffer(A));
+    kernel.setArg(1, device_buffer(B));
+    kernel.setArg(2, device_buffer(C));
+    kernel.setArg(3, (bias==nullptr)?cl::Buffer(0):device_buffer(*bias));
+    kernel.setArg(4, C.rows);
+    kernel.setArg(5, C.cols);
+    kernel.setArg(6, A.cols);
+    kernel.setArg(7, A.offset);
+    kernel.setArg(8, B.offset);
+    kernel.setArg(9, C.offset);
+    kernel.setArg(10, (bias==nullptr)?0:bias->offset);
+    kernel.setArg(11, calcSigmoid?1:0);
+    kernel.setArg(12, A.colMajorOrdered?1:0);
+    kernel.setArg(13, B.colMajorOrdered?1:0);
+    kernel.setArg(14, sumToC?1:0);
+    kernel.setArg(15, multPrevVal);
+    kernel.setArg(16, multSum);
+    kernel.setArg(17, (sigmoidDerivative==nullptr)?cl::Buffer(0):
+                      device_buffer(*sigmoidDerivative));
+    kernel.setArg(18, (sigmoidDerivative==nullptr)?0:sigmoidDerivative->offset);
+    // storage of the matrices (GEMM_HALF_A | GEMM_HALF_B | ...)
+    kernel.setArg(19, cl_int(A.isHalf() | (B.isHalf() << 1) |
+                             (C.isHalf() << 2) |
+                             ((sigmoidDerivative==nullptr)?0:
+                              (sigmoidDerivative->isHalf() << 3))));
+    // dropout mode (GEMM_DROPOUT_NONE, _MASK, _DERIVATIVE), seed and keep
+    // probability (also as a threshold of the 32 bits random numbers)
+    const cl_float keep = (dropout==nullptr)?1.0f:dropout->keep;
+    const cl_uint threshold = (keep >= 1.0f)?0xFFFFFFFFu:
+                              cl_uint(keep*4294967296.0);
+    kernel.setArg(20, cl_int((dropout==nullptr)?0:
+                             (dropout->derivative?2:1)));
+    kernel.setArg(21, (dropout==nullptr)?cl_uint(0):dropout->seed);
+    kernel.setArg(22, threshold);
+    kernel.setArg(23, keep);
+    
+    // every work-item calculates workPerItemM x workPerItemN values.
+    // The work-groups of the edges are partially outside of C.
+    const size_t groups_n = (C.cols + t.tileN - 1) / t.tileN;
+    const size_t groups_m = (C.rows + t.tileM - 1) / t.tileM;
+    const cl::NDRange global(groups_n * (t.tileN / t.workPerItemN),
+                             groups_m * (t.tileM / t.workPerItemM));
+    const cl::NDRange local(t.tileN / t.workPerItemN,
+                            t.tileM / t.workPerItemM);
+    return launch(kernel, global, local, waitList);
+}
+
+compute_event OpenCLKernels::runElementWiseSubstract(
+            matrix_float const &tm,
+            matrix_float const &ym,
+            matrix_float &em,
+            cl_float scale,
+            const std::vector<compute_event> *waitList) {
 
     assert(tm.cols == ym.cols && tm.rows == ym.rows &&
            tm.cols == em.cols && tm.rows == em.rows);
     
-    //const size_t blockSize = 512;  // float4's
-    const size_t data_size_float4_global = ym.rows*ym.cols/4;
+    const size_t n = ym.rows*ym.cols;
     
-    size_t global_size[1] = {data_size_float4_global};
+    // every work-item calculates 4 elements
+    size_t global_size[1] = {(n + 3)/4};
 
-    elementWiseSubstractKernel->setArg(0, *(tm.data.deviceData));
-    elementWiseSubstractKernel->setArg(1, *(ym.data.deviceData));
-    elementWiseSubstractKernel->setArg(2, *(em.data.deviceData));
-    elementWiseSubstractKernel->setArg(3, tm.offset/4);
-    elementWiseSubstractKernel->setArg(4, ym.offset/4);
-    elementWiseSubstractKernel->setArg(5, em.offset/4);
+    elementWiseSubstractKernel->setArg(0, device_buffer(tm));
+    elementWiseSubstractKernel->setArg(1, device_buffer(ym));
+    elementWiseSubstractKernel->setArg(2, device_buffer(em));
+    elementWiseSubstractKernel->setArg(3, cl_int(n));
+    elementWiseSubstractKernel->setArg(4, tm.offset);
+    elementWiseSubstractKernel->setArg(5, ym.offset);
+    elementWiseSubstractKernel->setArg(6, em.offset);
+    elementWiseSubstractKernel->setArg(7, cl_int(tm.isHalf() |
+                                                 (ym.isHalf() << 1) |
+                                                 (em.isHalf() << 2)));
+    elementWiseSubstractKernel->setArg(8, scale);
     
-    const cl::NDRange offset = cl::NullRange;
     const cl::NDRange global(global_size[0]);
     //const cl::NDRange local(local_size[0]);
-    queue.enqueueNDRangeKernel(*elementWiseSubstractKernel,
-                               offset,
-                               global/*,
-                               local*/);
-    queue.finish();
+    return launch(*elementWiseSubstractKernel, global, cl::NullRange, waitList);
 }
 
-void OpenCLKernels::runElementWiseSum(
-            matrix_cl_float const &a,
-            matrix_cl_float const &b,
-            matrix_cl_float &c,
+compute_event OpenCLKernels::runElementWiseSum(
+            matrix_float const &a,
+            matrix_float const &b,
+            matrix_float &c,
             cl_float mult_a,
-            cl_float mult_b) {
+            cl_float mult_b,
+            const std::vector<compute_event> *waitList) {
 
     assert(a.cols == b.cols && a.rows == b.rows &&
            a.cols == c.cols && a.rows == c.rows);
+    // only for matrices stored in floats (weights and increments)
+    assert(!a.isHalf() && !b.isHalf() && !c.isHalf());
     
-    //const size_t blockSize = 512;  // float4's
-    const size_t data_size_float4_global = b.rows*b.cols/4;
-    
-    size_t global_size[1] = {data_size_float4_global};
-    //size_t local_size[1] = {boost::math::gcd(blockSize, global_size[0])};
+    const size_t n = b.rows*b.cols;
     
-    //assert(global_size[0] % local_size[0] == 0);
+    // every work-item calculates 4 elements
+    size_t global_size[1] = {(n + 3)/4};
 
-    elementWiseSumKernel->setArg(0, *(a.data.deviceData));
-    elementWiseSumKernel->setArg(1, *(b.data.deviceData));
-    elementWiseSumKernel->setArg(2, *(c.data.deviceData));
-    elementWiseSumKernel->setArg(3, a.offset/4);
-    elementWiseSumKernel->setArg(4, b.offset/4);
-    elementWiseSumKernel->setArg(5, c.offset/4);
-    elementWiseSumKernel->setArg(6, mult_a);
-    elementWiseSumKernel->setArg(7, mult_b);
+    elementWiseSumKernel->setArg(0, device_buffer(a));
+    elementWiseSumKernel->setArg(1, device_buffer(b));
+    elementWiseSumKernel->setArg(2, device_buffer(c));
+    elementWiseSumKernel->setArg(3, cl_int(n));
+    elementWiseSumKernel->setArg(4, a.offset);
+    elementWiseSumKernel->setArg(5, b.offset);
+    elementWiseSumKernel->setArg(6, c.offset);
+    elementWiseSumKernel->setArg(7, mult_a);
+    elementWiseSumKernel->setArg(8, mult_b);
     
-    const cl::NDRange offset = cl::NullRange;
     const cl::NDRange global(global_size[0]);
     //const cl::NDRange local(local_size[0]);
-    queue.enqueueNDRangeKernel(*elementWiseSumKernel,
-                               offset,
-                               global/*,
-                               local*/);
-    queue.finish();
+    return launch(*elementWiseSumKernel, global, cl::NullRange, waitList);
 }
 
 // NOT TESTED YET
-void OpenCLKernels::runElementWiseMultiplicationBySigmoidDerivativeKernel(
-            matrix_cl_float const &deltas,
-            matrix_cl_float const &activations) {
+compute_event OpenCLKernels::runElementWiseMultiplicationBySigmoidDerivativeKernel(
+            matrix_float const &deltas,
+            matrix_float const &activations,
+            const std::vector<compute_event> *waitList) {
 
     assert(deltas.cols == activations.cols
            && deltas.rows == activations.rows);
+    assert(!deltas.isHalf() && !activations.isHalf());
     
-    //const size_t blockSize = 512;  // float4's
-    const size_t data_size_float4_global = deltas.rows*deltas.cols/4;
+    const size_t n = deltas.rows*deltas.cols;
     
-    size_t global_size[1] = {data_size_float4_global};
-    //size_t local_size[1] = {boost::math::gcd(blockSize, global_size[0])};
-    
-    //assert(global_size[0] % local_size[0] == 0);
+    // every work-item calculates 4 elements
+    size_t global_size[1] = {(n + 3)/4};
 
     elementWiseMultiplicationBySigmoidDerivativeKernel->
-        setArg(0, *(deltas.data.deviceData));
+        setArg(0, device_buffer(deltas));
+    elementWiseMultiplicationBySigmoidDerivativeKernel->
+        setArg(1, device_buffer(activations));
     elementWiseMultiplicationBySigmoidDerivativeKernel->
-        setArg(1, *(activations.data.deviceData));
+        setArg(2, cl_int(n));
     elementWiseMultiplicationBySigmoidDerivativeKernel->
-        setArg(2, deltas.offset/4);
+        setArg(3, deltas.offset);
     elementWiseMultiplicationBySigmoidDerivativeKernel->
-        setArg(3, activations.offset/4);
+        setArg(4, activations.offset);
     
-    const cl::NDRange offset = cl::NullRange;
     const cl::NDRange global(global_size[0]);
     //const cl::NDRange local(local_size[0]);
-    queue.enqueueNDRangeKernel(
-        *elementWiseMultiplicationBySigmoidDerivativeKernel,
-        offset,
-        global/*,
-        local*/);
-    queue.finish();
-}
-
-cl_float OpenCLKernels::runCrossEntropy(matrix_cl_float const &t,
-                                        matrix_cl_float const &y,
-                                        matrix_cl_float &error) {
-    // proposed blockSize
-    const size_t blockSize = 512;  // float4's (8kBytes)
-    
-    const size_t data_size_float4_global = y.rows*y.cols/4;
-
-    size_t global_size[1] = {data_size_float4_global / 2};
-    // global_size es múltiplo de 8. 
-    // Aprovechamos éste hecho para fijar local_size
-    size_t local_size[1] = {8};
-    
-    if(global_size[0] <= blockSize) {
-        local_size[0] = global_size[0];
-    } else {
-        size_t resto = global_size[0] / 8;  // sabemos que es divisible
-        if(resto <= blockSize) {
-            local_size[0] = resto;
-        } 
-    }
-    
-    
+    return launch(*elementWiseMultiplicationBySigmoidDerivativeKernel,
+                  global,
+                  cl::NullRange,
+                  waitList);
+}
+
+cl_float OpenCLKernels::runCrossEntropy(matrix_float const &t,
+                                        matrix_float const &y,
+                                        matrix_float &error,
+                                        const std::vector<compute_event> *waitList) {
+    assert(t.rows == y.rows && t.cols == y.cols);
     
-    assert(data_size_float4_global * 4 <= error.data.hostData.size());    
-    //assert(global_size[0] % local_size[0] == 0);
+    const size_t n = y.rows*y.cols;
     
     // -----------------------------------------------------------------------
     // Setting kernel arguments
     // -----------------------------------------------------------------------
-    crossEntropyKernelLocal->setArg(0, *(t.data.deviceData));
-    crossEntropyKernelLocal->setArg(1, *(y.data.deviceData));
-    crossEntropyKernelLocal->setArg(2, *(error.data.deviceData));
+    crossEntropyKernelLocal->setArg(0, device_buffer(t));
+    crossEntropyKernelLocal->setArg(1, device_buffer(y));
+    crossEntropyKernelLocal->setArg(2, device_buffer(error));
+    crossEntropyKernelLocal->setArg(4, cl_int(n));
+    crossEntropyKernelLocal->setArg(5, t.offset);
+    crossEntropyKernelLocal->setArg(6, y.offset);
+    crossEntropyKernelLocal->setArg(7, y.isHalf());
+
+    // local size (tuned if the tuner is active)
+    const size_t local_size =
+        reduction_local_size(crossEntropyKernelLocal_name,
+                             n,
+                             [&](cl_uint l) {
+                                 crossEntropyKernelLocal->setArg(3,
+                                     cl::Local(l * sizeof(cl_float)));
+                                 launch(*crossEntropyKernelLocal,
+                                        cl::NDRange(reduction_groups(n, l)*l),
+                                        cl::NDRange(l),
+                                        nullptr);
+                             });
+    const size_t groups = reduction_groups(n, local_size);
+    assert(groups <= error.data.hostData.size());
+    
     crossEntropyKernelLocal->setArg(3,
-                           cl::Local(local_size[0] * 4 * sizeof(cl_float)));
-    crossEntropyKernelLocal->setArg(4, y.offset/4);
+                           cl::Local(local_size * sizeof(cl_float)));
 
-    // -----------------------------------------------------------------------
-    // Define ndrange iteration space: global and local sizes based on
-    // parameters obtained from user
+    const cl::NDRange global(groups * local_size);
+    const cl::NDRange local(local_size);
+    std::vector<compute_event> ce_event(1,
+        launch(*crossEntropyKernelLocal, global, local, waitList));
 
-    // Refer to the sample documentation for clarification about
-    // how work is devided among work-groups and work-items.
+    // the partials of the work-groups are summed on device
+    ce_event.assign(1, runReduceSum(device_buffer(error), 0, groups,
+                                    &ce_event));
+    
+    // only point where the host has to wait for the device
+    const cl_float ce = readReduceSum(&ce_event);
+    
+    //return -ce/(y.rows*y.cols);
+    return -ce/(y.rows);
+}
+
+cl_float OpenCLKernels::runL2Regularization(matrix_float const &weights,
+                                            matrix_float &error,
+                                            const std::vector<compute_event> *waitList) {
+    const size_t n = weights.rows*weights.cols;
+    assert(!weights.isHalf());
+    
+    // -----------------------------------------------------------------------
+    // Setting kernel arguments
     // -----------------------------------------------------------------------
+    level2RegularizationKernelLocal->setArg(0, device_buffer(weights));
+    level2RegularizationKernelLocal->setArg(1, device_buffer(error));
+    level2RegularizationKernelLocal->setArg(3, cl_int(n));
+    level2RegularizationKernelLocal->setArg(4, weights.offset);
+
+    // local size (tuned if the tuner is active)
+    const size_t local_size =
+        reduction_local_size(level2RegularizationKernelLocal_name,
+                             n,
+                             [&](cl_uint l) {
+                                 level2RegularizationKernelLocal->setArg(2,
+                                     cl::Local(l * sizeof(cl_float)));
+                                 launch(*level2RegularizationKernelLocal,
+                                        cl::NDRange(reduction_groups(n, l)*l),
+                                        cl::NDRange(l),
+                                        nullptr);
+                             });
+    const size_t groups = reduction_groups(n, local_size);
+    assert(groups <= error.data.hostData.size());
     
-    const cl::NDRange offset = cl::NullRange;
-    const cl::NDRange global(global_size[0]);
-    const cl::NDRange local(local_size[0]);
-    queue.enqueueNDRangeKernel(*crossEntropyKernelLocal, offset, global, local);
-    queue.finish();
+    level2RegularizationKernelLocal->setArg(2,
+                            cl::Local(local_size * sizeof(cl_float)));
 
-    //std::cout << "CE kernel finished\n";
+    const cl::NDRange global(groups * local_size);
+    const cl::NDRange local(local_size);
+    std::vector<compute_event> l2_event(1,
+        launch(*level2RegularizationKernelLocal, global, local, waitList));
+
+    // the partials of the work-groups are summed on device
+    l2_event.assign(1, runReduceSum(device_buffer(error), 0, groups,
+                                    &l2_event));
     
-    error.data.readFromDevice(queue);
+    // only point where the host has to wait for the device
+    return readReduceSum(&l2_event);
+}
 
-    const size_t error_size = 4 * global_size[0]/local_size[0];
-    std::vector<cl_float> & e = error.data.hostData;
-    cl_float ce = 0.0;
-    for (size_t i = 0; i < error_size; i++) {
-        ce += e[i];
+/*
+ * Local size of the first level reduction kernels (crossEntropyKernelLocal
+ * and level2RegularizationKernelLocal) for n elements. The reduction
+ * requires a power of 2.
+ */
+size_t OpenCLKernels::reduction_local_size(
+                    const std::string &kernel_name,
+                    size_t n,
+                    const std::function<void(cl_uint)> &trial) {
+    cl_uint local_size = pow2_local_size(reduceSumLocalSize);
+    
+    if (!autotuning) return local_size;
+    
+    std::ostringstream key;
+    key << kernel_name << ":" << n;
+    if (tuner->lookup(key.str(), local_size)) return local_size;
+    
+    std::vector<cl_uint> candidates;
+    for (size_t l = 1; l <= pow2_local_size(maxWorkGroupSize); l *= 2) {
+        candidates.push_back(l);
+    }
+    return tune(key.str(), candidates, trial);
+}
+
+/*
+ * Work-groups of a grid-stride reduction of n elements: two elements per
+ * work-item and at most local_size work-groups, so the next level is only
+ * one work-group.
+ */
+size_t OpenCLKernels::reduction_groups(size_t n, size_t local_size) const {
+    return std::min((n + 2*local_size - 1) / (2*local_size), local_size);
+}
+
+size_t OpenCLKernels::pow2_local_size(size_t preferred) const {
+    size_t local_size = 1;
+    while (local_size*2 <= std::min(preferred, maxWorkGroupSize)) {
+        local_size *= 2;
+    }
+    return local_size;
+}
+
+void OpenCLKernels::softmax_layout(cl_uint cols,
+                                   size_t &row_size,
+                                   size_t &rows_per_group) const {
+    const size_t max_local_size = pow2_local_size(softmaxLocalSize);
+    row_size = 1;
+    while (row_size < cols && row_size < max_local_size) row_size *= 2;
+    rows_per_group = max_local_size / row_size;
+}
+
+compute_event OpenCLKernels::runSoftMax(
+            matrix_float const &activations,
+            const std::vector<compute_event> *waitList) {
+    
+    const size_t max_local_size = pow2_local_size(softmaxLocalSize);
+    
+    if (activations.cols <= max_local_size) {
+        // several rows per work-group
+        size_t row_size, rows_per_group;
+        softmax_layout(activations.cols, row_size, rows_per_group);
+        const size_t groups =
+            (activations.rows + rows_per_group - 1) / rows_per_group;
+        
+        softmaxKernelRows->setArg(0, device_buffer(activations));
+        softmaxKernelRows->setArg(1, cl::Local(row_size * rows_per_group *
+                                               sizeof(cl_float)));
+        softmaxKernelRows->setArg(2, activations.rows);
+        softmaxKernelRows->setArg(3, activations.cols);
+        softmaxKernelRows->setArg(4, activations.offset);
+        softmaxKernelRows->setArg(5, activations.isHalf());
+        
+        const cl::NDRange global(row_size, groups * rows_per_group);
+        const cl::NDRange local(row_size, rows_per_group);
+        return launch(*softmaxKernelRows, global, local, waitList);
     }
     
-    //return -ce/(y.rows*y.cols);
-    return -ce/(y.rows);
+    // the row does not fit in a work-group: (max, sum) per chunk of the row
+    // and normalization with the combination of the chunks
+    const size_t chunks =
+        (activations.cols + max_local_size - 1) / max_local_size;
+    const size_t partials_bytes =
+        activations.rows * chunks * 2 * sizeof(cl_float);
+    if (partials_bytes > softmaxPartialsSize) {
+        delete softmaxPartials;
+        softmaxPartials = new cl::Buffer(context, CL_MEM_READ_WRITE,
+                                         partials_bytes);
+        softmaxPartialsSize = partials_bytes;
+    }
+    
+    const cl::NDRange global(chunks * max_local_size, activations.rows);
+    const cl::NDRange local(max_local_size, 1);
+    
+    softmaxPartialKernel->setArg(0, device_buffer(activations));
+    softmaxPartialKernel->setArg(1, *softmaxPartials);
+    softmaxPartialKernel->setArg(2,
+                                 cl::Local(max_local_size * sizeof(cl_float)));
+    softmaxPartialKernel->setArg(3, activations.cols);
+    softmaxPartialKernel->setArg(4, activations.offset);
+    softmaxPartialKernel->setArg(5, activations.isHalf());
+    
+    std::vector<compute_event> deps;
+    deps.push_back(launch(*softmaxPartialKernel, global, local, waitList));
+    
+    softmaxNormalizeKernel->setArg(0, device_buffer(activations));
+    softmaxNormalizeKernel->setArg(1, *softmaxPartials);
+    softmaxNormalizeKernel->setArg(2,
+                                 cl::Local(max_local_size * sizeof(cl_float)));
+    softmaxNormalizeKernel->setArg(3, activations.cols);
+    softmaxNormalizeKernel->setArg(4, activations.offset);
+    softmaxNormalizeKernel->setArg(5, activations.isHalf());
+    
+    return launch(*softmaxNormalizeKernel, global, local, &deps);
+}
+
+compute_event OpenCLKernels::runSoftMaxDeltaCrossEntropy(
+            matrix_float const &y,
+            matrix_float const &t,
+            matrix_float const &deltas,
+            matrix_float *ce_partial,
+            cl_float deltaScale,
+            const std::vector<compute_event> *waitList) {
+    
+    assert(!t.isHalf());
+    assert(y.rows == t.rows && y.cols == t.cols &&
+           y.rows == deltas.rows && y.cols == deltas.cols);
+    
+    size_t row_size, rows_per_group;
+    softmax_layout(y.cols, row_size, rows_per_group);
+    const size_t groups = (y.rows + rows_per_group - 1) / rows_per_group;
+    
+    if (ce_partial != nullptr) {
+        assert(groups <= ce_partial->data.hostData.size());
+    }
+    
+    cl::Kernel &kernel = *softmaxDeltaCrossEntropyKernel;
+    kernel.setArg(0, device_buffer(y));
+    kernel.setArg(1, device_buffer(t));
+    kernel.setArg(2, device_buffer(deltas));
+    kernel.setArg(3, (ce_partial==nullptr)?cl::Buffer(0):
+                                           device_buffer(*ce_partial));
+    kernel.setArg(4, cl::Local(row_size * rows_per_group * sizeof(cl_float)));
+    kernel.setArg(5, y.rows);
+    kernel.setArg(6, y.cols);
+    kernel.setArg(7, y.offset);
+    kernel.setArg(8, t.offset);
+    kernel.setArg(9, deltas.offset);
+    kernel.setArg(10, (ce_partial==nullptr)?0:1);
+    kernel.setArg(11, y.isHalf());
+    kernel.setArg(12, deltas.isHalf());
+    kernel.setArg(13, deltaScale);
+    
+    const cl::NDRange global(row_size, groups * rows_per_group);
+    const cl::NDRange local(row_size, rows_per_group);
+    return launch(kernel, global, local, waitList);
 }
 
-cl_float OpenCLKernels::runL2Regularization(matrix_cl_float const &weights,
-                                            matrix_cl_float &error) {
-    // proposed blockSize
-    const size_t blockSize = 512;  // float4's (8kBytes)
+cl_float OpenCLKernels::readCrossEntropyPartials(
+            matrix_float &ce_partial,
+            cl_uint rows,
+            cl_uint cols,
+            const std::vector<compute_event> *waitList) {
+    size_t row_size, rows_per_group;
+    softmax_layout(cols, row_size, rows_per_group);
+    const size_t groups = (rows + rows_per_group - 1) / rows_per_group;
     
-    const size_t data_size_float4_global = weights.rows*weights.cols/4;
+    std::vector<compute_event> sum_event(1,
+        runReduceSum(device_buffer(ce_partial), 0, groups, waitList));
+    return -readReduceSum(&sum_event)/rows;
+}
 
-    size_t global_size[1] = {data_size_float4_global / 2};
-    // global_size es múltiplo de 8. 
-    // Aprovechamos éste hecho para fijar local_size
-    size_t local_size[1] = {8};
+/*
+ * Reduction of n floats to one in several levels of reduceSumKernel. Every
+ * level launches at most local size work-groups, each one summing its part
+ * of the input, and the next level reduces the partial sums of the previous
+ * one (ping-ponging between the two scratch buffers) until only one
+ * work-group is required, that writes the result in reductionResult.
+ */
+compute_event OpenCLKernels::runReduceSum(
+            const cl::Buffer &input,
+            size_t offset,
+            size_t n,
+            const std::vector<compute_event> *waitList) {
+    assert(n > 0);
+    
+    const size_t local_size = pow2_local_size(reduceSumLocalSize);
+    
+    const cl::Buffer *src = &input;
+    size_t src_offset = offset;
+    size_t count = n;
+    size_t ping = 0;
+    
+    std::vector<compute_event> deps;
+    const std::vector<compute_event> *wait = waitList;
     
-    if(global_size[0] <= blockSize) {
-        local_size[0] = global_size[0];
-    } else {
-        size_t resto = global_size[0] / 8;  // sabemos que es divisible
-        if(resto <= blockSize) {
-            local_size[0] = resto;
-        } 
+    while (true) {
+        const size_t groups = reduction_groups(count, local_size);
+        const cl::Buffer *dst = (groups == 1)?reductionResult:
+                                              reductionScratch[ping];
+        
+        reduceSumKernel->setArg(0, *src);
+        reduceSumKernel->setArg(1, *dst);
+        reduceSumKernel->setArg(2, cl::Local(local_size * sizeof(cl_float)));
+        reduceSumKernel->setArg(3, cl_int(count));
+        reduceSumKernel->setArg(4, cl_int(src_offset));
+        
+        deps.assign(1, launch(*reduceSumKernel,
+                              cl::NDRange(groups * local_size),
+                              cl::NDRange(local_size),
+                              wait));
+        if (groups == 1) return deps[0];
+        
+        wait = &deps;
+        src = dst;
+        src_offset = 0;
+        count = groups;
+        ping = 1 - ping;
     }
+}
+
+cl_float OpenCLKernels::readReduceSum(const std::vector<compute_event> *waitList) {
+    cl_float value;
+    const std::vector<cl::Event> events = to_cl_events(waitList);
+    cl::Event event;
+    queue.enqueueReadBuffer(*reductionResult,
+                            CL_TRUE,
+                            0,
+                            sizeof(cl_float),
+                            &value,
+                            &events,
+                            &event);
+    if (prof != nullptr) prof->record("readBuffer", event);
+    return value;
+}
+
+compute_event OpenCLKernels::readReduceSumAsync(
+            cl_float &value,
+            const std::vector<compute_event> *waitList) {
+    const std::vector<cl::Event> events = to_cl_events(waitList);
+    cl::Event event;
+    queue.enqueueReadBuffer(*reductionResult,
+                            CL_FALSE,
+                            0,
+                            sizeof(cl_float),
+                            &value,
+                            &events,
+                            &event);
+    if (prof != nullptr) prof->record("readBuffer", event);
+    return to_compute_event(event);
+}
+
+compute_event OpenCLKernels::runRowSum(
+            matrix_float &A, 
+            matrix_float &result,
+            cl_float multExisting,
+            cl_float multNew,
+            const std::vector<compute_event> *waitList) {
     
-    assert(data_size_float4_global * 4 <= error.data.hostData.size());    
-    //assert(global_size[0] % local_size[0] == 0);
+    assert(result.rows*result.cols == A.cols && !result.isHalf());
     
-    // -----------------------------------------------------------------------
-    // Setting kernel arguments
-    // -----------------------------------------------------------------------
-    level2RegularizationKernelLocal->setArg(0, *(weights.data.deviceData));
-    level2RegularizationKernelLocal->setArg(1, *(error.data.deviceData));
-    level2RegularizationKernelLocal->setArg(2,
-                            cl::Local(local_size[0] * 4 * sizeof(cl_float)));
+    rowSumKernel->setArg(0, device_buffer(A));
+    rowSumKernel->setArg(1, device_buffer(result));
+    rowSumKernel->setArg(2, A.rows);
+    rowSumKernel->setArg(3, A.cols);
+    rowSumKernel->setArg(4, A.offset);
+    rowSumKernel->setArg(5, result.offset);
+    rowSumKernel->setArg(6, multExisting);
+    rowSumKernel->setArg(7, multNew);
+    rowSumKernel->setArg(8, A.isHalf());
+    
+    // one work-group per rowSumTileCols columns, the rows are split between
+    // its rowSumRowSplit rows of work-items
+    const size_t tc = rowSumTileCols;
+    const cl::NDRange global((A.cols + tc - 1) / tc * tc, rowSumRowSplit);
+    const cl::NDRange local(tc, rowSumRowSplit);
+    return launch(*rowSumKernel, global, local, waitList);
+}
 
-    // -----------------------------------------------------------------------
-    // Define ndrange iteration space: global and local sizes based on
-    // parameters obtained from user
+compute_event OpenCLKernels::runMatrixScalarMultiplication(
+            matrix_float const &matrix,
+            cl_float scalar,
+            const std::vector<compute_event> *waitList) {
+    
+    const size_t n = matrix.cols * matrix.rows;
+    assert(!matrix.isHalf());
+    
+    // every work-item calculates 4 elements
+    size_t global_size[1] = {(n + 3)/4};
+    
+    matrixScalarMultiplicationKernel->setArg(0, device_buffer(matrix));
+    matrixScalarMultiplicationKernel->setArg(1, scalar);
+    matrixScalarMultiplicationKernel->setArg(2, cl_int(n));
+    matrixScalarMultiplicationKernel->setArg(3, matrix.offset);
+    
+    const cl::NDRange global(global_size[0]);
+    return launch(*matrixScalarMultiplicationKernel,
+                  global,
+                  cl::NullRange,
+                  waitList);
+}
 
-    // Refer to the sample documentation for clarification about
-    // how work is devided among work-groups and work-items.
-    // -----------------------------------------------------------------------
+compute_event OpenCLKernels::runConvertToHalf(
+            matrix_float const &src,
+            matrix_float const &dst,
+            const std::vector<compute_event> *waitList) {
+    
+    assert(src.rows*src.cols == dst.rows*dst.cols);
+    assert(!src.isHalf() && dst.isHalf());
+    
+    const size_t n = src.cols * src.rows;
+    
+    // every work-item converts 4 elements
+    size_t global_size[1] = {(n + 3)/4};
+    
+    floatToHalfKernel->setArg(0, device_buffer(src));
+    floatToHalfKernel->setArg(1, device_buffer(dst));
+    floatToHalfKernel->setArg(2, cl_int(n));
+    floatToHalfKernel->setArg(3, src.offset);
+    floatToHalfKernel->setArg(4, dst.offset);
     
-    const cl::NDRange offset = cl::NullRange;
     const cl::NDRange global(global_size[0]);
-    const cl::NDRange local(local_size[0]);
-    queue.enqueueNDRangeKernel(*level2RegularizationKernelLocal, offset, global, local);
-    queue.finish();
+    return launch(*floatToHalfKernel,
+                  global,
+                  cl::NullRange,
+                  waitList);
+}
 
-    //std::cout << "CE kernel finished\n";
+compute_event OpenCLKernels::runQuantize(
+            matrix_float const &src,
+            matrix_char const &dst,
+            cl_float invScale,
+            const std::vector<compute_event> *waitList) {
     
-    error.data.readFromDevice(queue);
+    assert(src.rows*src.cols == dst.rows*dst.cols);
+    
+    const size_t n = src.cols * src.rows;
+    
+    quantizeKernel->setArg(0, device_buffer(src));
+    quantizeKernel->setArg(1, device_buffer(dst));
+    quantizeKernel->setArg(2, cl_int(n));
+    quantizeKernel->setArg(3, src.offset);
+    quantizeKernel->setArg(4, dst.offset);
+    quantizeKernel->setArg(5, invScale);
+    quantizeKernel->setArg(6, src.isHalf());
+    
+    const cl::NDRange global(n);
+    return launch(*quantizeKernel, global, cl::NullRange, waitList);
+}
 
-    const size_t error_size = 4 * global_size[0]/local_size[0];
-    std::vector<cl_float> & e = error.data.hostData;
-    cl_float sumsqr = 0.0;
-    for (size_t i = 0; i < error_size; i++) {
-        sumsqr += e[i];
-    }
+compute_event OpenCLKernels::runMatrixMultiplicationInt8(
+            matrix_char const &A,
+            matrix_char const &B,
+            matrix_char const &C,
+            matrix_float const &bias,
+            matrix_float const &scaleB,
+            cl_float scaleA,
+            cl_float invScaleC,
+            bool calcSigmoid,
+            const std::vector<compute_event> *waitList) {
+    assert(C.rows == A.rows && C.cols == B.cols);
+    return launchMatrixMultiplicationInt8(A, B, device_buffer(C),
+                                          C.offset, C.cols, bias, scaleB,
+                                          scaleA, calcSigmoid, true,
+                                          invScaleC, 0, waitList);
+}
+
+compute_event OpenCLKernels::runMatrixMultiplicationInt8(
+            matrix_char const &A,
+            matrix_char const &B,
+            matrix_float const &C,
+            matrix_float const &bias,
+            matrix_float const &scaleB,
+            cl_float scaleA,
+            bool calcSigmoid,
+            const std::vector<compute_event> *waitList) {
+    assert(C.rows == A.rows && C.cols == B.cols);
+    return launchMatrixMultiplicationInt8(A, B, device_buffer(C),
+                                          C.offset, C.cols, bias, scaleB,
+                                          scaleA, calcSigmoid, false,
+                                          1.0f, C.isHalf(), waitList);
+}
+
+compute_event OpenCLKernels::launchMatrixMultiplicationInt8(
+            matrix_char const &A,
+            matrix_char const &B,
+            const cl::Buffer &C,
+            cl_uint offsetC,
+            cl_uint colsC,
+            matrix_float const &bias,
+            matrix_float const &scaleB,
+            cl_float scaleA,
+            bool calcSigmoid,
+            bool quantizeC,
+            cl_float invScaleC,
+            cl_int halfC,
+            const std::vector<compute_event> *waitList) {
+    // only row major matrices (the quantized copies are never transposed)
+    assert(A.cols == B.rows && !A.colMajorOrdered && !B.colMajorOrdered);
+    assert(bias.offset == scaleB.offset);
+    
+    cl::Kernel &kernel = *matrixMultiplicationInt8Kernel;
+    kernel.setArg(0, device_buffer(A));
+    kernel.setArg(1, device_buffer(B));
+    kernel.setArg(2, C);
+    kernel.setArg(3, device_buffer(bias));
+    kernel.setArg(4, device_buffer(scaleB));
+    kernel.setArg(5, A.rows);
+    kernel.setArg(6, colsC);
+    kernel.setArg(7, A.cols);
+    kernel.setArg(8, A.offset);
+    kernel.setArg(9, B.offset);
+    kernel.setArg(10, offsetC);
+    kernel.setArg(11, bias.offset);
+    kernel.setArg(12, scaleA);
+    kernel.setArg(13, calcSigmoid?1:0);
+    kernel.setArg(14, quantizeC?1:0);
+    kernel.setArg(15, invScaleC);
+    kernel.setArg(16, halfC);
     
-    return sumsqr;
+    // one work-item per element of C, rounded up to the tile size
+    const size_t ts = int8TileSize;
+    const cl::NDRange global((colsC + ts - 1) / ts * ts,
+                             (A.rows + ts - 1) / ts * ts);
+    const cl::NDRange local(ts, ts);
+    return launch(kernel, global, local, waitList);
 }
 
+compute_event OpenCLKernels::runDropoutGatherScatter(
+            matrix_float const &all,
+            matrix_float const &compact,
+            matrix_float const *allInc,
+            matrix_float const *compactInc,
+            matrix_uint const *rowIdx,
+            matrix_uint const &colIdx,
+            bool scatter,
+            const std::vector<compute_event> *waitList) {
+    
+    assert((allInc == nullptr) == (compactInc == nullptr));
+    assert(rowIdx != nullptr || compact.rows == 1);
+    assert(!all.isHalf() && !compact.isHalf());
+    
+    cl::Kernel &kernel = *dropoutGatherScatterKernel;
+    kernel.setArg(0, device_buffer(all));
+    kernel.setArg(1, device_buffer(compact));
+    kernel.setArg(2, (allInc==nullptr)?cl::Buffer(0):device_buffer(*allInc));
+    kernel.setArg(3, (compactInc==nullptr)?cl::Buffer(0):
+                                           device_buffer(*compactInc));
+    kernel.setArg(4, (rowIdx==nullptr)?cl::Buffer(0):device_buffer(*rowIdx));
+    kernel.setArg(5, device_buffer(colIdx));
+    kernel.setArg(6, all.cols);
+    kernel.setArg(7, compact.cols);
+    kernel.setArg(8, all.offset);
+    kernel.setArg(9, compact.offset);
+    kernel.setArg(10, (rowIdx==nullptr)?0:rowIdx->offset);
+    kernel.setArg(11, colIdx.offset);
+    kernel.setArg(12, scatter?1:0);
+    
+    const cl::NDRange global(compact.cols, compact.rows);
+    return launch(kernel, global, cl::NullRange, waitList);
+}
 
-void OpenCLKernels::runSoftMax(
-            matrix_cl_float const &activations) {
-  
-    assert(activations.cols % 4 == 0 && activations.rows % 4 == 0);
+compute_event OpenCLKernels::runGatherRows(
+            matrix_float const &src,
+            matrix_float const &dst,
+            matrix_uint const &idx,
+            const std::vector<compute_event> *waitList) {
     
-    size_t local_size[1] {activations.cols / 4};
-    size_t global_size[1] = {local_size[0] * activations.rows};
+    assert(src.cols == dst.cols);
+    assert(idx.rows*idx.cols == dst.rows);
+    assert(!src.isHalf() && src.offset == 0);
     
-    softmaxKernelLocal->setArg(0, *(activations.data.deviceData));
-    softmaxKernelLocal->setArg(1,
-                               cl::Local(local_size[0] * 4 * sizeof(cl_float)));
-    softmaxKernelLocal->setArg(2, activations.offset/4);
+    cl::Kernel &kernel = *gatherRowsKernel;
+    kernel.setArg(0, device_buffer(src));
+    kernel.setArg(1, device_buffer(dst));
+    kernel.setArg(2, device_buffer(idx));
+    kernel.setArg(3, dst.cols);
+    kernel.setArg(4, dst.offset);
+    kernel.setArg(5, idx.offset);
+    kernel.setArg(6, dst.isHalf());
     
-    const cl::NDRange offset = cl::NullRange;
-    const cl::NDRange global(global_size[0]);
-    const cl::NDRange local(local_size[0]);
-    queue.enqueueNDRangeKernel(*softmaxKernelLocal,
-                               offset,
-                               global,
-                               local);
-    queue.finish();
+    const cl::NDRange global(dst.cols, dst.rows);
+    return launch(kernel, global, cl::NullRange, waitList);
 }
 
-void OpenCLKernels::runRowSum(
-            matrix_cl_float &A, 
-            matrix_cl_float &result,
-            cl_float multExisting,
-            cl_float multNew) {
+compute_event OpenCLKernels::runOptimizerUpdate(
+            matrix_float const &w,
+            matrix_float const &state,
+            matrix_float const &gradient,
+            cl_int rule,
+            cl_float lr,
+            cl_float momentum,
+            cl_float l2,
+            cl_float gradScale,
+            const std::vector<compute_event> *waitList) {
     
-    size_t global_size[1] = {A.cols/4};
+    const size_t n = w.rows * w.cols;
+    assert(state.rows*state.cols == n && gradient.rows*gradient.cols == n);
+    assert(state.offset == w.offset && gradient.offset == w.offset);
+    assert(!w.isHalf() && !state.isHalf() && !gradient.isHalf());
     
-    rowSumKernel->setArg(0, *(A.data.deviceData));
-    rowSumKernel->setArg(1, *(result.data.deviceData));
-    rowSumKernel->setArg(2, A.rows);
-    rowSumKernel->setArg(3, multExisting);
-    rowSumKernel->setArg(4, multNew);
+    // every work-item updates 4 elements
+    size_t global_size[1] = {(n + 3)/4};
+    
+    cl::Kernel &kernel = *optimizerUpdateKernel;
+    kernel.setArg(0, device_buffer(w));
+    kernel.setArg(1, device_buffer(state));
+    kernel.setArg(2, device_buffer(gradient));
+    kernel.setArg(3, cl_int(n));
+    kernel.setArg(4, w.offset);
+    kernel.setArg(5, rule);
+    kernel.setArg(6, lr);
+    kernel.setArg(7, momentum);
+    kernel.setArg(8, l2);
+    kernel.setArg(9, gradScale);
     
-    const cl::NDRange offset = cl::NullRange;
     const cl::NDRange global(global_size[0]);
-    queue.enqueueNDRangeKernel(*rowSumKernel,
-                               offset,
-                               global);
-    queue.finish();
+    return launch(kernel, global, cl::NullRange, waitList);
+}
+
+compute_event OpenCLKernels::runClearCounters(
+            matrix_uint const &counters,
+            const std::vector<compute_event> *waitList) {
+    const std::vector<cl::Event> events = to_cl_events(waitList);
+    cl::Event event;
+    queue.enqueueFillBuffer(device_buffer(counters),
+                            cl_uint(0),
+                            counters.offset*sizeof(cl_uint),
+                            counters.rows*counters.cols*sizeof(cl_uint),
+                            &events,
+                            &event);
+    if (prof != nullptr) prof->record("fillBuffer", event);
+    if (synchronous) event.wait();
+    return to_compute_event(event);
 }
 
-void OpenCLKernels::runMatrixScalarMultiplication(
-            matrix_cl_float const &matrix, cl_float scalar) {
+compute_event OpenCLKernels::runClassification(
+            matrix_float const &y,
+            matrix_float const &t,
+            matrix_uint const &correct,
+            matrix_uint const *confusion,
+            const std::vector<compute_event> *waitList) {
     
-    size_t global_size[1] = {matrix.cols * matrix.rows / 4};
+    assert(y.rows == t.rows && y.cols == t.cols && !t.isHalf());
+    assert(confusion == nullptr ||
+           confusion->rows*confusion->cols == y.cols*y.cols);
     
-    matrixScalarMultiplicationKernel->setArg(0, *(matrix.data.deviceData));
-    matrixScalarMultiplicationKernel->setArg(1, scalar);
+    const size_t local_size = pow2_local_size(classificationLocalSize);
     
-    const cl::NDRange offset = cl::NullRange;
-    const cl::NDRange global(global_size[0]);
-    queue.enqueueNDRangeKernel(*matrixScalarMultiplicationKernel,
-                               offset,
-                               global);
-    queue.finish();    
+    cl::Kernel &kernel = *classificationKernel;
+    kernel.setArg(0, device_buffer(y));
+    kernel.setArg(1, device_buffer(t));
+    kernel.setArg(2, device_buffer(correct));
+    kernel.setArg(3, (confusion == nullptr)?device_buffer(correct):
+                                            device_buffer(*confusion));
+    kernel.setArg(4, cl::Local(local_size * sizeof(cl_float)));
+    kernel.setArg(5, y.rows);
+    kernel.setArg(6, y.cols);
+    kernel.setArg(7, y.offset);
+    kernel.setArg(8, t.offset);
+    kernel.setArg(9, correct.offset);
+    kernel.setArg(10, (confusion == nullptr)?0:confusion->offset);
+    kernel.setArg(11, cl_int(confusion != nullptr));
+    kernel.setArg(12, cl_int(y.isHalf()));
+    
+    const cl::NDRange global((y.rows + local_size - 1) / local_size *
+                             local_size);
+    const cl::NDRange local(local_size);
+    return launch(kernel, global, local, waitList);
 }
\ No newline at end of file
@@ -14,13 +14,19 @@
 #include <string>
 #include <fstream>
 #include <map>
+#include <vector>
+#include <functional>
 
 #include "CL/cl.hpp"
 
 #include "common.hpp"
+#include "compute_backend.hpp"
+#include "tuner.hpp"
+#include "program_cache.hpp"
+#include "profiler.hpp"
 
 
-class OpenCLKernels {
+class OpenCLKernels : public compute_backend {
  public:
     inline OpenCLKernels(
             const cl::Context & c,
@@ -33,56 +39,232 @@ class OpenCLKernels {
 
     virtual ~OpenCLKernels();
     
-    void runMatrixMultiplicationSigmoid(
-            matrix_cl_float const &A,
-            matrix_cl_float const &B,
-            matrix_cl_float const &C,
-            matrix_cl_float * bias = nullptr,
+    // Synchronous mode waits for every kernel to finish before returning
+    // (old behaviour, useful for debugging). By default kernels are only
+    // enqueued and the returned events have to be used to synchronize.
+    inline void setSynchronous(bool s) { synchronous = s; }
+    inline bool isSynchronous() const { return synchronous; }
+    
+    // Use the local memory tiled GEMM kernel. The float4 kernel is only an
+    // option when all the sizes are multiple of 16.
+    inline void setTiledGemm(bool t) { tiledGemm = t; }
+    
+    // Autotuning of the launch configurations (work-group sizes, GEMM
+    // kernel and tiles). Winners are cached on disk by kernel_tuner.
+    inline void setAutotuning(bool a) { autotuning = a; }
+    
+    // Every kernel launch and transfer is recorded in p (nullptr disables
+    // it). The queue has to be created with CL_QUEUE_PROFILING_ENABLE.
+    inline void setProfiler(profiler *p) { prof = p; }
+    
+    // device buffers: the maps are transferred by the caller
+    inline bool host_memory() const { return false; }
+    
+    // marker, flush and wait of the queue
+    compute_event marker(
+            const std::vector<compute_event> *waitList = nullptr);
+    void flush();
+    void wait(const std::vector<compute_event> &waitList);
+    
+    // copy between device buffers (enqueueCopyBuffer)
+    compute_event runCopy(
+            matrix_float const &src,
+            matrix_float const &dst,
+            const std::vector<compute_event> *waitList = nullptr);
+    
+    compute_event runMatrixMultiplicationSigmoid(
+            matrix_float const &A,
+            matrix_float const &B,
+            matrix_float const &C,
+            matrix_float * bias = nullptr,
             bool calcSigmoid = false,
             bool sumToC = false,
             cl_float multPrevVal = 1.0f,
-            cl_float multSum = 1.0f);
+            cl_float multSum = 1.0f,
+            matrix_float const *sigmoidDerivative = nullptr,
+            dropout_mask const *dropout = nullptr,
+            const std::vector<compute_event> *waitList = nullptr);
     
-    void runElementWiseSubstract(
-            matrix_cl_float const &t,
-            matrix_cl_float const &y,
-            matrix_cl_float &e);
+    // e = scale*(t - y)
+    compute_event runElementWiseSubstract(
+            matrix_float const &t,
+            matrix_float const &y,
+            matrix_float &e,
+            cl_float scale = 1.0f,
+            const std::vector<compute_event> *waitList = nullptr);
     
-    void runElementWiseSum(
-            matrix_cl_float const &a,
-            matrix_cl_float const &b,
-            matrix_cl_float &c,
+    compute_event runElementWiseSum(
+            matrix_float const &a,
+            matrix_float const &b,
+            matrix_float &c,
             cl_float mult_a = 1.0f,
-            cl_float mult_b = 1.0f);
+            cl_float mult_b = 1.0f,
+            const std::vector<compute_event> *waitList = nullptr);
     
     
     cl_float runCrossEntropy(
-            matrix_cl_float const &t,
-            matrix_cl_float const &y,
-            matrix_cl_float &error);
+            matrix_float const &t,
+            matrix_float const &y,
+            matrix_float &error,
+            const std::vector<compute_event> *waitList = nullptr);
     
     cl_float runL2Regularization(
-            matrix_cl_float const &weights,
-            matrix_cl_float &error);
+            matrix_float const &weights,
+            matrix_float &error,
+            const std::vector<compute_event> *waitList = nullptr);
         
-    void runElementWiseMultiplicationBySigmoidDerivativeKernel(
-            matrix_cl_float const &deltas,
-            matrix_cl_float const &activations);
+    compute_event runElementWiseMultiplicationBySigmoidDerivativeKernel(
+            matrix_float const &deltas,
+            matrix_float const &activations,
+            const std::vector<compute_event> *waitList = nullptr);
     
-    void runSoftMax(
-            matrix_cl_float const &activations);
+    // Numerically stable softmax of every row (in place). Row blocked when
+    // the row fits in a work-group, in two passes otherwise.
+    compute_event runSoftMax(
+            matrix_float const &activations,
+            const std::vector<compute_event> *waitList = nullptr);
     
-    void runRowSum(
-            matrix_cl_float &A, 
-            matrix_cl_float &result,
+    // Softmax of the logits y (in place), deltas = deltaScale*(y - t) and,
+    // if ce_partial is given, cross entropy partial sums (one per work-group)
+    compute_event runSoftMaxDeltaCrossEntropy(
+            matrix_float const &y,
+            matrix_float const &t,
+            matrix_float const &deltas,
+            matrix_float * ce_partial = nullptr,
+            cl_float deltaScale = 1.0f,
+            const std::vector<compute_event> *waitList = nullptr);
+    
+    // Cross entropy of rows x cols values from the partial sums calculated by
+    // runSoftMaxDeltaCrossEntropy
+    cl_float readCrossEntropyPartials(
+            matrix_float &ce_partial,
+            cl_uint rows,
+            cl_uint cols,
+            const std::vector<compute_event> *waitList = nullptr);
+    
+    // Sums on device the n floats of input starting at offset (in floats).
+    // The result is kept in a one float device buffer, read it with
+    // readReduceSum() or readReduceSumAsync().
+    compute_event runReduceSum(
+            const cl::Buffer &input,
+            size_t offset,
+            size_t n,
+            const std::vector<compute_event> *waitList = nullptr);
+    
+    // Blocking read of the result of the last runReduceSum (4 bytes)
+    cl_float readReduceSum(const std::vector<compute_event> *waitList = nullptr);
+    
+    // Non-blocking read of the result of the last runReduceSum. value can
+    // not be used until the returned event has completed.
+    compute_event readReduceSumAsync(
+            cl_float &value,
+            const std::vector<compute_event> *waitList = nullptr);
+    
+    compute_event runRowSum(
+            matrix_float &A, 
+            matrix_float &result,
             cl_float multExisting = 0.0f,
-            cl_float multNew = 1.0f);
+            cl_float multNew = 1.0f,
+            const std::vector<compute_event> *waitList = nullptr);
+    
+    compute_event runMatrixScalarMultiplication(
+            matrix_float const &matrix,
+            cl_float scalar,
+            const std::vector<compute_event> *waitList = nullptr);
     
-    void runMatrixScalarMultiplication(
-            matrix_cl_float const &matrix,
-            cl_float scalar);
+    // Copy of src (stored in floats) into dst (stored in halfs)
+    compute_event runConvertToHalf(
+            matrix_float const &src,
+            matrix_float const &dst,
+            const std::vector<compute_event> *waitList = nullptr);
+    
+    // dst = src / scale quantized to int8 (symmetric, saturated to +-127)
+    compute_event runQuantize(
+            matrix_float const &src,
+            matrix_char const &dst,
+            cl_float invScale,
+            const std::vector<compute_event> *waitList = nullptr);
+    
+    // Int8 inference GEMM with int32 accumulation:
+    // C = sigmoid(scaleA * scaleB .* (A * B) + bias) (sigmoid only if
+    // calcSigmoid), quantized again to int8 with invScaleC.
+    // scaleB has one value per column of B and uses the offset of bias.
+    compute_event runMatrixMultiplicationInt8(
+            matrix_char const &A,
+            matrix_char const &B,
+            matrix_char const &C,
+            matrix_float const &bias,
+            matrix_float const &scaleB,
+            cl_float scaleA,
+            cl_float invScaleC,
+            bool calcSigmoid,
+            const std::vector<compute_event> *waitList = nullptr);
+    
+    // Dropout. Gather (scatter == false): compact = rows rowIdx and columns
+    // colIdx of all. Scatter: the inverse copy. Same copy between allInc and
+    // compactInc if given. rowIdx == nullptr selects the row 0 of all
+    // (bias). all.cols are the columns of the whole matrix, compact.rows and
+    // compact.cols the selected ones.
+    compute_event runDropoutGatherScatter(
+            matrix_float const &all,
+            matrix_float const &compact,
+            matrix_float const *allInc,
+            matrix_float const *compactInc,
+            matrix_uint const *rowIdx,
+            matrix_uint const &colIdx,
+            bool scatter,
+            const std::vector<compute_event> *waitList = nullptr);
+    
+    // Fused optimizer step (optimizerUpdateKernel): w, state and gradient
+    // read and written once. rule is one of the OPTIMIZER_* of the kernels
+    // (optimizer::rule_t).
+    compute_event runOptimizerUpdate(
+            matrix_float const &w,
+            matrix_float const &state,
+            matrix_float const &gradient,
+            cl_int rule,
+            cl_float lr,
+            cl_float momentum,
+            cl_float l2,
+            cl_float gradScale,
+            const std::vector<compute_event> *waitList = nullptr);
+    
+    // Minibatch gather: row r of dst = row idx[r] of src. idx is a vector
+    // of dst.rows elements, src.cols == dst.cols.
+    compute_event runGatherRows(
+            matrix_float const &src,
+            matrix_float const &dst,
+            matrix_uint const &idx,
+            const std::vector<compute_event> *waitList = nullptr);
+    
+    // counters = 0 (enqueueFillBuffer)
+    compute_event runClearCounters(
+            matrix_uint const &counters,
+            const std::vector<compute_event> *waitList = nullptr);
+    
+    // Argmax of the rows of y and t, correct classifications and confusion
+    // matrix counted on the device (classificationKernel, one work-item per
+    // row). y can be stored in halfs.
+    compute_event runClassification(
+            matrix_float const &y,
+            matrix_float const &t,
+            matrix_uint const &correct,
+            matrix_uint const *confusion = nullptr,
+            const std::vector<compute_event> *waitList = nullptr);
+    
+    // Same with C stored in floats (logits of the output layer)
+    compute_event runMatrixMultiplicationInt8(
+            matrix_char const &A,
+            matrix_char const &B,
+            matrix_float const &C,
+            matrix_float const &bias,
+            matrix_float const &scaleB,
+            cl_float scaleA,
+            bool calcSigmoid,
+            const std::vector<compute_event> *waitList = nullptr);
   private:
-    const std::string sourceFile = "NN_Kernels.cl";
+    // NN_Kernels.cl embedded in the executable
+    static const char * const kernelSource;
     
     const cl::Context & context;
     const std::vector<cl::Device> & devices;
@@ -97,6 +279,36 @@ class OpenCLKernels {
     const std::string matrixMultiplicationSigmoidKernel_name =
                       "matrixMultiplicationSigmoidKernelLocal";
     
+    cl::Kernel *matrixMultiplicationSigmoidKernelTiled;
+    const std::string matrixMultiplicationSigmoidKernelTiled_name =
+                      "matrixMultiplicationSigmoidKernelTiled";
+    
+    // Tile configurations of the tiled GEMM (passed as build options, one
+    // program per configuration). The first one is built with the rest of
+    // the kernels and used when the tuner is not active. The tuner times
+    // all the ones supported by the device.
+    struct gemm_tile {
+        size_t tileM;   // rows of C per work-group
+        size_t tileN;   // cols of C per work-group
+        size_t tileK;   // depth of the A and B tiles
+        size_t workPerItemM;   // register tile rows
+        size_t workPerItemN;   // register tile cols
+    };
+    const std::vector<gemm_tile> gemmTiles = {{64, 64, 16, 8, 8},
+                                              {32, 32, 16, 4, 4},
+                                              {64, 64, 8, 4, 4},
+                                              {128, 64, 16, 8, 8},
+                                              {64, 128, 16, 8, 8},
+                                              {32, 64, 16, 4, 8}};
+    // programs and kernels of the other tile configurations, built the
+    // first time they are used (nullptr until then)
+    std::vector<cl::Program *> gemmTilePrograms;
+    std::vector<cl::Kernel *> gemmTileKernels;
+    // tuner configuration of the tiled kernel with the tile t is
+    // gemmTiledConfiguration + t. The lower values are the blocksizes of
+    // matrixMultiplicationSigmoidKernelLocal.
+    const cl_uint gemmTiledConfiguration = 0x100;
+    
     cl::Kernel *elementWiseSubstractKernel;
     const std::string elementWiseSubstractKernel_name =
                       "elementWiseSubstractKernel";
@@ -117,25 +329,186 @@ class OpenCLKernels {
     const std::string elementWiseMultiplicationBySigmoidDerivativeKernel_name =
                       "elementWiseMultiplicationBySigmoidDerivativeKernel";
     
-    cl::Kernel *softmaxKernelLocal;
-    const std::string softmaxKernelLocal_name =
-                      "softmaxKernelLocal";
+    cl::Kernel *softmaxKernelRows;
+    const std::string softmaxKernelRows_name =
+                      "softmaxKernelRows";
+    
+    cl::Kernel *softmaxPartialKernel;
+    const std::string softmaxPartialKernel_name =
+                      "softmaxPartialKernel";
+    
+    cl::Kernel *softmaxNormalizeKernel;
+    const std::string softmaxNormalizeKernel_name =
+                      "softmaxNormalizeKernel";
+    
+    cl::Kernel *softmaxDeltaCrossEntropyKernel;
+    const std::string softmaxDeltaCrossEntropyKernel_name =
+                      "softmaxDeltaCrossEntropyKernel";
+    const size_t softmaxLocalSize = 256;   // work-items per work-group
+    
+    cl::Kernel *reduceSumKernel;
+    const std::string reduceSumKernel_name =
+                      "reduceSumKernel";
+    const size_t reduceSumLocalSize = 256;   // work-items per work-group
+    
+    // Partial sums of the reduction levels (ping-pong, one float per
+    // work-group of the first level) and final result (one float)
+    cl::Buffer *reductionScratch[2] = {nullptr, nullptr};
+    cl::Buffer *reductionResult = nullptr;
+    
+    // (max, sum) per row and chunk of the two pass softmax
+    cl::Buffer *softmaxPartials = nullptr;
+    size_t softmaxPartialsSize = 0;
     
     cl::Kernel *rowSumKernel;
     const std::string rowSumKernel_name =
                       "rowSumKernel";
+    // ROWSUM_TSC and ROWSUM_RS of the kernel (passed as build options),
+    // reduced by opencl_init() to the max work-group size of the device
+    size_t rowSumTileCols = 16;   // columns per work-group
+    size_t rowSumRowSplit = 16;   // rows of work-items (power of 2)
     
     cl::Kernel *matrixScalarMultiplicationKernel;
     const std::string matrixScalarMultiplicationKernel_name = 
                       "matrixScalarMultiplicationKernel";
     
+    cl::Kernel *floatToHalfKernel;
+    const std::string floatToHalfKernel_name = 
+                      "floatToHalfKernel";
+    
+    cl::Kernel *dropoutGatherScatterKernel;
+    const std::string dropoutGatherScatterKernel_name = 
+                      "dropoutGatherScatterKernel";
+
+    cl::Kernel *gatherRowsKernel;
+    const std::string gatherRowsKernel_name = 
+                      "gatherRowsKernel";
+
+    cl::Kernel *optimizerUpdateKernel;
+    const std::string optimizerUpdateKernel_name = 
+                      "optimizerUpdateKernel";
+    
+    cl::Kernel *classificationKernel;
+    const std::string classificationKernel_name = 
+                      "classificationKernel";
+    const size_t classificationLocalSize = 256;   // rows per work-group
+    
+    cl::Kernel *quantizeKernel;
+    const std::string quantizeKernel_name = 
+                      "quantizeKernel";
+    
+    cl::Kernel *matrixMultiplicationInt8Kernel;
+    const std::string matrixMultiplicationInt8Kernel_name = 
+                      "matrixMultiplicationInt8Kernel";
+    // INT8_TS (build option), reduced by opencl_init() to the max
+    // work-group size of the device
+    size_t int8TileSize = 16;
+    
     bool lds;
     
-    inline void readfile(const std::string &filepath, std::string &buffer) {
-        std::ifstream fin(filepath.c_str());
-        getline(fin, buffer, char(-1));
-        fin.close();
-    };
+    bool synchronous = false;
+    bool tiledGemm = true;
+    bool autotuning = true;
+    
+    kernel_tuner *tuner;
+    size_t maxWorkGroupSize;
+    cl_ulong localMemSize;
+    
+    profiler *prof = nullptr;
+    
+    // tuner->tune() without recording the trials in the profile
+    cl_uint tune(const std::string &key,
+                 const std::vector<cl_uint> &candidates,
+                 const std::function<void(cl_uint)> &trial);
+    
+    std::string build_options(const gemm_tile &tile) const;
+    // Program of the source built with options for the device (loaded from
+    // the program cache if it was already compiled)
+    cl::Program * build_program(const std::string &options);
+    
+    // matrixMultiplicationSigmoidKernelTiled built with gemmTiles[tile]
+    cl::Kernel & tiled_gemm_kernel(size_t tile);
+    // true if the work-group and the local memory of the tile fit in the
+    // device
+    bool gemm_tile_supported(const gemm_tile &tile) const;
+    
+    // Largest power of 2 work-group size not greater than preferred and
+    // supported by the device
+    size_t pow2_local_size(size_t preferred) const;
+    // Work-items per row and rows per work-group of the row blocked softmax
+    void softmax_layout(cl_uint cols,
+                        size_t &row_size,
+                        size_t &rows_per_group) const;
+    
+    // true if the sizes and offsets are valid for the float4 kernel
+    // matrixMultiplicationSigmoidKernelLocal
+    bool legacy_gemm_supported(matrix_float const &A,
+                               matrix_float const &B,
+                               matrix_float const &C,
+                               matrix_float const *bias,
+                               matrix_float const *sigmoidDerivative,
+                               dropout_mask const *dropout) const;
+    cl_uint default_gemm_configuration(matrix_float const &A,
+                                       matrix_float const &C,
+                                       bool legacy);
+    std::vector<cl_uint> gemm_configurations(matrix_float const &A,
+                                             matrix_float const &C,
+                                             bool legacy);
+    
+    compute_event runMatrixMultiplicationSigmoidLocal(
+            matrix_float const &A,
+            matrix_float const &B,
+            matrix_float const &C,
+            matrix_float * bias,
+            bool calcSigmoid,
+            bool sumToC,
+            cl_float multPrevVal,
+            cl_float multSum,
+            matrix_float const *sigmoidDerivative,
+            size_t blocksize,
+            const std::vector<compute_event> *waitList);
+    
+    size_t reduction_local_size(const std::string &kernel_name,
+                                size_t n,
+                                const std::function<void(cl_uint)> &trial);
+    size_t reduction_groups(size_t n, size_t local_size) const;
+    
+    // common part of the runMatrixMultiplicationInt8 versions
+    compute_event launchMatrixMultiplicationInt8(
+            matrix_char const &A,
+            matrix_char const &B,
+            const cl::Buffer &C,
+            cl_uint offsetC,
+            cl_uint colsC,
+            matrix_float const &bias,
+            matrix_float const &scaleB,
+            cl_float scaleA,
+            bool calcSigmoid,
+            bool quantizeC,
+            cl_float invScaleC,
+            cl_int halfC,
+            const std::vector<compute_event> *waitList);
+    
+    compute_event runMatrixMultiplicationSigmoidTiled(
+            matrix_float const &A,
+            matrix_float const &B,
+            matrix_float const &C,
+            matrix_float * bias,
+            bool calcSigmoid,
+            bool sumToC,
+            cl_float multPrevVal,
+            cl_float multSum,
+            matrix_float const *sigmoidDerivative,
+            dropout_mask const *dropout,
+            size_t tile,
+            const std::vector<compute_event> *waitList);
+    
+    // Enqueues the kernel after the events of waitList and returns the
+    // event associated to its execution
+    compute_event launch(const cl::Kernel &kernel,
+                     const cl::NDRange &global,
+                     const cl::NDRange &local,
+                     const std::vector<compute_event> *waitList);
     
     void opencl_init();
     
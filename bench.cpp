@@ -0,0 +1,666 @@
+/*
+ * File:   bench.cpp
+ *
+ * Created on 17 de octubre de 2026
+ */
+
+/*
+ * Micro-benchmarks of the OpenCLKernels entry points (make bench).
+ *
+ * Every operation is run over a sweep of shapes (the ones of the MNIST
+ * network and some bigger ones) and the median of the wall-clock time of
+ * the repetitions (enqueue and finish of the queue) is reported with its
+ * GFLOPS (GEMM) or GB/s (the rest, minimum bytes read and written) and the
+ * percentage of the peak measured in the same device: a compute bound
+ * kernel (FMA chains) for GFLOPS and enqueueCopyBuffer for GB/s.
+ *
+ * Usage: nn-bench [--device k] [--reps n] [--json file]
+ * The results are printed and saved as JSON (nn-bench.json by default).
+ */
+
+#define __CL_ENABLE_EXCEPTIONS  // enable use of exceptions of the OpenCL API
+
+#include <CL/cl.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "common.hpp"
+#include "OpenCLKernels.hpp"
+#include "optimizer.hpp"
+
+// Compute bound kernel: 8 independent chains of float4 mads per work-item
+static const char * const peakFlopsSource = R"PEAK(
+__kernel void peakFlopsKernel(__global float *out, float a, float b) {
+    const float g = get_global_id(0) * 1e-6f;
+    float4 x0 = (float4)(g, g + 0.1f, g + 0.2f, g + 0.3f);
+    float4 x1 = x0 + 1.0f, x2 = x0 + 2.0f, x3 = x0 + 3.0f;
+    float4 x4 = x0 + 4.0f, x5 = x0 + 5.0f, x6 = x0 + 6.0f, x7 = x0 + 7.0f;
+    for (int i = 0; i < PEAK_ITERATIONS; i++) {
+        x0 = mad(x0, a, b); x1 = mad(x1, a, b);
+        x2 = mad(x2, a, b); x3 = mad(x3, a, b);
+        x4 = mad(x4, a, b); x5 = mad(x5, a, b);
+        x6 = mad(x6, a, b); x7 = mad(x7, a, b);
+    }
+    const float4 s = x0 + x1 + x2 + x3 + x4 + x5 + x6 + x7;
+    out[get_global_id(0)] = s.x + s.y + s.z + s.w;
+}
+)PEAK";
+static const size_t peakIterations = 1024;
+static const size_t peakWorkItems = 1 << 18;
+// 8 chains x 4 lanes x 2 flops (mad)
+static const size_t peakFlopsPerIteration = 8*4*2;
+// bytes of the buffers copied by the bandwidth measure
+static const size_t peakCopyBytes = 64 << 20;
+
+// host vector and device buffer of an operand of the benchmarks
+template<typename T>
+struct operand {
+    std::vector<T> host;
+    host_device_memory_map<T> map;
+
+    inline operand(const cl::Context &context, size_t n, bool half = false) :
+                   host(n), map(host) {
+        map.halfStorage = half;
+        map.createBuffer(context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR);
+    }
+};
+
+struct result {
+    std::string kernel;
+    std::string shape;
+    double median_ms;
+    double flops;   // 0 if the kernel is memory bound
+    double bytes;
+};
+
+class benchmark {
+ public:
+    benchmark(size_t device, size_t reps);
+    ~benchmark();
+
+    void run();
+    void save_json(const std::string &file) const;
+
+ private:
+    std::vector<cl::Device> devices;
+    size_t device_id;
+    cl::Context *context;
+    cl::CommandQueue *queue;
+    OpenCLKernels *kernels;
+    size_t repetitions;
+    std::mt19937 rng;
+
+    double peakGflops = 0.0;
+    double peakGBps = 0.0;
+    std::vector<result> results;
+
+    // random values in [min, max) written to the device
+    void fill(operand<cl_float> &o, cl_float min = -1.0f, cl_float max = 1.0f);
+    // sorted random subset of [0, all) written to the device
+    void kept(operand<cl_uint> &idx, cl_uint all);
+
+    // median in ms of the repetitions of op (after a warm-up run, which
+    // also does the autotuning of new shapes)
+    double time(const std::function<void()> &op);
+    void add(const std::string &kernel,
+             const std::string &shape,
+             double flops,
+             double bytes,
+             const std::function<void()> &op);
+    void print(std::ostream &out, const result &r) const;
+
+    void measure_peaks();
+    void gemm(cl_uint M, cl_uint K, cl_uint N);
+    void gemm_int8(cl_uint M, cl_uint K, cl_uint N);
+    void elementwise(cl_uint rows, cl_uint cols);
+    void conversions(cl_uint rows, cl_uint cols);
+    void reductions(cl_uint rows, cl_uint cols);
+    void softmax(cl_uint rows, cl_uint cols);
+    void parameters(cl_uint n);
+    void gather(cl_uint dataRows, cl_uint rows, cl_uint cols);
+    void dropout(cl_uint allRows, cl_uint allCols, cl_uint rows, cl_uint cols);
+    void classification(cl_uint rows, cl_uint cols);
+};
+
+static std::string shape(cl_uint a, cl_uint b) {
+    std::ostringstream s;
+    s << a << "x" << b;
+    return s.str();
+}
+
+static std::string shape(cl_uint a, cl_uint b, cl_uint c) {
+    std::ostringstream s;
+    s << a << "x" << b << "x" << c;
+    return s.str();
+}
+
+benchmark::benchmark(size_t device, size_t reps) :
+                     device_id(device), repetitions(reps), rng(1234) {
+    std::vector<cl::Platform> platforms;
+    cl::Platform::get(&platforms);
+    platforms[0].getDevices(CL_DEVICE_TYPE_ALL, &devices);
+    assert(device_id < devices.size());
+    context = new cl::Context(devices);
+    queue = new cl::CommandQueue(*context, devices[device_id]);
+    kernels = new OpenCLKernels(*context, devices, device_id, *queue);
+}
+
+benchmark::~benchmark() {
+    delete kernels;
+    delete queue;
+    delete context;
+}
+
+void benchmark::fill(operand<cl_float> &o, cl_float min, cl_float max) {
+    std::uniform_real_distribution<cl_float> dist(min, max);
+    for (cl_float &v : o.host) v = dist(rng);
+    o.map.writeToDevice(*queue);
+}
+
+void benchmark::kept(operand<cl_uint> &idx, cl_uint all) {
+    std::vector<cl_uint> order(all);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), rng);
+    std::copy(order.begin(), order.begin() + idx.host.size(),
+              idx.host.begin());
+    std::sort(idx.host.begin(), idx.host.end());
+    idx.map.writeToDevice(*queue);
+}
+
+double benchmark::time(const std::function<void()> &op) {
+    typedef std::chrono::high_resolution_clock clock;
+    op();
+    queue->finish();
+    std::vector<double> times;
+    for (size_t r = 0; r < repetitions; r++) {
+        const clock::time_point start = clock::now();
+        op();
+        queue->finish();
+        const std::chrono::duration<double, std::milli> elapsed =
+                                                    clock::now() - start;
+        times.push_back(elapsed.count());
+    }
+    std::sort(times.begin(), times.end());
+    return times[times.size()/2];
+}
+
+void benchmark::add(const std::string &kernel,
+                    const std::string &shape,
+                    double flops,
+                    double bytes,
+                    const std::function<void()> &op) {
+    results.push_back(result{kernel, shape, time(op), flops, bytes});
+    print(std::cout, results.back());
+}
+
+void benchmark::print(std::ostream &out, const result &r) const {
+    out << std::left << std::setw(32) << r.kernel
+        << std::setw(20) << r.shape << std::right
+        << std::fixed << std::setprecision(4)
+        << std::setw(12) << r.median_ms << " ms";
+    if (r.flops > 0) {
+        const double gflops = r.flops/(r.median_ms*1e6);
+        out << std::setprecision(1)
+            << std::setw(10) << gflops << " GFLOPS"
+            << std::setw(8) << 100.0*gflops/peakGflops << "%\n";
+    } else {
+        const double gbps = r.bytes/(r.median_ms*1e6);
+        out << std::setprecision(1)
+            << std::setw(10) << gbps << " GB/s  "
+            << std::setw(8) << 100.0*gbps/peakGBps << "%\n";
+    }
+}
+
+void benchmark::measure_peaks() {
+    const std::vector<cl::Device> device(1, devices[device_id]);
+    cl::Program::Sources sources;
+    sources.push_back(std::make_pair(peakFlopsSource, 0));
+    cl::Program program(*context, sources);
+    std::ostringstream options;
+    options << "-D PEAK_ITERATIONS=" << peakIterations;
+    program.build(device, options.str().c_str());
+    cl::Kernel kernel(program, "peakFlopsKernel");
+    cl::Buffer out(*context, CL_MEM_WRITE_ONLY, peakWorkItems*sizeof(cl_float));
+    kernel.setArg(0, out);
+    kernel.setArg(1, 0.999f);
+    kernel.setArg(2, 0.001f);
+    const double ms = time([&]() {
+        queue->enqueueNDRangeKernel(kernel, cl::NullRange,
+                                    cl::NDRange(peakWorkItems),
+                                    cl::NullRange);
+    });
+    peakGflops = double(peakWorkItems)*peakIterations*peakFlopsPerIteration/
+                 (ms*1e6);
+
+    const size_t bytes = std::min<size_t>(peakCopyBytes,
+            devices[device_id].getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>());
+    cl::Buffer src(*context, CL_MEM_READ_WRITE, bytes);
+    cl::Buffer dst(*context, CL_MEM_READ_WRITE, bytes);
+    const double copy_ms = time([&]() {
+        queue->enqueueCopyBuffer(src, dst, 0, 0, bytes);
+    });
+    // read and written
+    peakGBps = 2.0*bytes/(copy_ms*1e6);
+
+    std::cout << std::fixed << std::setprecision(1)
+              << "Peak: " << peakGflops << " GFLOPS, "
+              << peakGBps << " GB/s\n";
+}
+
+/*
+ * The four transpose combinations of C(MxN) = A(MxK) * B(KxN). FF uses NN,
+ * BP NT (weights transposed) and the gradients TN (activations transposed).
+ */
+void benchmark::gemm(cl_uint M, cl_uint K, cl_uint N) {
+    operand<cl_float> a(*context, M*K);
+    operand<cl_float> b(*context, K*N);
+    operand<cl_float> c(*context, M*N);
+    fill(a);
+    fill(b);
+    fill(c);
+
+    const char * const names[4] = {"gemm_NN", "gemm_NT", "gemm_TN", "gemm_TT"};
+    for (int transpose = 0; transpose < 4; transpose++) {
+        matrix_float A(a.map);
+        matrix_float B(b.map);
+        matrix_float C(c.map);
+        A.set(M, K, 0, (transpose & 2) != 0);
+        B.set(K, N, 0, (transpose & 1) != 0);
+        C.set(M, N);
+        add(names[transpose], shape(M, K, N),
+            2.0*M*N*K, sizeof(cl_float)*(double(M)*K + double(K)*N + M*N),
+            [&]() { kernels->runMatrixMultiplicationSigmoid(A, B, C); });
+    }
+}
+
+/*
+ * Int8 inference GEMM (compare_int8_inference): hidden layers quantized
+ * again for the next layer and output layer with the logits in floats.
+ */
+void benchmark::gemm_int8(cl_uint M, cl_uint K, cl_uint N) {
+    operand<cl_char> a(*context, size_t(M)*K);
+    operand<cl_char> b(*context, size_t(K)*N);
+    operand<cl_char> c(*context, size_t(M)*N);
+    operand<cl_float> logits(*context, size_t(M)*N);
+    operand<cl_float> bias(*context, N);
+    operand<cl_float> scale(*context, N);
+    std::uniform_int_distribution<int> dist(-127, 127);
+    for (cl_char &v : a.host) v = cl_char(dist(rng));
+    for (cl_char &v : b.host) v = cl_char(dist(rng));
+    a.map.writeToDevice(*queue);
+    b.map.writeToDevice(*queue);
+    fill(bias);
+    fill(scale, 0.001f, 0.01f);
+    matrix_char A(a.map);
+    matrix_char B(b.map);
+    matrix_char C(c.map);
+    matrix_float L(logits.map);
+    matrix_float Bias(bias.map);
+    matrix_float S(scale.map);
+    A.set(M, K);
+    B.set(K, N);
+    C.set(M, N);
+    L.set(M, N);
+    Bias.set(1, N);
+    S.set(1, N);
+
+    const double bytes = double(M)*K + double(K)*N;
+    add("gemm_int8", shape(M, K, N), 2.0*M*N*K, bytes + double(M)*N,
+        [&]() {
+            kernels->runMatrixMultiplicationInt8(A, B, C, Bias, S, 0.01f,
+                                                 10.0f, true);
+        });
+    add("gemm_int8_logits", shape(M, K, N), 2.0*M*N*K,
+        bytes + sizeof(cl_float)*double(M)*N,
+        [&]() {
+            kernels->runMatrixMultiplicationInt8(A, B, L, Bias, S, 0.01f,
+                                                 false);
+        });
+}
+
+void benchmark::elementwise(cl_uint rows, cl_uint cols) {
+    const size_t n = size_t(rows)*cols;
+    const double bytes = sizeof(cl_float)*double(n);
+    operand<cl_float> a(*context, n);
+    operand<cl_float> b(*context, n);
+    operand<cl_float> c(*context, n);
+    fill(a, 0.0f, 1.0f);
+    fill(b, 0.0f, 1.0f);
+    fill(c);
+    matrix_float A(a.map);
+    matrix_float B(b.map);
+    matrix_float C(c.map);
+    A.set(rows, cols);
+    B.set(rows, cols);
+    C.set(rows, cols);
+
+    add("elementWiseSubstract", shape(rows, cols), 0, 3*bytes,
+        [&]() { kernels->runElementWiseSubstract(A, B, C); });
+    add("elementWiseSum", shape(rows, cols), 0, 3*bytes,
+        [&]() { kernels->runElementWiseSum(A, B, C); });
+    // deltas (C) multiplied by the derivative of the activations (A)
+    add("sigmoidDerivative", shape(rows, cols), 0, 3*bytes,
+        [&]() {
+            kernels->runElementWiseMultiplicationBySigmoidDerivativeKernel(C,
+                                                                           A);
+        });
+    add("matrixScalarMultiplication", shape(rows, cols), 0, 2*bytes,
+        [&]() { kernels->runMatrixScalarMultiplication(C, 1.0f); });
+}
+
+// copies and conversions to the storage formats of the activations (half
+// storage, int8 inference)
+void benchmark::conversions(cl_uint rows, cl_uint cols) {
+    const size_t n = size_t(rows)*cols;
+    operand<cl_float> src(*context, n);
+    operand<cl_float> dst(*context, n);
+    operand<cl_float> half(*context, n, true);
+    operand<cl_char> quantized(*context, n);
+    fill(src);
+    matrix_float S(src.map);
+    matrix_float D(dst.map);
+    matrix_float H(half.map);
+    matrix_char Q(quantized.map);
+    S.set(rows, cols);
+    D.set(rows, cols);
+    H.set(rows, cols);
+    Q.set(rows, cols);
+
+    add("copy", shape(rows, cols), 0, 2*sizeof(cl_float)*double(n),
+        [&]() { kernels->runCopy(S, D); });
+    add("convertToHalf", shape(rows, cols), 0,
+        (sizeof(cl_float) + sizeof(cl_half))*double(n),
+        [&]() { kernels->runConvertToHalf(S, H); });
+    add("quantize", shape(rows, cols), 0,
+        (sizeof(cl_float) + sizeof(cl_char))*double(n),
+        [&]() { kernels->runQuantize(S, Q, 100.0f); });
+}
+
+void benchmark::reductions(cl_uint rows, cl_uint cols) {
+    const size_t n = size_t(rows)*cols;
+    const double bytes = sizeof(cl_float)*double(n);
+    operand<cl_float> t(*context, n);
+    operand<cl_float> y(*context, n);
+    operand<cl_float> error(*context, 65536);
+    operand<cl_float> sums(*context, cols);
+    fill(t, 0.0f, 1.0f);
+    fill(y, 0.01f, 1.0f);   // log(y)
+    matrix_float T(t.map);
+    matrix_float Y(y.map);
+    matrix_float E(error.map);
+    matrix_float S(sums.map);
+    T.set(rows, cols);
+    Y.set(rows, cols);
+    S.set(1, cols);
+
+    add("crossEntropy", shape(rows, cols), 0, 2*bytes,
+        [&]() { kernels->runCrossEntropy(T, Y, E); });
+    add("L2Regularization", shape(rows, cols), 0, bytes,
+        [&]() { kernels->runL2Regularization(Y, E); });
+    add("rowSum", shape(rows, cols), 0,
+        bytes + sizeof(cl_float)*double(cols),
+        [&]() { kernels->runRowSum(Y, S); });
+    add("reduceSum", shape(rows, cols), 0, bytes,
+        [&]() { kernels->runReduceSum(*y.map.deviceData, 0, n); });
+}
+
+void benchmark::softmax(cl_uint rows, cl_uint cols) {
+    const size_t n = size_t(rows)*cols;
+    const double bytes = sizeof(cl_float)*double(n);
+    operand<cl_float> y(*context, n);
+    operand<cl_float> t(*context, n);
+    operand<cl_float> deltas(*context, n);
+    operand<cl_float> partials(*context, rows);
+    fill(y);
+    fill(t, 0.0f, 1.0f);
+    matrix_float Y(y.map);
+    matrix_float T(t.map);
+    matrix_float D(deltas.map);
+    matrix_float P(partials.map);
+    Y.set(rows, cols);
+    T.set(rows, cols);
+    D.set(rows, cols);
+
+    add("softMax", shape(rows, cols), 0, 2*bytes,
+        [&]() { kernels->runSoftMax(Y); });
+    // y and t read, y and deltas written
+    add("softMaxDeltaCrossEntropy", shape(rows, cols), 0, 4*bytes,
+        [&]() { kernels->runSoftMaxDeltaCrossEntropy(Y, T, D, &P); });
+}
+
+void benchmark::parameters(cl_uint n) {
+    const double bytes = sizeof(cl_float)*double(n);
+    operand<cl_float> w(*context, n);
+    operand<cl_float> state(*context, n);
+    operand<cl_float> gradient(*context, n);
+    fill(w);
+    fill(state, -0.01f, 0.01f);
+    fill(gradient, -0.01f, 0.01f);
+    matrix_float W(w.map);
+    matrix_float S(state.map);
+    matrix_float G(gradient.map);
+    W.set(1, n);
+    S.set(1, n);
+    G.set(1, n);
+
+    // w, state and gradient read, w and state written
+    add("optimizerUpdate", shape(1, n), 0, 5*bytes,
+        [&]() {
+            kernels->runOptimizerUpdate(W, S, G, optimizer::NESTEROV,
+                                        0.01f, 0.9f, 0.0f, 1.0f);
+        });
+}
+
+void benchmark::gather(cl_uint dataRows, cl_uint rows, cl_uint cols) {
+    operand<cl_float> data(*context, size_t(dataRows)*cols);
+    operand<cl_float> minibatch(*context, size_t(rows)*cols);
+    operand<cl_uint> idx(*context, rows);
+    fill(data);
+    std::uniform_int_distribution<cl_uint> dist(0, dataRows - 1);
+    for (cl_uint &i : idx.host) i = dist(rng);
+    idx.map.writeToDevice(*queue);
+    matrix_float D(data.map);
+    matrix_float M(minibatch.map);
+    matrix_uint I(idx.map);
+    D.set(dataRows, cols);
+    M.set(rows, cols);
+    I.set(rows, 1);
+
+    add("gatherRows", shape(dataRows, rows, cols), 0,
+        sizeof(cl_float)*2.0*rows*cols + sizeof(cl_uint)*double(rows),
+        [&]() { kernels->runGatherRows(D, M, I); });
+}
+
+/*
+ * Dropout compaction of a layer: gather of the kept rows and columns of the
+ * weights and of their increments into the compact network and the scatter
+ * back.
+ */
+void benchmark::dropout(cl_uint allRows,
+                        cl_uint allCols,
+                        cl_uint rows,
+                        cl_uint cols) {
+    const size_t n = size_t(rows)*cols;
+    operand<cl_float> w_all(*context, size_t(allRows)*allCols);
+    operand<cl_float> inc_all(*context, size_t(allRows)*allCols);
+    operand<cl_float> w(*context, n);
+    operand<cl_float> inc(*context, n);
+    operand<cl_uint> row_idx(*context, rows);
+    operand<cl_uint> col_idx(*context, cols);
+    fill(w_all);
+    fill(inc_all, -0.01f, 0.01f);
+    kept(row_idx, allRows);
+    kept(col_idx, allCols);
+    matrix_float WA(w_all.map);
+    matrix_float IA(inc_all.map);
+    matrix_float W(w.map);
+    matrix_float I(inc.map);
+    matrix_uint R(row_idx.map);
+    matrix_uint C(col_idx.map);
+    WA.set(allRows, allCols);
+    IA.set(allRows, allCols);
+    W.set(rows, cols);
+    I.set(rows, cols);
+    R.set(1, rows);
+    C.set(1, cols);
+
+    // weights and increments read from one network and written to the
+    // other one
+    const std::string s = shape(allRows, allCols) + ">" + shape(rows, cols);
+    const double bytes = 4*sizeof(cl_float)*double(n) +
+                         sizeof(cl_uint)*double(rows + cols);
+    add("dropoutGather", s, 0, bytes,
+        [&]() {
+            kernels->runDropoutGatherScatter(WA, W, &IA, &I, &R, C, false);
+        });
+    add("dropoutScatter", s, 0, bytes,
+        [&]() {
+            kernels->runDropoutGatherScatter(WA, W, &IA, &I, &R, C, true);
+        });
+}
+
+// counters of the evaluation: correct classifications and confusion matrix
+void benchmark::classification(cl_uint rows, cl_uint cols) {
+    const size_t n = size_t(rows)*cols;
+    operand<cl_float> y(*context, n);
+    operand<cl_float> t(*context, n);
+    operand<cl_uint> counts(*context, 1 + size_t(cols)*cols);
+    fill(y, 0.0f, 1.0f);
+    // one-hot targets
+    std::uniform_int_distribution<cl_uint> dist(0, cols - 1);
+    for (cl_uint r = 0; r < rows; r++) t.host[size_t(r)*cols + dist(rng)] = 1;
+    t.map.writeToDevice(*queue);
+    matrix_float Y(y.map);
+    matrix_float T(t.map);
+    matrix_uint all(counts.map);
+    matrix_uint correct(counts.map);
+    matrix_uint confusion(counts.map);
+    Y.set(rows, cols);
+    T.set(rows, cols);
+    all.set(1, 1 + cols*cols);
+    correct.set(1, 1);
+    confusion.set(cols, cols, 1);
+
+    add("clearCounters", shape(1, 1 + cols*cols), 0,
+        sizeof(cl_uint)*(1 + double(cols)*cols),
+        [&]() { kernels->runClearCounters(all); });
+    add("classification", shape(rows, cols), 0,
+        2*sizeof(cl_float)*double(n),
+        [&]() { kernels->runClassification(Y, T, correct, &confusion); });
+}
+
+void benchmark::run() {
+    std::cout << "Device: "
+              << device_string(devices[device_id], CL_DEVICE_NAME) << " ("
+              << device_string(devices[device_id], CL_DRIVER_VERSION)
+              << ")\n";
+    measure_peaks();
+
+    // FF (256x784x2048, 256x2048x2048, 256x2048x10), BP and gradients of
+    // the MNIST network with minibatches of 256 and bigger square ones
+    const cl_uint gemms[][3] = {
+        {256, 784, 2048}, {256, 2048, 2048}, {256, 2048, 10},
+        {784, 256, 2048}, {2048, 256, 2048}, {2048, 256, 10},
+        {1024, 1024, 1024}, {2048, 2048, 2048}};
+    for (const auto &g : gemms) gemm(g[0], g[1], g[2]);
+    // int8 inference of the MNIST network
+    const cl_uint gemms_int8[][3] = {
+        {256, 784, 2048}, {256, 2048, 2048}, {256, 2048, 10}};
+    for (const auto &g : gemms_int8) gemm_int8(g[0], g[1], g[2]);
+
+    // activations of a minibatch and of the test set
+    const cl_uint layers[][2] = {{256, 784}, {256, 2048}, {10000, 2048}};
+    for (const auto &l : layers) elementwise(l[0], l[1]);
+    for (const auto &l : layers) conversions(l[0], l[1]);
+    for (const auto &l : layers) reductions(l[0], l[1]);
+
+    // output layers
+    const cl_uint outputs[][2] = {{256, 10}, {10000, 10}, {256, 1000}};
+    for (const auto &o : outputs) softmax(o[0], o[1]);
+    for (const auto &o : outputs) classification(o[0], o[1]);
+
+    // parameters of the MNIST network
+    parameters(784*2048 + 2048*2048 + 2048*10);
+    gather(60000, 256, 784);
+    // layers of the MNIST network with dropout (0.8 of the inputs and 0.5
+    // of the hidden units kept)
+    dropout(784, 2048, 627, 1024);
+    dropout(2048, 2048, 1024, 1024);
+    dropout(2048, 10, 1024, 10);
+}
+
+static std::string json_string(const std::string &s) {
+    std::string escaped;
+    for (char c : s) {
+        if (c == '"' || c == '\\') escaped += '\\';
+        escaped += c;
+    }
+    return "\"" + escaped + "\"";
+}
+
+void benchmark::save_json(const std::string &file) const {
+    std::ofstream out(file.c_str());
+    if (!out.is_open()) {
+        std::cout << "Unable to write " << file << "\n";
+        return;
+    }
+    out << std::setprecision(6)
+        << "{\n  \"device\": "
+        << json_string(device_string(devices[device_id], CL_DEVICE_NAME))
+        << ",\n  \"driver\": "
+        << json_string(device_string(devices[device_id],
+                                    CL_DRIVER_VERSION))
+        << ",\n  \"repetitions\": " << repetitions
+        << ",\n  \"peak_gflops\": " << peakGflops
+        << ",\n  \"peak_gbps\": " << peakGBps
+        << ",\n  \"results\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const result &r = results[i];
+        const bool compute = r.flops > 0;
+        const double rate = (compute?r.flops:r.bytes)/(r.median_ms*1e6);
+        out << ((i == 0)?"\n":",\n")
+            << "    {\"kernel\": " << json_string(r.kernel)
+            << ", \"shape\": " << json_string(r.shape)
+            << ", \"median_ms\": " << r.median_ms
+            << ", \"" << (compute?"gflops":"gbps") << "\": " << rate
+            << ", \"peak_pct\": "
+            << 100.0*rate/(compute?peakGflops:peakGBps) << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+int main(int argc, char** argv) {
+    size_t device = 0;
+    size_t reps = 20;
+    std::string json = "nn-bench.json";
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const std::string arg(argv[i]);
+        if (arg == "--device") {
+            device = std::strtoul(argv[i+1], nullptr, 10);
+        } else if (arg == "--reps") {
+            reps = std::max<size_t>(std::strtoul(argv[i+1], nullptr, 10), 1);
+        } else if (arg == "--json") {
+            json = argv[i+1];
+        } else {
+            std::cout << "Usage: nn-bench [--device k] [--reps n] "
+                      << "[--json file]\n";
+            return 1;
+        }
+    }
+
+    benchmark b(device, reps);
+    b.run();
+    b.save_json(json);
+    return 0;
+}
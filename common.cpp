@@ -1,9 +1,72 @@
+#include <cstdint>
+#include <cstring>
 #include <string>
 #include <vector>
 #include "common.hpp"
 
 typedef boost::tokenizer< boost::escaped_list_separator<char> > Tokenizer;
 
+cl_half float_to_half(cl_float f) {
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+    
+    const uint32_t sign = (x >> 16) & 0x8000;
+    const uint32_t absx = x & 0x7FFFFFFF;
+    
+    if (absx >= 0x7F800000) {
+        // Inf or NaN (NaN keeps a mantissa bit)
+        return cl_half(sign | 0x7C00 | ((absx > 0x7F800000)?0x200:0));
+    }
+    if (absx >= 0x477FF000) {
+        // rounds to a value greater than the maximum half (65504)
+        return cl_half(sign | 0x7C00);
+    }
+    if (absx < 0x38800000) {
+        // subnormal half or zero: shift the mantissa with the implicit 1
+        if (absx < 0x33000000) return cl_half(sign);  // < half of min subnormal
+        const uint32_t exponent = absx >> 23;
+        const uint32_t mantissa = (absx & 0x7FFFFF) | 0x800000;
+        const uint32_t shift = 126 - exponent;   // 14 to 24
+        uint32_t h = mantissa >> shift;
+        const uint32_t rest = mantissa & ((1u << shift) - 1);
+        const uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (h & 1))) h++;
+        return cl_half(sign | h);
+    }
+    // normal: rebias the exponent (127 -> 15) and round 13 bits of mantissa
+    uint32_t h = (absx - 0x38000000) >> 13;
+    const uint32_t rest = absx & 0x1FFF;
+    if (rest > 0x1000 || (rest == 0x1000 && (h & 1))) h++;
+    return cl_half(sign | h);
+}
+
+cl_float half_to_float(cl_half h) {
+    const uint32_t sign = uint32_t(h & 0x8000) << 16;
+    const uint32_t exponent = (h >> 10) & 0x1F;
+    uint32_t mantissa = h & 0x3FF;
+    uint32_t x;
+    
+    if (exponent == 0x1F) {
+        x = sign | 0x7F800000 | (mantissa << 13);   // Inf or NaN
+    } else if (exponent != 0) {
+        x = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    } else if (mantissa == 0) {
+        x = sign;   // zero
+    } else {
+        // subnormal half: normalize it
+        uint32_t e = 113;
+        while (!(mantissa & 0x400)) {
+            mantissa <<= 1;
+            e--;
+        }
+        x = sign | (e << 23) | ((mantissa & 0x3FF) << 13);
+    }
+    
+    cl_float f;
+    std::memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
 void load_nn_data(const std::string & filename,
                    cl_uint &layers,
                    std::vector<cl_uint> &elements) {
@@ -28,8 +91,7 @@ void load_nn_data(const std::string & filename,
     for (std::vector<std::string>::iterator it = vec.begin() ;
          it != vec.end(); ++it) {
         cl_uint elem = std::stoi(*it);
-        // check that every layer has a -multiple of 4- number of elements
-        assert(elem % 4 == 0);
+        assert(elem > 0);
         elements.push_back(elem);
         layers++;
     }    
@@ -154,7 +216,7 @@ void print_vector(const std::vector<cl_float> &v,
   }
 }
 
-void print(const matrix_cl_float &m,
+void print(const matrix_float &m,
            const std::string header,
            const bool rows2cols) {
   if (!header.empty())
@@ -12,49 +12,256 @@
 #include <boost/tokenizer.hpp>
 #include <boost/format.hpp>
 #include <cassert>
+#include <cstring>
+#include <memory>
 #include <vector>
 #include <string>
 
 #include <fstream>
 #include <iostream>
 
+#include "compute_types.hpp"
+
+// cl::Event of an OpenCL operation inside the compute_event of the
+// interface of the backends
+inline compute_event to_compute_event(const cl::Event & event) {
+  return compute_event(std::make_shared<cl::Event>(event));
+}
+
+// OpenCL wait list of the events of waitList (the empty events, of
+// operations already finished, are skipped)
+inline std::vector<cl::Event> to_cl_events(
+                        const std::vector<compute_event> *waitList) {
+  std::vector<cl::Event> events;
+  if (waitList == nullptr) return events;
+  for (const compute_event & e : *waitList) {
+      if (!e.empty()) events.push_back(*static_cast<cl::Event *>(e.get()));
+  }
+  return events;
+}
+
+// Map with a buffer in the device (OpenCL backend)
 template<typename T>
-struct host_device_memory_map {
-  std::vector<T> & hostData;
+struct host_device_memory_map : public host_memory_map<T> {
+  using host_memory_map<T>::hostData;
+  using host_memory_map<T>::halfStorage;
+  using host_memory_map<T>::halfData;
+  using host_memory_map<T>::transfers;
+  using host_memory_map<T>::deviceElementSize;
+
   cl::Buffer * deviceData = nullptr;
   
-  explicit inline host_device_memory_map(std::vector<T> & v) : hostData(v) {}
+  explicit inline host_device_memory_map(std::vector<T> & v,
+                                         const std::string & name = "") :
+                                         host_memory_map<T>(v, name) {}
   
   inline host_device_memory_map(const host_device_memory_map<T> & orig) :
-                                hostData(orig.hostData),
+                                host_memory_map<T>(orig),
                                 deviceData(orig.deviceData) {}
 
   inline void createBuffer(const cl::Context & context,
                            const cl_mem_flags flags) {
+    if (halfStorage) {
+        // the host pointer (CL_MEM_USE_HOST_PTR) is the half staging area
+        halfData.resize(hostData.size());
+        deviceData = new cl::Buffer(context,
+                                    flags,
+                                    halfData.size()*sizeof(cl_half),
+                                    &halfData[0]);
+        return;
+    }
     deviceData = new cl::Buffer(context,
                                 flags,
                                 hostData.size()*sizeof(T),
                                 &hostData[0]);
   }
   
-  inline void readFromDevice(const cl::CommandQueue & queue) {
+  // Blocking transfers of count elements from the element offset. The host
+  // can use hostData[offset, offset + count) as soon as they return.
+  // event (optional) is the one of the transfer (profiling).
+  inline void readRangeFromDevice(
+                        const cl::CommandQueue & queue,
+                        size_t offset,
+                        size_t count,
+                        const std::vector<cl::Event> *waitList = nullptr,
+                        cl::Event *event = nullptr) {
+      assert(offset + count <= hostData.size());
+      if (count == 0) return;
+      if (halfStorage) {
+          queue.enqueueReadBuffer(*deviceData,
+                                  CL_TRUE,
+                                  offset*sizeof(cl_half),
+                                  count*sizeof(cl_half),
+                                  &halfData[offset],
+                                  waitList,
+                                  event);
+          from_half(offset, count);
+      } else {
+          queue.enqueueReadBuffer(*deviceData,
+                                  CL_TRUE,
+                                  offset*sizeof(T),
+                                  count*sizeof(T),
+                                  &hostData[offset],
+                                  waitList,
+                                  event);
+      }
+      transfers.bytesRead += count*deviceElementSize();
+  }
+
+  inline void writeRangeToDevice(
+                        const cl::CommandQueue & queue,
+                        size_t offset,
+                        size_t count,
+                        const std::vector<cl::Event> *waitList = nullptr,
+                        cl::Event *event = nullptr) {
+      assert(offset + count <= hostData.size());
+      if (count == 0) return;
+      if (halfStorage) {
+          to_half(offset, count);
+          queue.enqueueWriteBuffer(*deviceData,
+                                   CL_TRUE,
+                                   offset*sizeof(cl_half),
+                                   count*sizeof(cl_half),
+                                   &halfData[offset],
+                                   waitList,
+                                   event);
+      } else {
+          queue.enqueueWriteBuffer(*deviceData,
+                                   CL_TRUE,
+                                   offset*sizeof(T),
+                                   count*sizeof(T),
+                                   &hostData[offset],
+                                   waitList,
+                                   event);
+      }
+      transfers.bytesWritten += count*deviceElementSize();
+  }
+  
+  // Blocking transfers of the whole map
+  inline void readFromDevice(const cl::CommandQueue & queue,
+                             const std::vector<cl::Event> *waitList = nullptr,
+                             cl::Event *event = nullptr) {
+      readRangeFromDevice(queue, 0, hostData.size(), waitList, event);
+  }
+
+  inline void writeToDevice(const cl::CommandQueue & queue,
+                            size_t bytes = 0,
+                            cl::Event *event = nullptr) {
+      // If bytes == 0 writes the whole size (bytes of the host type)
+      const size_t count = (bytes==0)?hostData.size():bytes/sizeof(T);
+      writeRangeToDevice(queue, 0, count, nullptr, event);
+  }
+  
+  // Non-blocking transfers. The range of hostData can not be touched by the
+  // host until the returned event has completed.
+  inline cl::Event readRangeFromDeviceAsync(
+                        const cl::CommandQueue & queue,
+                        size_t offset,
+                        size_t count,
+                        const std::vector<cl::Event> *waitList = nullptr) {
+      // the conversion from half would require waiting for the transfer
+      assert(!halfStorage);
+      assert(offset + count <= hostData.size());
+      cl::Event event;
       queue.enqueueReadBuffer(*deviceData,
-                              CL_TRUE,
-                              0,
-                              hostData.size()*sizeof(cl_float),
-                              &hostData[0]);
-      queue.finish();
+                              CL_FALSE,
+                              offset*sizeof(T),
+                              count*sizeof(T),
+                              &hostData[offset],
+                              waitList,
+                              &event);
+      transfers.bytesRead += count*sizeof(T);
+      return event;
   }
 
-  inline void writeToDevice(const cl::CommandQueue & queue, size_t bytes = 0) {
-      // If bytes == 0 writes the whole size
-      const size_t write_size = (bytes==0)?hostData.size()*sizeof(cl_float):bytes;
-      queue.enqueueWriteBuffer(*deviceData,
-                               CL_TRUE, 
-                               0,
-                               write_size,
-                               &hostData[0]);
-      queue.finish();
+  inline cl::Event writeRangeToDeviceAsync(
+                        const cl::CommandQueue & queue,
+                        size_t offset,
+                        size_t count,
+                        const std::vector<cl::Event> *waitList = nullptr) {
+      assert(offset + count <= hostData.size());
+      cl::Event event;
+      if (halfStorage) {
+          // converted now, halfData is the one that can not be touched
+          to_half(offset, count);
+          queue.enqueueWriteBuffer(*deviceData,
+                                   CL_FALSE,
+                                   offset*sizeof(cl_half),
+                                   count*sizeof(cl_half),
+                                   &halfData[offset],
+                                   waitList,
+                                   &event);
+      } else {
+          queue.enqueueWriteBuffer(*deviceData,
+                                   CL_FALSE,
+                                   offset*sizeof(T),
+                                   count*sizeof(T),
+                                   &hostData[offset],
+                                   waitList,
+                                   &event);
+      }
+      transfers.bytesWritten += count*deviceElementSize();
+      return event;
+  }
+  
+  inline cl::Event readFromDeviceAsync(
+                        const cl::CommandQueue & queue,
+                        const std::vector<cl::Event> *waitList = nullptr) {
+      return readRangeFromDeviceAsync(queue, 0, hostData.size(), waitList);
+  }
+
+  inline cl::Event writeToDeviceAsync(
+                        const cl::CommandQueue & queue,
+                        size_t bytes = 0,
+                        const std::vector<cl::Event> *waitList = nullptr) {
+      // If bytes == 0 writes the whole size (bytes of the host type)
+      const size_t count = (bytes==0)?hostData.size():bytes/sizeof(T);
+      return writeRangeToDeviceAsync(queue, 0, count, waitList);
+  }
+  
+  // Zero-copy read (enqueueMapBuffer) for the devices that share the
+  // memory with the host (CPUs). The region mapped of a CL_MEM_USE_HOST_PTR
+  // buffer is the one of hostData (halfData), so map and unmap only
+  // synchronize the device and the host. Other buffers are copied from the
+  // mapped region (and counted as transfers). There is no write by map: a
+  // CL_MAP_WRITE mapping may refresh the region with the device values and
+  // overwrite the new ones of the host, so writes use enqueueWriteBuffer.
+  inline void readRangeByMap(const cl::CommandQueue & queue,
+                             size_t offset,
+                             size_t count,
+                             const std::vector<cl::Event> *waitList = nullptr,
+                             cl::Event *mapEvent = nullptr,
+                             cl::Event *unmapEvent = nullptr) {
+      assert(offset + count <= hostData.size());
+      if (count == 0) return;
+      const size_t bytes = count*deviceElementSize();
+      void *region = queue.enqueueMapBuffer(*deviceData,
+                                            CL_TRUE,
+                                            CL_MAP_READ,
+                                            offset*deviceElementSize(),
+                                            bytes,
+                                            waitList,
+                                            mapEvent);
+      void *host = halfStorage?static_cast<void *>(&halfData[offset]):
+                               static_cast<void *>(&hostData[offset]);
+      if (region != host) {
+          std::memcpy(host, region, bytes);
+          transfers.bytesRead += bytes;
+      }
+      queue.enqueueUnmapMemObject(*deviceData, region, nullptr, unmapEvent);
+      if (halfStorage) from_half(offset, count);
+  }
+
+  inline void to_half(size_t offset, size_t count) {
+      for (size_t i = offset; i < offset + count; i++) {
+          halfData[i] = float_to_half(hostData[i]);
+      }
+  }
+  
+  inline void from_half(size_t offset, size_t count) {
+      for (size_t i = offset; i < offset + count; i++) {
+          hostData[i] = half_to_float(halfData[i]);
+      }
   }
   
   inline ~host_device_memory_map() {
@@ -62,34 +269,12 @@ struct host_device_memory_map {
   }
 };
 
+// Device buffer of a matrix of the OpenCL backend (its maps are always
+// host_device_memory_map)
 template <typename T>
-struct opencl_matrix {
-    host_device_memory_map<T> & data;
-    cl_uint rows;
-    cl_uint cols;
-    cl_uint offset;
-    bool colMajorOrdered = false;   // default is row major
-    
-    explicit inline opencl_matrix(host_device_memory_map<T> & d) :
-                         data(d), rows(0), cols(0), offset(0) {}
-    
-    inline opencl_matrix(const opencl_matrix<T> & orig) :
-                         data(orig.data), rows(orig.rows),
-                         cols(orig.cols), offset(orig.offset) {}
-    
-    inline opencl_matrix const & set(cl_uint r,
-                                     cl_uint c,
-                                     cl_uint o = 0,
-                                     bool matrixInColMajorOrder = false) {
-        rows = r;
-        cols = c;
-        offset = o;
-        colMajorOrdered = matrixInColMajorOrder;
-        return *this;
-    }
-};
-
-typedef opencl_matrix<cl_float> matrix_cl_float;
+inline cl::Buffer & device_buffer(matrix_view<T> const & m) {
+    return *static_cast<host_device_memory_map<T> &>(m.data).deviceData;
+}
 
 void load_nn_data(const std::string & filename,
                    cl_uint &layers,
@@ -113,11 +298,20 @@ void print_vector(const std::vector<cl_float> & v,
                   cl_uint cols,
                   cl_uint offset);
 
-void print(const matrix_cl_float &m,
+void print(const matrix_float &m,
            const std::string header = "",
            const bool rows2cols = false);
 
 void save_NN(const std::string filename);
 
+// string parameter of a device (CL_DEVICE_NAME, CL_DRIVER_VERSION, ...)
+inline std::string device_string(const cl::Device & device,
+                                 cl_device_info param) {
+  std::string value;
+  device.getInfo(param, &value);
+  // some drivers return the strings with the null terminator included
+  return value.c_str();
+}
+
 #endif  /* COMMON_HPP */
 
@@ -0,0 +1,231 @@
+/*
+ * File:   compute_backend.hpp
+ *
+ * Created on 17 de octubre de 2026
+ */
+
+#ifndef COMPUTE_BACKEND_HPP
+#define COMPUTE_BACKEND_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "compute_types.hpp"
+
+/*
+ * Dropout mask generated inside the GEMM kernels with a counter-based RNG:
+ * the element (row, col) of the result is kept with probability keep,
+ * depending only on seed, row and col, so the mask is never stored.
+ * derivative = false: mask and 1/keep scaling of the result (FF)
+ * derivative = true: same mask applied to the sigmoid derivative (BP)
+ */
+struct dropout_mask {
+    uint32_t seed;
+    float keep;
+    bool derivative;
+
+    inline dropout_mask(uint32_t s, float k, bool d) :
+                        seed(s), keep(k), derivative(d) {}
+};
+
+/*
+ * Operations used by nn (FF, BP, gradients, WA, evaluation). Implemented by
+ * OpenCLKernels (kernels enqueued in an in-order OpenCL queue) and by
+ * cpu_backend (native multithreaded code working on the host vectors of the
+ * maps, no OpenCL runtime required).
+ * The interface does not depend on OpenCL: the returned events and the wait
+ * lists are compute_event (cl::Event of the OpenCL backend). The
+ * operations of a backend that does not enqueue anything (host_memory())
+ * have finished when they return and the events are empty.
+ */
+class compute_backend {
+ public:
+    virtual ~compute_backend() {}
+
+    // true if the operations work directly on hostData of the maps: there
+    // are no device buffers and no transfers
+    virtual bool host_memory() const = 0;
+
+    // event completed when the operations of waitList have finished (all
+    // the previous operations if there is no wait list)
+    virtual compute_event marker(
+            const std::vector<compute_event> *waitList = nullptr) = 0;
+    // starts the execution of the enqueued operations
+    virtual void flush() = 0;
+    virtual void wait(const std::vector<compute_event> &events) = 0;
+
+    // dst = src (same number of elements, stored in floats)
+    virtual compute_event runCopy(
+            matrix_float const &src,
+            matrix_float const &dst,
+            const std::vector<compute_event> *waitList = nullptr) = 0;
+
+    virtual compute_event runMatrixMultiplicationSigmoid(
+            matrix_float const &A,
+            matrix_float const &B,
+            matrix_float const &C,
+            matrix_float * bias = nullptr,
+            bool calcSigmoid = false,
+            bool sumToC = false,
+            float multPrevVal = 1.0f,
+            float multSum = 1.0f,
+            matrix_float const *sigmoidDerivative = nullptr,
+            dropout_mask const *dropout = nullptr,
+            const std::vector<compute_event> *waitList = nullptr) = 0;
+
+    // e = scale*(t - y)
+    virtual compute_event runElementWiseSubstract(
+            matrix_float const &t,
+            matrix_float const &y,
+            matrix_float &e,
+            float scale = 1.0f,
+            const std::vector<compute_event> *waitList = nullptr) = 0;
+
+    virtual compute_event runElementWiseSum(
+            matrix_float const &a,
+            matrix_float const &b,
+            matrix_float &c,
+            float mult_a = 1.0f,
+            float mult_b = 1.0f,
+            const std::vector<compute_event> *waitList = nullptr) = 0;
+
+    // Cross entropy of y divided by the rows. error is scratch space.
+    virtual float runCrossEntropy(
+            matrix_float const &t,
+            matrix_float const &y,
+            matrix_float &error,
+            const std::vector<compute_event> *waitList = nullptr) = 0;
+
+    // Sum of the squares of the weights. error is scratch space.
+    virtual float runL2Regularization(
+            matrix_float const &weights,
+            matrix_float &error,
+            const std::vector<compute_event> *waitList = nullptr) = 0;
+
+    virtual compute_event runElementWiseMultiplicationBySigmoidDerivativeKernel(
+            matrix_float const &deltas,
+            matrix_float const &activations,
+            const std::vector<compute_event> *waitList = nullptr) = 0;
+
+    // Numerically stable softmax of every row (in place)
+    virtual compute_event runSoftMax(
+            matrix_float const &activations,
+            const std::vector<compute_event> *waitList = nullptr) = 0;
+
+    // Softmax of the logits y (in place), deltas = deltaScale*(y - t) and,
+    // if ce_partial is given, cross entropy partial sums
+    virtual compute_event runSoftMaxDeltaCrossEntropy(
+            matrix_float const &y,
+            matrix_float const &t,
+            matrix_float const &deltas,
+            matrix_float * ce_partial = nullptr,
+            float deltaScale = 1.0f,
+            const std::vector<compute_event> *waitList = nullptr) = 0;
+
+    // Cross entropy of rows x cols values from the partial sums calculated by
+    // runSoftMaxDeltaCrossEntropy
+    virtual float readCrossEntropyPartials(
+            matrix_float &ce_partial,
+            uint32_t rows,
+            uint32_t cols,
+            const std::vector<compute_event> *waitList = nullptr) = 0;
+
+    virtual compute_event runRowSum(
+            matrix_float &A,
+            matrix_float &result,
+            float multExisting = 0.0f,
+            float multNew = 1.0f,
+            const std::vector<compute_event> *waitList = nullptr) = 0;
+
+    virtual compute_event runMatrixScalarMultiplication(
+            matrix_float const &matrix,
+            float scalar,
+            const std::vector<compute_event> *waitList = nullptr) = 0;
+
+    // Copy of src (stored in floats) into dst (stored in halfs)
+    virtual compute_event runConvertToHalf(
+            matrix_float const &src,
+            matrix_float const &dst,
+            const std::vector<compute_event> *waitList = nullptr) = 0;
+
+    // dst = src / scale quantized to int8 (symmetric, saturated to +-127)
+    virtual compute_event runQuantize(
+            matrix_float const &src,
+            matrix_char const &dst,
+            float invScale,
+            const std::vector<compute_event> *waitList = nullptr) = 0;
+
+    // Int8 inference GEMM with int32 accumulation:
+    // C = sigmoid(scaleA * scaleB .* (A * B) + bias) (sigmoid only if
+    // calcSigmoid), quantized again to int8 with invScaleC.
+    virtual compute_event runMatrixMultiplicationInt8(
+            matrix_char const &A,
+            matrix_char const &B,
+            matrix_char const &C,
+            matrix_float const &bias,
+            matrix_float const &scaleB,
+            float scaleA,
+            float invScaleC,
+            bool calcSigmoid,
+            const std::vector<compute_event> *waitList = nullptr) = 0;
+
+    // Same with C stored in floats (logits of the output layer)
+    virtual compute_event runMatrixMultiplicationInt8(
+            matrix_char const &A,
+            matrix_char const &B,
+            matrix_float const &C,
+            matrix_float const &bias,
+            matrix_float const &scaleB,
+            float scaleA,
+            bool calcSigmoid,
+            const std::vector<compute_event> *waitList = nullptr) = 0;
+
+    // Dropout gather (scatter == false) or scatter of the selected neurons
+    virtual compute_event runDropoutGatherScatter(
+            matrix_float const &all,
+            matrix_float const &compact,
+            matrix_float const *allInc,
+            matrix_float const *compactInc,
+            matrix_uint const *rowIdx,
+            matrix_uint const &colIdx,
+            bool scatter,
+            const std::vector<compute_event> *waitList = nullptr) = 0;
+
+    // Fused optimizer step. rule is one of optimizer::rule_t.
+    virtual compute_event runOptimizerUpdate(
+            matrix_float const &w,
+            matrix_float const &state,
+            matrix_float const &gradient,
+            int32_t rule,
+            float lr,
+            float momentum,
+            float l2,
+            float gradScale,
+            const std::vector<compute_event> *waitList = nullptr) = 0;
+
+    // Minibatch gather: row r of dst = row idx[r] of src
+    virtual compute_event runGatherRows(
+            matrix_float const &src,
+            matrix_float const &dst,
+            matrix_uint const &idx,
+            const std::vector<compute_event> *waitList = nullptr) = 0;
+
+    // counters = 0 (rows*cols elements from the offset)
+    virtual compute_event runClearCounters(
+            matrix_uint const &counters,
+            const std::vector<compute_event> *waitList = nullptr) = 0;
+
+    // Classification of the rows of y (predictions) against the one-hot
+    // targets t (argmax of every row): correct (one element) += rows with
+    // the same argmax and, if given, confusion (t.cols x t.cols, row =
+    // target, column = prediction) += 1 for every row. The counters are
+    // accumulated until runClearCounters.
+    virtual compute_event runClassification(
+            matrix_float const &y,
+            matrix_float const &t,
+            matrix_uint const &correct,
+            matrix_uint const *confusion = nullptr,
+            const std::vector<compute_event> *waitList = nullptr) = 0;
+};
+
+#endif  /* COMPUTE_BACKEND_HPP */
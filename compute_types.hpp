@@ -0,0 +1,123 @@
+/*
+ * File:   compute_types.hpp
+ *
+ * Created on 17 de octubre de 2026
+ */
+
+#ifndef COMPUTE_TYPES_HPP
+#define COMPUTE_TYPES_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * Types of the interface of the backends (compute_backend). They do not
+ * depend on the OpenCL headers, so a backend that works on the host (the
+ * native CPU one) can be compiled without them. The OpenCL side (device
+ * buffers, transfers and events) is added by common.hpp.
+ */
+
+// IEEE 754 half precision conversions (round to nearest even), cl_half is
+// an uint16_t
+uint16_t float_to_half(float f);
+float half_to_float(uint16_t h);
+
+// Bytes transferred between the host and the device by a map since the
+// last reset (transfer accounting of the training)
+struct transfer_count {
+  std::string name;
+  size_t bytesRead = 0;       // device -> host
+  size_t bytesWritten = 0;    // host -> device
+
+  explicit inline transfer_count(const std::string & n) : name(n) {}
+
+  inline void reset() { bytesRead = bytesWritten = 0; }
+};
+
+// Host side of a map: the values and the storage format of the device.
+// host_device_memory_map (common.hpp) adds the device buffer.
+template<typename T>
+struct host_memory_map {
+  std::vector<T> & hostData;
+
+  // Device storage in 16 bits (half) floats. The host keeps the values in
+  // hostData as T, the transfers convert them through halfData.
+  // Set it before createBuffer().
+  bool halfStorage = false;
+  std::vector<uint16_t> halfData;   // cl_half
+
+  // counted by every transfer
+  transfer_count transfers;
+
+  explicit inline host_memory_map(std::vector<T> & v,
+                                  const std::string & name = "") :
+                                  hostData(v), transfers(name) {}
+
+  inline host_memory_map(const host_memory_map<T> & orig) :
+                         hostData(orig.hostData),
+                         halfStorage(orig.halfStorage),
+                         transfers(orig.transfers.name) {}
+
+  // size of an element in device memory
+  inline size_t deviceElementSize() const {
+      return halfStorage?sizeof(uint16_t):sizeof(T);
+  }
+};
+
+template <typename T>
+struct matrix_view {
+    host_memory_map<T> & data;
+    uint32_t rows;
+    uint32_t cols;
+    uint32_t offset;
+    bool colMajorOrdered = false;   // default is row major
+
+    explicit inline matrix_view(host_memory_map<T> & d) :
+                         data(d), rows(0), cols(0), offset(0) {}
+
+    inline matrix_view(const matrix_view<T> & orig) :
+                         data(orig.data), rows(orig.rows),
+                         cols(orig.cols), offset(orig.offset) {}
+
+    inline matrix_view const & set(uint32_t r,
+                                   uint32_t c,
+                                   uint32_t o = 0,
+                                   bool matrixInColMajorOrder = false) {
+        rows = r;
+        cols = c;
+        offset = o;
+        colMajorOrdered = matrixInColMajorOrder;
+        return *this;
+    }
+
+    // kernel flag of the storage format of the data (1 if halfs)
+    inline int32_t isHalf() const { return data.halfStorage?1:0; }
+};
+
+typedef matrix_view<float> matrix_float;
+typedef matrix_view<int8_t> matrix_char;
+typedef matrix_view<uint32_t> matrix_uint;
+
+/*
+ * Completion of an operation of a backend. Opaque for the code that only
+ * chains the operations: the OpenCL backend keeps its cl::Event in it
+ * (to_compute_event() of common.hpp) and it is empty for the operations
+ * that have finished when they return.
+ */
+class compute_event {
+ public:
+    inline compute_event() {}
+    explicit inline compute_event(const std::shared_ptr<void> &h) :
+                                  handle(h) {}
+
+    inline bool empty() const { return !handle; }
+    inline void * get() const { return handle.get(); }
+
+ private:
+    std::shared_ptr<void> handle;
+};
+
+#endif  /* COMPUTE_TYPES_HPP */
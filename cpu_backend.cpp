@@ -0,0 +1,824 @@
+/*
+ * File:   cpu_backend.cpp
+ *
+ * Created on 17 de octubre de 2026
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_BACKEND_X86
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "cpu_backend.hpp"
+#include "optimizer.hpp"
+
+const size_t cpu_backend::gemmMR;
+const size_t cpu_backend::gemmNR;
+const size_t cpu_backend::gemmKC;
+const size_t cpu_backend::gemmMC;
+const size_t cpu_backend::gemmNC;
+const size_t cpu_backend::elementsPerTask;
+
+namespace {
+
+inline float sigmoid(float x) {
+    return 1.0f / (1.0f + std::exp(-x));
+}
+
+// same than cross_entropy_element() of the kernels
+inline float cross_entropy_element(float t, float y) {
+    const float epsilon = 1E-30f;
+    return t * std::log(y + epsilon) + (1.0f - t) * std::log(1.0f - y + epsilon);
+}
+
+// philox2x32_10() and dropout_keep() of the kernels: the same masks than
+// the OpenCL backend
+inline bool dropout_keep(uint32_t row, uint32_t col, uint32_t seed,
+                         uint32_t keepThreshold) {
+    uint32_t x = row;
+    uint32_t y = col;
+    uint32_t key = seed;
+    for (int round = 0; round < 10; round++) {
+        const uint64_t product = uint64_t(0xD256D193u) * x;
+        const uint32_t hi = uint32_t(product >> 32);
+        const uint32_t lo = uint32_t(product);
+        x = hi ^ key ^ y;
+        y = lo;
+        key += 0x9E3779B9u;
+    }
+    return x < keepThreshold;
+}
+
+inline uint32_t keep_threshold(float keep) {
+    return (keep >= 1.0f)?0xFFFFFFFFu:uint32_t(keep*4294967296.0);
+}
+
+// round to nearest even and saturation of convert_char_sat_rte(clamp())
+inline int8_t quantize(float value) {
+    return int8_t(std::nearbyint(std::min(std::max(value, -127.0f), 127.0f)));
+}
+
+}  // namespace
+
+cpu_backend::cpu_backend(size_t threads) :
+             pool((threads != 0)?threads:std::thread::hardware_concurrency()),
+             micro_kernel(select_micro_kernel()) {
+}
+
+/*
+ * The micro-kernels are compiled for their instruction sets
+ * (target attribute) and the one of the machine is chosen at runtime, so
+ * the executable does not need -march.
+ */
+cpu_backend::micro_kernel_fn cpu_backend::select_micro_kernel() {
+#ifdef CPU_BACKEND_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return micro_kernel_avx512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return micro_kernel_avx2;
+#endif
+    return micro_kernel_portable;
+}
+
+/*
+ * c[gemmMR x gemmNR] (leading dimension ldc) += a * b, being a a packed
+ * panel of A (gemmMR values per k) and b one of B (gemmNR values per k).
+ * The accumulators stay in registers during the whole depth.
+ */
+#ifdef CPU_BACKEND_X86
+__attribute__((target("avx512f")))
+void cpu_backend::micro_kernel_avx512(size_t kc,
+                                      const float *a,
+                                      const float *b,
+                                      float *c,
+                                      size_t ldc) {
+    static_assert(gemmNR == 16, "one AVX-512 register per row");
+    __m512 acc[gemmMR];
+    for (size_t i = 0; i < gemmMR; i++) acc[i] = _mm512_loadu_ps(c + i*ldc);
+    for (size_t k = 0; k < kc; k++) {
+        const __m512 bv = _mm512_loadu_ps(b + k*gemmNR);
+        for (size_t i = 0; i < gemmMR; i++) {
+            acc[i] = _mm512_fmadd_ps(_mm512_set1_ps(a[k*gemmMR + i]), bv,
+                                     acc[i]);
+        }
+    }
+    for (size_t i = 0; i < gemmMR; i++) _mm512_storeu_ps(c + i*ldc, acc[i]);
+}
+
+__attribute__((target("avx2,fma")))
+void cpu_backend::micro_kernel_avx2(size_t kc,
+                                    const float *a,
+                                    const float *b,
+                                    float *c,
+                                    size_t ldc) {
+    static_assert(gemmNR == 16, "two AVX2 registers per row");
+    __m256 acc[gemmMR][2];
+    for (size_t i = 0; i < gemmMR; i++) {
+        acc[i][0] = _mm256_loadu_ps(c + i*ldc);
+        acc[i][1] = _mm256_loadu_ps(c + i*ldc + 8);
+    }
+    for (size_t k = 0; k < kc; k++) {
+        const __m256 b0 = _mm256_loadu_ps(b + k*gemmNR);
+        const __m256 b1 = _mm256_loadu_ps(b + k*gemmNR + 8);
+        for (size_t i = 0; i < gemmMR; i++) {
+            const __m256 av = _mm256_broadcast_ss(a + k*gemmMR + i);
+            acc[i][0] = _mm256_fmadd_ps(av, b0, acc[i][0]);
+            acc[i][1] = _mm256_fmadd_ps(av, b1, acc[i][1]);
+        }
+    }
+    for (size_t i = 0; i < gemmMR; i++) {
+        _mm256_storeu_ps(c + i*ldc, acc[i][0]);
+        _mm256_storeu_ps(c + i*ldc + 8, acc[i][1]);
+    }
+}
+#endif
+
+// portable version (vectorized by the compiler, SSE2 on x86-64)
+void cpu_backend::micro_kernel_portable(size_t kc,
+                                        const float *a,
+                                        const float *b,
+                                        float *c,
+                                        size_t ldc) {
+    float acc[gemmMR][gemmNR];
+    for (size_t i = 0; i < gemmMR; i++)
+        for (size_t j = 0; j < gemmNR; j++)
+            acc[i][j] = c[i*ldc + j];
+    for (size_t k = 0; k < kc; k++) {
+        for (size_t i = 0; i < gemmMR; i++) {
+            const float av = a[k*gemmMR + i];
+            for (size_t j = 0; j < gemmNR; j++)
+                acc[i][j] += av * b[k*gemmNR + j];
+        }
+    }
+    for (size_t i = 0; i < gemmMR; i++)
+        for (size_t j = 0; j < gemmNR; j++)
+            c[i*ldc + j] = acc[i][j];
+}
+
+/*
+ * packedA: panel p (rows p*gemmMR ...) of the whole depth, gemmMR values
+ * (one per row, 0 outside of A) for every k.
+ */
+void cpu_backend::pack_A(matrix_float const &A) {
+    const size_t M = A.rows;
+    const size_t K = A.cols;
+    const size_t panels = (M + gemmMR - 1) / gemmMR;
+    if (packedA.size() < panels*gemmMR*K) packedA.resize(panels*gemmMR*K);
+
+    const float *a = &A.data.hostData[A.offset];
+    const bool colMajor = A.colMajorOrdered;
+    pool.parallel_for(panels, std::max<size_t>(1, panels / (4*pool.size())),
+                      [&](size_t begin, size_t end) {
+        for (size_t p = begin; p < end; p++) {
+            float *dst = &packedA[p*gemmMR*K];
+            for (size_t i = 0; i < gemmMR; i++) {
+                const size_t r = p*gemmMR + i;
+                for (size_t k = 0; k < K; k++) {
+                    dst[k*gemmMR + i] = (r >= M) ? 0.0f :
+                                        (colMajor ? a[k*M + r] : a[r*K + k]);
+                }
+            }
+        }
+    });
+}
+
+/*
+ * packedB: panel q (cols q*gemmNR ...) of the whole depth, gemmNR values
+ * (one per col, 0 outside of B) for every k.
+ */
+void cpu_backend::pack_B(matrix_float const &B) {
+    const size_t K = B.rows;
+    const size_t N = B.cols;
+    const size_t panels = (N + gemmNR - 1) / gemmNR;
+    if (packedB.size() < panels*gemmNR*K) packedB.resize(panels*gemmNR*K);
+
+    const float *b = &B.data.hostData[B.offset];
+    const bool colMajor = B.colMajorOrdered;
+    pool.parallel_for(panels, std::max<size_t>(1, panels / (4*pool.size())),
+                      [&](size_t begin, size_t end) {
+        for (size_t q = begin; q < end; q++) {
+            float *dst = &packedB[q*gemmNR*K];
+            for (size_t k = 0; k < K; k++) {
+                for (size_t j = 0; j < gemmNR; j++) {
+                    const size_t c = q*gemmNR + j;
+                    dst[k*gemmNR + j] = (c >= N) ? 0.0f :
+                                        (colMajor ? b[c*K + k] : b[k*N + c]);
+                }
+            }
+        }
+    });
+}
+
+/*
+ * Same operation and epilogue than matrixMultiplicationSigmoidKernelTiled.
+ * One task per gemmMC x gemmNC block of C: the block is accumulated in a
+ * buffer of the thread (whole register tiles, the padding of the panels is
+ * 0) and written to C by the epilogue.
+ */
+compute_event cpu_backend::runMatrixMultiplicationSigmoid(
+                                    matrix_float const &A,
+                                    matrix_float const &B,
+                                    matrix_float const &C,
+                                    matrix_float *bias,
+                                    bool calcSigmoid,
+                                    bool sumToC,
+                                    float multPrevVal,
+                                    float multSum,
+                                    matrix_float const *sigmoidDerivative,
+                                    dropout_mask const *dropout,
+                                    const std::vector<compute_event> *waitList) {
+    assert(C.rows == A.rows && C.cols == B.cols && A.cols == B.rows);
+    assert(sigmoidDerivative == nullptr ||
+           (sigmoidDerivative->rows == C.rows &&
+            sigmoidDerivative->cols == C.cols));
+    assert(dropout == nullptr || !dropout->derivative ||
+           sigmoidDerivative != nullptr);
+    assert(!C.colMajorOrdered);
+
+    const size_t M = C.rows;
+    const size_t N = C.cols;
+    const size_t K = A.cols;
+    if (M == 0 || N == 0) return compute_event();
+
+    pack_A(A);
+    pack_B(B);
+
+    const float keep = (dropout == nullptr)?1.0f:dropout->keep;
+    const uint32_t threshold = keep_threshold(keep);
+    const bool dropMask = dropout != nullptr && !dropout->derivative;
+    const bool dropDerivative = dropout != nullptr && dropout->derivative;
+
+    const size_t tilesM = (M + gemmMC - 1) / gemmMC;
+    const size_t tilesN = (N + gemmNC - 1) / gemmNC;
+    pool.parallel_for(tilesM*tilesN, 1, [&](size_t begin, size_t end) {
+        thread_local std::vector<float> acc;
+        acc.resize(gemmMC*gemmNC);
+
+        for (size_t tile = begin; tile < end; tile++) {
+            const size_t i0 = (tile / tilesN) * gemmMC;
+            const size_t j0 = (tile % tilesN) * gemmNC;
+            const size_t mc = std::min(gemmMC, M - i0);
+            const size_t nc = std::min(gemmNC, N - j0);
+            const size_t panelsM = (mc + gemmMR - 1) / gemmMR;
+            const size_t panelsN = (nc + gemmNR - 1) / gemmNR;
+
+            std::fill(acc.begin(), acc.end(), 0.0f);
+            for (size_t k0 = 0; k0 < K; k0 += gemmKC) {
+                const size_t kc = std::min(gemmKC, K - k0);
+                for (size_t q = 0; q < panelsN; q++) {
+                    const float *b =
+                        &packedB[((j0 / gemmNR + q)*K + k0)*gemmNR];
+                    for (size_t p = 0; p < panelsM; p++) {
+                        const float *a =
+                            &packedA[((i0 / gemmMR + p)*K + k0)*gemmMR];
+                        micro_kernel(kc, a, b,
+                                     &acc[p*gemmMR*gemmNC + q*gemmNR],
+                                     gemmNC);
+                    }
+                }
+            }
+
+            // epilogue
+            for (size_t i = 0; i < mc; i++) {
+                const size_t row = i0 + i;
+                float *c = &C.data.hostData[C.offset + row*N + j0];
+                const float *bv = (bias == nullptr) ? nullptr :
+                                     &bias->data.hostData[bias->offset + j0];
+                const float *d = (sigmoidDerivative == nullptr) ? nullptr :
+                    &sigmoidDerivative->data.hostData[
+                                    sigmoidDerivative->offset + row*N + j0];
+                for (size_t j = 0; j < nc; j++) {
+                    const size_t col = j0 + j;
+                    float sum = acc[i*gemmNC + j];
+
+                    if (bv != nullptr) sum += bv[j];
+
+                    if (calcSigmoid) sum = sigmoid(sum);
+
+                    if (d != nullptr) {
+                        float a = d[j];
+                        if (dropDerivative) {
+                            if (dropout_keep(row, col, dropout->seed,
+                                             threshold)) {
+                                // the activation was divided by keep
+                                a *= keep;
+                                sum *= a * (1.0f - a) / keep;
+                            } else {
+                                sum = 0.0f;
+                            }
+                        } else {
+                            sum *= a * (1.0f - a);
+                        }
+                    }
+
+                    if (dropMask) {
+                        sum = dropout_keep(row, col, dropout->seed,
+                                           threshold) ? sum / keep : 0.0f;
+                    }
+
+                    if (sumToC) sum = multPrevVal * c[j] + multSum * sum;
+                    c[j] = sum;
+                }
+            }
+        }
+    });
+    return compute_event();
+}
+
+compute_event cpu_backend::runCopy(matrix_float const &src,
+                               matrix_float const &dst,
+                               const std::vector<compute_event> *waitList) {
+    assert(src.rows*src.cols == dst.rows*dst.cols);
+
+    const size_t n = src.rows*src.cols;
+    const float *s = src.data.hostData.data() + src.offset;
+    float *d = dst.data.hostData.data() + dst.offset;
+    pool.parallel_for(n, elementsPerTask, [&](size_t begin, size_t end) {
+        std::copy(s + begin, s + end, d + begin);
+    });
+    return compute_event();
+}
+
+compute_event cpu_backend::runElementWiseSubstract(
+            matrix_float const &tm,
+            matrix_float const &ym,
+            matrix_float &em,
+            float scale,
+            const std::vector<compute_event> *waitList) {
+    assert(tm.cols == ym.cols && tm.rows == ym.rows &&
+           tm.cols == em.cols && tm.rows == em.rows);
+
+    const size_t n = ym.rows*ym.cols;
+    const float *t = tm.data.hostData.data() + tm.offset;
+    const float *y = ym.data.hostData.data() + ym.offset;
+    float *e = em.data.hostData.data() + em.offset;
+    pool.parallel_for(n, elementsPerTask, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) e[i] = scale * (t[i] - y[i]);
+    });
+    return compute_event();
+}
+
+compute_event cpu_backend::runElementWiseSum(
+            matrix_float const &a,
+            matrix_float const &b,
+            matrix_float &c,
+            float mult_a,
+            float mult_b,
+            const std::vector<compute_event> *waitList) {
+    assert(a.cols == b.cols && a.rows == b.rows &&
+           a.cols == c.cols && a.rows == c.rows);
+
+    const size_t n = b.rows*b.cols;
+    const float *av = a.data.hostData.data() + a.offset;
+    const float *bv = b.data.hostData.data() + b.offset;
+    float *cv = c.data.hostData.data() + c.offset;
+    pool.parallel_for(n, elementsPerTask, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+            cv[i] = mult_a * av[i] + mult_b * bv[i];
+    });
+    return compute_event();
+}
+
+compute_event cpu_backend::runElementWiseMultiplicationBySigmoidDerivativeKernel(
+            matrix_float const &deltas,
+            matrix_float const &activations,
+            const std::vector<compute_event> *waitList) {
+    assert(deltas.cols == activations.cols &&
+           deltas.rows == activations.rows);
+
+    const size_t n = deltas.rows*deltas.cols;
+    float *del = deltas.data.hostData.data() + deltas.offset;
+    const float *act = activations.data.hostData.data() +
+                          activations.offset;
+    pool.parallel_for(n, elementsPerTask, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+            del[i] *= act[i] * (1.0f - act[i]);
+    });
+    return compute_event();
+}
+
+float cpu_backend::runCrossEntropy(matrix_float const &t,
+                                      matrix_float const &y,
+                                      matrix_float &error,
+                                      const std::vector<compute_event> *waitList) {
+    assert(t.rows == y.rows && t.cols == y.cols);
+
+    const size_t n = y.rows*y.cols;
+    const float *tv = t.data.hostData.data() + t.offset;
+    const float *yv = y.data.hostData.data() + y.offset;
+    // one partial sum per task
+    std::vector<double> partial((n + elementsPerTask - 1) / elementsPerTask);
+    pool.parallel_for(n, elementsPerTask, [&](size_t begin, size_t end) {
+        double sum = 0.0;
+        for (size_t i = begin; i < end; i++)
+            sum += cross_entropy_element(tv[i], yv[i]);
+        partial[begin / elementsPerTask] = sum;
+    });
+    double ce = 0.0;
+    for (double p : partial) ce += p;
+
+    return -float(ce)/(y.rows);
+}
+
+float cpu_backend::runL2Regularization(
+            matrix_float const &weights,
+            matrix_float &error,
+            const std::vector<compute_event> *waitList) {
+    const size_t n = weights.rows*weights.cols;
+    const float *w = weights.data.hostData.data() + weights.offset;
+    std::vector<double> partial((n + elementsPerTask - 1) / elementsPerTask);
+    pool.parallel_for(n, elementsPerTask, [&](size_t begin, size_t end) {
+        double sum = 0.0;
+        for (size_t i = begin; i < end; i++) sum += w[i] * w[i];
+        partial[begin / elementsPerTask] = sum;
+    });
+    double l2 = 0.0;
+    for (double p : partial) l2 += p;
+    return float(l2);
+}
+
+compute_event cpu_backend::runSoftMax(matrix_float const &activations,
+                                  const std::vector<compute_event> *waitList) {
+    const size_t rows = activations.rows;
+    const size_t cols = activations.cols;
+    float *z = activations.data.hostData.data() + activations.offset;
+    pool.parallel_for(rows, std::max<size_t>(1, elementsPerTask / cols),
+                      [&](size_t begin, size_t end) {
+        for (size_t r = begin; r < end; r++) {
+            float *row = z + r*cols;
+            const float maximum = *std::max_element(row, row + cols);
+            float sum = 0.0f;
+            for (size_t j = 0; j < cols; j++) {
+                row[j] = std::exp(row[j] - maximum);
+                sum += row[j];
+            }
+            const float inv_sum = 1.0f / sum;
+            for (size_t j = 0; j < cols; j++) row[j] *= inv_sum;
+        }
+    });
+    return compute_event();
+}
+
+compute_event cpu_backend::runSoftMaxDeltaCrossEntropy(
+            matrix_float const &y,
+            matrix_float const &t,
+            matrix_float const &deltas,
+            matrix_float *ce_partial,
+            float deltaScale,
+            const std::vector<compute_event> *waitList) {
+    assert(y.rows == t.rows && y.cols == t.cols &&
+           y.rows == deltas.rows && y.cols == deltas.cols);
+
+    const size_t rows = y.rows;
+    const size_t cols = y.cols;
+    float *z = y.data.hostData.data() + y.offset;
+    const float *tv = t.data.hostData.data() + t.offset;
+    float *del = deltas.data.hostData.data() + deltas.offset;
+    // cross entropy of every row
+    std::vector<float> rowCE(rows);
+    pool.parallel_for(rows, std::max<size_t>(1, elementsPerTask / cols),
+                      [&](size_t begin, size_t end) {
+        for (size_t r = begin; r < end; r++) {
+            float *zr = z + r*cols;
+            const float *tr = tv + r*cols;
+            float *dr = del + r*cols;
+            const float maximum = *std::max_element(zr, zr + cols);
+            float sum = 0.0f;
+            for (size_t j = 0; j < cols; j++) {
+                zr[j] = std::exp(zr[j] - maximum);
+                sum += zr[j];
+            }
+            const float inv_sum = 1.0f / sum;
+            float ce = 0.0f;
+            for (size_t j = 0; j < cols; j++) {
+                zr[j] *= inv_sum;
+                dr[j] = deltaScale * (zr[j] - tr[j]);
+                ce += cross_entropy_element(tr[j], zr[j]);
+            }
+            rowCE[r] = ce;
+        }
+    });
+
+    if (ce_partial != nullptr) {
+        double ce = 0.0;
+        for (float c : rowCE) ce += c;
+        ce_partial->data.hostData[ce_partial->offset] = float(ce);
+    }
+    return compute_event();
+}
+
+float cpu_backend::readCrossEntropyPartials(
+            matrix_float &ce_partial,
+            uint32_t rows,
+            uint32_t cols,
+            const std::vector<compute_event> *waitList) {
+    // only one partial (the whole matrix)
+    return -ce_partial.data.hostData[ce_partial.offset]/rows;
+}
+
+compute_event cpu_backend::runRowSum(matrix_float &A,
+                                 matrix_float &result,
+                                 float multExisting,
+                                 float multNew,
+                                 const std::vector<compute_event> *waitList) {
+    assert(result.rows*result.cols == A.cols && !A.colMajorOrdered);
+
+    const size_t rows = A.rows;
+    const size_t cols = A.cols;
+    const float *a = A.data.hostData.data() + A.offset;
+    float *res = result.data.hostData.data() + result.offset;
+    // blocks of columns, the rows are read in order
+    const size_t colsPerTask = 256;
+    pool.parallel_for(cols, colsPerTask, [&](size_t begin, size_t end) {
+        float sums[colsPerTask] = {};
+        for (size_t r = 0; r < rows; r++) {
+            const float *row = a + r*cols;
+            for (size_t c = begin; c < end; c++) sums[c - begin] += row[c];
+        }
+        for (size_t c = begin; c < end; c++) {
+            // the previous value is not read if it is not used (gradients)
+            const float prev = (multExisting == 0.0f) ? 0.0f :
+                                  multExisting * res[c];
+            res[c] = prev + multNew * sums[c - begin];
+        }
+    });
+    return compute_event();
+}
+
+compute_event cpu_backend::runMatrixScalarMultiplication(
+            matrix_float const &matrix,
+            float scalar,
+            const std::vector<compute_event> *waitList) {
+    const size_t n = matrix.cols * matrix.rows;
+    float *m = matrix.data.hostData.data() + matrix.offset;
+    pool.parallel_for(n, elementsPerTask, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) m[i] *= scalar;
+    });
+    return compute_event();
+}
+
+compute_event cpu_backend::runConvertToHalf(
+            matrix_float const &src,
+            matrix_float const &dst,
+            const std::vector<compute_event> *waitList) {
+    assert(src.rows*src.cols == dst.rows*dst.cols);
+
+    const size_t n = src.cols * src.rows;
+    const float *s = src.data.hostData.data() + src.offset;
+    float *d = dst.data.hostData.data() + dst.offset;
+    pool.parallel_for(n, elementsPerTask, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+            d[i] = half_to_float(float_to_half(s[i]));
+    });
+    return compute_event();
+}
+
+compute_event cpu_backend::runQuantize(matrix_float const &src,
+                                   matrix_char const &dst,
+                                   float invScale,
+                                   const std::vector<compute_event> *waitList) {
+    assert(src.rows*src.cols == dst.rows*dst.cols);
+
+    const size_t n = src.cols * src.rows;
+    const float *s = src.data.hostData.data() + src.offset;
+    int8_t *d = dst.data.hostData.data() + dst.offset;
+    pool.parallel_for(n, elementsPerTask, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) d[i] = quantize(s[i] * invScale);
+    });
+    return compute_event();
+}
+
+compute_event cpu_backend::runMatrixMultiplicationInt8(
+            matrix_char const &A,
+            matrix_char const &B,
+            matrix_char const &C,
+            matrix_float const &bias,
+            matrix_float const &scaleB,
+            float scaleA,
+            float invScaleC,
+            bool calcSigmoid,
+            const std::vector<compute_event> *waitList) {
+    assert(C.rows == A.rows && C.cols == B.cols);
+    int8_gemm(A, B, C.data.hostData.data() + C.offset, nullptr, bias, scaleB,
+              scaleA, invScaleC, calcSigmoid);
+    return compute_event();
+}
+
+compute_event cpu_backend::runMatrixMultiplicationInt8(
+            matrix_char const &A,
+            matrix_char const &B,
+            matrix_float const &C,
+            matrix_float const &bias,
+            matrix_float const &scaleB,
+            float scaleA,
+            bool calcSigmoid,
+            const std::vector<compute_event> *waitList) {
+    assert(C.rows == A.rows && C.cols == B.cols);
+    int8_gemm(A, B, nullptr, C.data.hostData.data() + C.offset, bias, scaleB,
+              scaleA, 1.0f, calcSigmoid);
+    return compute_event();
+}
+
+/*
+ * Same than matrixMultiplicationInt8Kernel: int32 accumulation of a row of
+ * C at a time (the rows of B are read in order), dequantization, bias and
+ * sigmoid. The result is quantized into Cq or stored in floats in Cf.
+ */
+void cpu_backend::int8_gemm(matrix_char const &A,
+                            matrix_char const &B,
+                            int8_t *Cq,
+                            float *Cf,
+                            matrix_float const &bias,
+                            matrix_float const &scaleB,
+                            float scaleA,
+                            float invScaleC,
+                            bool calcSigmoid) {
+    // only row major matrices (the quantized copies are never transposed)
+    assert(A.cols == B.rows && !A.colMajorOrdered && !B.colMajorOrdered);
+    assert(bias.offset == scaleB.offset);
+
+    const size_t rows = A.rows;
+    const size_t K = A.cols;
+    const size_t N = B.cols;
+    const int8_t *a = A.data.hostData.data() + A.offset;
+    const int8_t *b = B.data.hostData.data() + B.offset;
+    const float *bv = bias.data.hostData.data() + bias.offset;
+    const float *sb = scaleB.data.hostData.data() + scaleB.offset;
+    pool.parallel_for(rows, std::max<size_t>(1, elementsPerTask / (N*K + 1)),
+                      [&](size_t begin, size_t end) {
+        std::vector<int32_t> acc(N);
+        for (size_t r = begin; r < end; r++) {
+            std::fill(acc.begin(), acc.end(), 0);
+            for (size_t k = 0; k < K; k++) {
+                const int32_t av = a[r*K + k];
+                if (av == 0) continue;
+                const int8_t *brow = b + k*N;
+                for (size_t c = 0; c < N; c++) acc[c] += av * brow[c];
+            }
+            for (size_t c = 0; c < N; c++) {
+                float sum = float(acc[c]) * scaleA * sb[c] + bv[c];
+                if (calcSigmoid) sum = sigmoid(sum);
+                if (Cq != nullptr) {
+                    Cq[r*N + c] = quantize(sum * invScaleC);
+                } else {
+                    Cf[r*N + c] = sum;
+                }
+            }
+        }
+    });
+}
+
+compute_event cpu_backend::runDropoutGatherScatter(
+            matrix_float const &all,
+            matrix_float const &compact,
+            matrix_float const *allInc,
+            matrix_float const *compactInc,
+            matrix_uint const *rowIdx,
+            matrix_uint const &colIdx,
+            bool scatter,
+            const std::vector<compute_event> *waitList) {
+    assert((allInc == nullptr) == (compactInc == nullptr));
+    assert(rowIdx != nullptr || compact.rows == 1);
+
+    const size_t rows = compact.rows;
+    const size_t cols = compact.cols;
+    pool.parallel_for(rows, std::max<size_t>(1, elementsPerTask / (cols + 1)),
+                      [&](size_t begin, size_t end) {
+        for (size_t r = begin; r < end; r++) {
+            const size_t rowAll = (rowIdx == nullptr) ? 0 :
+                        rowIdx->data.hostData[rowIdx->offset + r];
+            for (size_t c = 0; c < cols; c++) {
+                const size_t idxAll = all.offset + rowAll*all.cols +
+                        colIdx.data.hostData[colIdx.offset + c];
+                const size_t idxCompact = compact.offset + r*cols + c;
+                if (scatter) {
+                    all.data.hostData[idxAll] =
+                                    compact.data.hostData[idxCompact];
+                    if (allInc != nullptr) {
+                        allInc->data.hostData[idxAll] =
+                                    compactInc->data.hostData[idxCompact];
+                    }
+                } else {
+                    compact.data.hostData[idxCompact] =
+                                    all.data.hostData[idxAll];
+                    if (allInc != nullptr) {
+                        compactInc->data.hostData[idxCompact] =
+                                    allInc->data.hostData[idxAll];
+                    }
+                }
+            }
+        }
+    });
+    return compute_event();
+}
+
+compute_event cpu_backend::runGatherRows(matrix_float const &src,
+                                     matrix_float const &dst,
+                                     matrix_uint const &idx,
+                                     const std::vector<compute_event> *waitList) {
+    assert(src.cols == dst.cols);
+    assert(idx.rows*idx.cols == dst.rows);
+    assert(src.offset == 0);
+
+    const size_t cols = dst.cols;
+    const uint32_t *rowsIdx = idx.data.hostData.data() + idx.offset;
+    const float *s = src.data.hostData.data();
+    float *d = dst.data.hostData.data() + dst.offset;
+    pool.parallel_for(dst.rows, std::max<size_t>(1, elementsPerTask / cols),
+                      [&](size_t begin, size_t end) {
+        for (size_t r = begin; r < end; r++) {
+            const float *row = s + size_t(rowsIdx[r])*cols;
+            std::copy(row, row + cols, d + r*cols);
+        }
+    });
+    return compute_event();
+}
+
+compute_event cpu_backend::runClearCounters(
+            matrix_uint const &counters,
+            const std::vector<compute_event> *waitList) {
+    uint32_t *c = counters.data.hostData.data() + counters.offset;
+    std::fill(c, c + counters.rows*counters.cols, 0);
+    return compute_event();
+}
+
+/*
+ * classificationKernel: every task counts its rows and adds them to the
+ * counters under the lock (one merge per task)
+ */
+compute_event cpu_backend::runClassification(
+            matrix_float const &y,
+            matrix_float const &t,
+            matrix_uint const &correct,
+            matrix_uint const *confusion,
+            const std::vector<compute_event> *waitList) {
+    assert(y.rows == t.rows && y.cols == t.cols);
+    assert(confusion == nullptr ||
+           confusion->rows*confusion->cols == y.cols*y.cols);
+
+    const size_t cols = y.cols;
+    const float *yv = y.data.hostData.data() + y.offset;
+    const float *tv = t.data.hostData.data() + t.offset;
+    uint32_t *c = correct.data.hostData.data() + correct.offset;
+    uint32_t *m = (confusion == nullptr)?nullptr:
+                 confusion->data.hostData.data() + confusion->offset;
+    std::mutex lock;
+    pool.parallel_for(y.rows, std::max<size_t>(1, elementsPerTask / cols),
+                      [&](size_t begin, size_t end) {
+        uint32_t hits = 0;
+        std::vector<uint32_t> counts((m == nullptr)?0:cols*cols, 0);
+        for (size_t r = begin; r < end; r++) {
+            const float *yr = yv + r*cols;
+            const float *tr = tv + r*cols;
+            const size_t prediction = std::max_element(yr, yr + cols) - yr;
+            const size_t target = std::max_element(tr, tr + cols) - tr;
+            if (prediction == target) hits++;
+            if (m != nullptr) counts[target*cols + prediction]++;
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        *c += hits;
+        for (size_t i = 0; i < counts.size(); i++) m[i] += counts[i];
+    });
+    return compute_event();
+}
+
+/*
+ * optimizerUpdateKernel and optimizer_rule() of the kernels
+ */
+compute_event cpu_backend::runOptimizerUpdate(
+            matrix_float const &w,
+            matrix_float const &state,
+            matrix_float const &gradient,
+            int32_t rule,
+            float lr,
+            float momentum,
+            float l2,
+            float gradScale,
+            const std::vector<compute_event> *waitList) {
+    const size_t n = w.rows * w.cols;
+    assert(state.rows*state.cols == n && gradient.rows*gradient.cols == n);
+    assert(state.offset == w.offset && gradient.offset == w.offset);
+
+    float *wv = w.data.hostData.data() + w.offset;
+    float *v = state.data.hostData.data() + state.offset;
+    const float *g = gradient.data.hostData.data() + gradient.offset;
+    const bool nesterov = (rule == optimizer::NESTEROV);
+    pool.parallel_for(n, elementsPerTask, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const float grad = gradScale * g[i] + l2 * wv[i];
+            const float v_prev = v[i];
+            v[i] = momentum * v_prev - lr * grad;
+            wv[i] += nesterov ? (1.0f + momentum) * v[i] - momentum * v_prev :
+                                v[i];
+        }
+    });
+    return compute_event();
+}
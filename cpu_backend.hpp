@@ -0,0 +1,256 @@
+/*
+ * File:   cpu_backend.hpp
+ *
+ * Created on 17 de octubre de 2026
+ */
+
+#ifndef CPU_BACKEND_HPP
+#define CPU_BACKEND_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "compute_types.hpp"
+#include "compute_backend.hpp"
+#include "thread_pool.hpp"
+
+/*
+ * Native CPU implementation of the operations of nn, for the machines
+ * without an OpenCL runtime. Same results than the kernels of NN_Kernels.cl
+ * (also the dropout masks, generated with the same Philox) computed on the
+ * host vectors of the maps (hostData) by a work-stealing thread pool.
+ *
+ * GEMM: A and B are packed once per call into panels of gemmMR rows of A and
+ * gemmNR columns of B (contiguous in the order the micro-kernel reads them,
+ * transposed matrices included). Every task calculates a gemmMC x gemmNC
+ * block of C in blocks of gemmKC of the depth (packed panels in L1/L2) with
+ * a gemmMR x gemmNR register micro-kernel (AVX-512, AVX2+FMA or portable C++
+ * chosen at runtime by the CPU) and applies the epilogue
+ * (bias, sigmoid, derivative, dropout, sumToC) to the block.
+ *
+ * Every operation has finished when it returns: the events are empty and
+ * the wait lists are not used. Half storage is an OpenCL storage format, the
+ * maps used with this backend are always in floats.
+ */
+class cpu_backend : public compute_backend {
+ public:
+    // threads == 0 uses all the hardware threads
+    explicit cpu_backend(size_t threads = 0);
+
+    inline bool host_memory() const { return true; }
+
+    inline compute_event marker(
+            const std::vector<compute_event> *waitList = nullptr) {
+        return compute_event();
+    }
+    inline void flush() {}
+    inline void wait(const std::vector<compute_event> &events) {}
+
+    compute_event runCopy(
+            matrix_float const &src,
+            matrix_float const &dst,
+            const std::vector<compute_event> *waitList = nullptr);
+
+    compute_event runMatrixMultiplicationSigmoid(
+            matrix_float const &A,
+            matrix_float const &B,
+            matrix_float const &C,
+            matrix_float * bias = nullptr,
+            bool calcSigmoid = false,
+            bool sumToC = false,
+            float multPrevVal = 1.0f,
+            float multSum = 1.0f,
+            matrix_float const *sigmoidDerivative = nullptr,
+            dropout_mask const *dropout = nullptr,
+            const std::vector<compute_event> *waitList = nullptr);
+
+    compute_event runElementWiseSubstract(
+            matrix_float const &t,
+            matrix_float const &y,
+            matrix_float &e,
+            float scale = 1.0f,
+            const std::vector<compute_event> *waitList = nullptr);
+
+    compute_event runElementWiseSum(
+            matrix_float const &a,
+            matrix_float const &b,
+            matrix_float &c,
+            float mult_a = 1.0f,
+            float mult_b = 1.0f,
+            const std::vector<compute_event> *waitList = nullptr);
+
+    float runCrossEntropy(
+            matrix_float const &t,
+            matrix_float const &y,
+            matrix_float &error,
+            const std::vector<compute_event> *waitList = nullptr);
+
+    float runL2Regularization(
+            matrix_float const &weights,
+            matrix_float &error,
+            const std::vector<compute_event> *waitList = nullptr);
+
+    compute_event runElementWiseMultiplicationBySigmoidDerivativeKernel(
+            matrix_float const &deltas,
+            matrix_float const &activations,
+            const std::vector<compute_event> *waitList = nullptr);
+
+    compute_event runSoftMax(
+            matrix_float const &activations,
+            const std::vector<compute_event> *waitList = nullptr);
+
+    // the cross entropy of the whole matrix is written in the first element
+    // of ce_partial
+    compute_event runSoftMaxDeltaCrossEntropy(
+            matrix_float const &y,
+            matrix_float const &t,
+            matrix_float const &deltas,
+            matrix_float * ce_partial = nullptr,
+            float deltaScale = 1.0f,
+            const std::vector<compute_event> *waitList = nullptr);
+
+    float readCrossEntropyPartials(
+            matrix_float &ce_partial,
+            uint32_t rows,
+            uint32_t cols,
+            const std::vector<compute_event> *waitList = nullptr);
+
+    compute_event runRowSum(
+            matrix_float &A,
+            matrix_float &result,
+            float multExisting = 0.0f,
+            float multNew = 1.0f,
+            const std::vector<compute_event> *waitList = nullptr);
+
+    compute_event runMatrixScalarMultiplication(
+            matrix_float const &matrix,
+            float scalar,
+            const std::vector<compute_event> *waitList = nullptr);
+
+    // values of src rounded to half precision (kept in floats in dst)
+    compute_event runConvertToHalf(
+            matrix_float const &src,
+            matrix_float const &dst,
+            const std::vector<compute_event> *waitList = nullptr);
+
+    compute_event runQuantize(
+            matrix_float const &src,
+            matrix_char const &dst,
+            float invScale,
+            const std::vector<compute_event> *waitList = nullptr);
+
+    compute_event runMatrixMultiplicationInt8(
+            matrix_char const &A,
+            matrix_char const &B,
+            matrix_char const &C,
+            matrix_float const &bias,
+            matrix_float const &scaleB,
+            float scaleA,
+            float invScaleC,
+            bool calcSigmoid,
+            const std::vector<compute_event> *waitList = nullptr);
+
+    compute_event runMatrixMultiplicationInt8(
+            matrix_char const &A,
+            matrix_char const &B,
+            matrix_float const &C,
+            matrix_float const &bias,
+            matrix_float const &scaleB,
+            float scaleA,
+            bool calcSigmoid,
+            const std::vector<compute_event> *waitList = nullptr);
+
+    compute_event runDropoutGatherScatter(
+            matrix_float const &all,
+            matrix_float const &compact,
+            matrix_float const *allInc,
+            matrix_float const *compactInc,
+            matrix_uint const *rowIdx,
+            matrix_uint const &colIdx,
+            bool scatter,
+            const std::vector<compute_event> *waitList = nullptr);
+
+    compute_event runOptimizerUpdate(
+            matrix_float const &w,
+            matrix_float const &state,
+            matrix_float const &gradient,
+            int32_t rule,
+            float lr,
+            float momentum,
+            float l2,
+            float gradScale,
+            const std::vector<compute_event> *waitList = nullptr);
+
+    compute_event runGatherRows(
+            matrix_float const &src,
+            matrix_float const &dst,
+            matrix_uint const &idx,
+            const std::vector<compute_event> *waitList = nullptr);
+
+    compute_event runClearCounters(
+            matrix_uint const &counters,
+            const std::vector<compute_event> *waitList = nullptr);
+
+    compute_event runClassification(
+            matrix_float const &y,
+            matrix_float const &t,
+            matrix_uint const &correct,
+            matrix_uint const *confusion = nullptr,
+            const std::vector<compute_event> *waitList = nullptr);
+
+ private:
+    thread_pool pool;
+
+    // Blocking of the GEMM (floats). gemmMR x gemmNR is the register tile
+    // of the micro-kernel, gemmMC and gemmNC multiples of them.
+    static const size_t gemmMR = 6;
+    static const size_t gemmNR = 16;
+    static const size_t gemmKC = 256;   // depth of the packed blocks
+    static const size_t gemmMC = 96;    // rows of C per task
+    static const size_t gemmNC = 256;   // cols of C per task
+
+    // elements per task of the element-wise operations
+    static const size_t elementsPerTask = 16384;
+
+    // packed A (panels of gemmMR rows) and B (panels of gemmNR cols)
+    std::vector<float> packedA;
+    std::vector<float> packedB;
+
+    void pack_A(matrix_float const &A);
+    void pack_B(matrix_float const &B);
+    typedef void (*micro_kernel_fn)(size_t kc,
+                                    const float *a,
+                                    const float *b,
+                                    float *c,
+                                    size_t ldc);
+    static micro_kernel_fn select_micro_kernel();
+    static void micro_kernel_avx512(size_t kc,
+                                    const float *a,
+                                    const float *b,
+                                    float *c,
+                                    size_t ldc);
+    static void micro_kernel_avx2(size_t kc,
+                                  const float *a,
+                                  const float *b,
+                                  float *c,
+                                  size_t ldc);
+    static void micro_kernel_portable(size_t kc,
+                                      const float *a,
+                                      const float *b,
+                                      float *c,
+                                      size_t ldc);
+    // the best one of the CPU
+    const micro_kernel_fn micro_kernel;
+
+    void int8_gemm(matrix_char const &A,
+                   matrix_char const &B,
+                   int8_t *Cq,
+                   float *Cf,
+                   matrix_float const &bias,
+                   matrix_float const &scaleB,
+                   float scaleA,
+                   float invScaleC,
+                   bool calcSigmoid);
+};
+
+#endif  /* CPU_BACKEND_HPP */
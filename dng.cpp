@@ -13,29 +13,24 @@
 #include "dng.hpp"
 
 dng::dng(std::vector<cl_uint> &el,
-         std::vector<cl_float> &w,
          std::vector<cl_uint> &w_off,
-         std::vector<cl_float> &b,
          std::vector<cl_uint> &b_off,
-         std::vector<cl_float> &inc_w)
+         std::vector<cl_uint> &idx)
         : elementsPerLayerActualEpoch(el),
-          weightsActualEpoch(w),
           weightsOffsetsActualEpoch(w_off),
-          biasActualEpoch(b),
           biasOffsetsActualEpoch(b_off),
-          incrementWeightsActualEpoch(inc_w),
+          indexes(idx),
           elementsPerLayer(el),
-          weightsAll(w),
           weightsOffsets(w_off),
-          biasAll(b),
-          biasOffsets(b_off),
-          incrementWeightsAll(inc_w) {
-    // reserve enough memory to select all the neurons
-    // except output layer where we don't do dropout
-    indexes.resize(elementsPerLayer.size());
-    for (cl_uint i = 0; i < indexes.size(); i++) {
-        indexes.reserve(elementsPerLayer[i]);
+          biasOffsets(b_off) {
+    // enough space to select all the neurons of every layer
+    indexesOffsets.resize(elementsPerLayer.size());
+    cl_uint neurons = 0;
+    for (cl_uint i = 0; i < elementsPerLayer.size(); i++) {
+        indexesOffsets[i] = neurons;
+        neurons += elementsPerLayer[i];
     }
+    indexes.resize(neurons);
 }
 
 void dng::calculate_offsets_actual_epoch() {
@@ -45,7 +40,7 @@ void dng::calculate_offsets_actual_epoch() {
     biasOffsetsActualEpoch.resize(numberOfLayers - 1);
     weightsOffsetsActualEpoch[0] = 0;
     biasOffsetsActualEpoch[0] = 0;
-    for (cl_uint i = 1; i < numberOfLayers; i++) {
+    for (cl_uint i = 1; i < numberOfLayers - 1; i++) {
       weightsOffsetsActualEpoch[i] = weightsOffsetsActualEpoch[i-1] +
                            elementsPerLayerActualEpoch[i-1]*elementsPerLayerActualEpoch[i];
       biasOffsetsActualEpoch[i] = biasOffsetsActualEpoch[i-1] + elementsPerLayerActualEpoch[i];
@@ -55,109 +50,34 @@ void dng::calculate_offsets_actual_epoch() {
 void dng::dropout_neurons() {
     const cl_uint layers = elementsPerLayer.size();
     
-    // Input layer without dropout. Insert in last indexes all the neurons
-    elementsPerLayerActualEpoch[0] = elementsPerLayer[0];    
-    indexes[0].clear();
-    for (cl_uint e = 0; e < elementsPerLayer[0]; e++)
-        indexes[0].push_back(e);
-        
-    // output layer without dropout. Insert in last indexes all the neurons
-    elementsPerLayerActualEpoch[layers-1] = elementsPerLayer[layers-1];
-    indexes[layers-1].clear();
-    for (cl_uint e = 0; e < elementsPerLayer[layers-1]; e++)
-        indexes[layers-1].push_back(e);
+    // Input and output layers without dropout: all the neurons
+    for (cl_uint l : {cl_uint(0), layers - 1}) {
+        elementsPerLayerActualEpoch[l] = elementsPerLayer[l];
+        for (cl_uint e = 0; e < elementsPerLayer[l]; e++)
+            indexes[indexesOffsets[l] + e] = e;
+    }
 
     // hidden layers random choosing    
     for (cl_uint l = 1; l < layers - 1; l++) {
-        indexes[l].clear();
-        // hidden layers (random choosing)
+        cl_uint selected = 0;
         for (cl_uint e = 0; e < elementsPerLayer[l]; e++) {
             if (rndbool.next())
-                indexes[l].push_back(e);
+                indexes[indexesOffsets[l] + selected++] = e;
         }
-        // size must be the next multiple of 8 (OpenCL kernel limitations)
-        cl_uint sz = (indexes[l].size() % 16)?
-                     (cl_uint(indexes[l].size())/16 + 1)*16 :
-                     indexes[l].size();
-        
-        elementsPerLayerActualEpoch[l] = sz;
+        // the kernels accept any layer size: only the selected neurons
+        elementsPerLayerActualEpoch[l] = selected;
     }    
     
     calculate_offsets_actual_epoch();
-    const cl_uint weights_sz = weightsOffsetsActualEpoch[layers - 2] +
-                               elementsPerLayerActualEpoch[layers - 2] * 
-                               elementsPerLayerActualEpoch[layers - 1];
-    weightsActualEpoch.resize(weights_sz);
-    //std::fill(weightsActualEpoch.begin(), weightsActualEpoch.end(), 0);
-    
-    const cl_uint bias_sz = biasOffsetsActualEpoch[layers-2] + 
-                            elementsPerLayerActualEpoch[layers - 1];
-    biasActualEpoch.resize(bias_sz);
-    //std::fill(biasActualEpoch.begin(), biasActualEpoch.end(), 0);
-    
-    for(cl_uint l = 1; l < layers; l++) {
-        // copy selected weights
-        for (cl_uint i = 0; i < indexes[l-1].size(); i++) {            
-            for (cl_uint j = 0; j < indexes[l].size(); j++) {
-                const cl_uint idx_fr = get_idx(weightsOffsets[l-1],
-                                               indexes[l-1][i], indexes[l][j],
-                                               elementsPerLayer[l]);
-
-                const cl_uint idx_to = get_idx(weightsOffsetsActualEpoch[l-1],
-                                               i, j,
-                                               elementsPerLayerActualEpoch[l]);
-                        
-                weightsActualEpoch[idx_to] = weightsAll[idx_fr];
-                incrementWeightsActualEpoch[idx_to] = incrementWeightsAll[idx_fr];
-            }
-        }
-        // copy selected biases
-        for (cl_uint j = 0; j < indexes[l].size(); j++) {
-            biasActualEpoch[biasOffsetsActualEpoch[l-1] + j] =
-                biasAll[biasOffsets[l-1] + indexes[l][j]];
-        }
-    }    
-}
-
-void dng::update_from_last_dropout() {
-    const cl_uint layers = elementsPerLayer.size();
-    
-    for(cl_uint l = 1; l < layers; l++) {
-        // copy selected weights
-        for (cl_uint i = 0; i < indexes[l-1].size(); i++) {            
-            for (cl_uint j = 0; j < indexes[l].size(); j++) {
-                const cl_uint idx_fr = get_idx(weightsOffsets[l-1],
-                                               indexes[l-1][i], indexes[l][j],
-                                               elementsPerLayer[l]);
-
-                const cl_uint idx_to = get_idx(weightsOffsetsActualEpoch[l-1],
-                                               i, j,
-                                               elementsPerLayerActualEpoch[l]);
-                        
-                weightsAll[idx_fr] = weightsActualEpoch[idx_to];
-                incrementWeightsAll[idx_fr] = incrementWeightsActualEpoch[idx_to];
-            }
-        }
-        // copy selected biases
-        for (cl_uint j = 0; j < indexes[l].size(); j++) {
-            biasAll[biasOffsets[l-1] + indexes[l][j]] = 
-                    biasActualEpoch[biasOffsetsActualEpoch[l-1] + j];
-        }
-    }    
 }
 
-void dng::transfer_all_weights_to_nn() {
-    weightsActualEpoch.resize(weightsAll.size());
-    std::copy(weightsAll.begin(), weightsAll.end(), weightsActualEpoch.begin());
+void dng::restore_all_neurons() {
     std::copy(elementsPerLayer.begin(),
               elementsPerLayer.end(),
               elementsPerLayerActualEpoch.begin());
     std::copy(weightsOffsets.begin(),
               weightsOffsets.end(),
               weightsOffsetsActualEpoch.begin());
-
-    biasActualEpoch.resize(biasAll.size());
-    std::copy(biasAll.begin(), biasAll.end(), biasActualEpoch.begin());
     std::copy(biasOffsets.begin(),
               biasOffsets.end(),
               biasOffsetsActualEpoch.begin());
@@ -46,43 +46,53 @@ class rnd_bool {
 
 
 /** Dropout Network Generator:
+ *  Selects the neurons of the hidden layers used in every minibatch and
+ *  updates the sizes and offsets of the layers of the NN (actual epoch)
+ *  accordingly. The weights are not touched: the NN gathers the selected
+ *  ones on the device (and scatters them back after the update) with the
+ *  indexes of the selected neurons of every layer.
  */
 class dng {
  public:
     dng(std::vector<cl_uint> &el,
-         std::vector<cl_float> &w,
-         std::vector<cl_uint> &w_off,
-         std::vector<cl_float> &b,
-         std::vector<cl_uint> &b_off,
-         std::vector<cl_float> &inc_w);
+        std::vector<cl_uint> &w_off,
+        std::vector<cl_uint> &b_off,
+        std::vector<cl_uint> &idx);
     
-    void dropout_neurons();  
+    // new random selection of the neurons of the hidden layers
+    void dropout_neurons();
+    // sizes and offsets of the whole network
+    void restore_all_neurons();
     
-    void update_from_last_dropout();  
-    void transfer_all_weights_to_nn();
+    // offset of the indexes of layer l in the indexes vector
+    inline cl_uint indexes_offset(cl_uint l) const {
+        return indexesOffsets[l];
+    }
+    // sizes and offsets of the whole network
+    inline const std::vector<cl_uint> & all_elements_per_layer() const {
+        return elementsPerLayer;
+    }
+    inline const std::vector<cl_uint> & all_weights_offsets() const {
+        return weightsOffsets;
+    }
+    inline const std::vector<cl_uint> & all_bias_offsets() const {
+        return biasOffsets;
+    }
     
  private:
     std::vector<cl_uint> &elementsPerLayerActualEpoch;
-    std::vector<cl_float> &weightsActualEpoch;
     std::vector<cl_uint> &weightsOffsetsActualEpoch;
-    std::vector<cl_float> &biasActualEpoch;
     std::vector<cl_uint> &biasOffsetsActualEpoch;
-    std::vector<cl_float> &incrementWeightsActualEpoch;
-    
-    std::vector<std::vector<cl_uint> > indexes;
+    // selected neurons of every layer (layer l from indexesOffsets[l])
+    std::vector<cl_uint> &indexes;
 
     std::vector<cl_uint> elementsPerLayer;
-    std::vector<cl_float> weightsAll;
     std::vector<cl_uint> weightsOffsets;
-    std::vector<cl_float> biasAll;
     std::vector<cl_uint> biasOffsets;
-    std::vector<cl_float> incrementWeightsAll;
+    std::vector<cl_uint> indexesOffsets;
     
     rnd_bool rndbool;
     
-    inline cl_uint get_idx(cl_uint offset, cl_uint row, cl_uint col, cl_uint nr_cols) {
-        return offset + row * nr_cols + col;
-    };
     void calculate_offsets_actual_epoch();
 };
 
@@ -19,12 +19,47 @@ int main(int argc, char** argv) {
     const std::string test_file = "t10k-images.idx3-ubyte";
     const std::string test_labels_file = "t10k-labels.idx1-ubyte";
     
-    nn nn1;
+    // --data-parallel: a replica of the model in every device
+    // --cpu: native CPU backend (no OpenCL)
+    // --profile: device time per kernel and per phase every printEpochs
+    // --confusion: confusion matrix of the test set every printEpochs
+    // --eval-train: CE and accuracy of the whole training set (in chunks)
+    // instead of the last minibatch
+    bool dataParallel = false;
+    bool nativeCPU = false;
+    bool profiling = false;
+    bool confusion = false;
+    bool evalTrainingSet = false;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg(argv[i]);
+        if (arg == "--data-parallel") dataParallel = true;
+        if (arg == "--cpu") nativeCPU = true;
+        if (arg == "--profile") profiling = true;
+        if (arg == "--confusion") confusion = true;
+        if (arg == "--eval-train") evalTrainingSet = true;
+    }
+    nn nn1(dataParallel, nativeCPU, profiling);
+    nn1.setConfusionMatrix(confusion);
+    nn1.setEvalTrainingSet(evalTrainingSet);
     
     // cli CLI(nn1);
     
+    if (argc == 3 && std::string(argv[1]) == "--int8") {
+        // inference only: fp32 vs int8 of a network saved with save_NN
+        nn1.load_NN(std::string(argv[2]));
+        nn1.load_MNIST_train_and_test_DATA(
+            train_file,
+            train_labels_file,
+            test_file,
+            test_labels_file);
+        nn1.init_training();
+        nn1.quantize_int8();
+        nn1.compare_int8_inference();
+        return 0;
+    }
+    
     // load nn structure
-    std::vector<cl_uint> neuralnet = {784, 2048, 2048, 16};
+    std::vector<cl_uint> neuralnet = {784, 2048, 2048, 10};
     nn1.load_NN(neuralnet);
     
     // load training and test data
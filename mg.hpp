@@ -21,28 +21,16 @@ class minibatch_generator {
     unsigned destSize;
     
     std::vector<bool> selected;
-    std::vector<cl_uint> index;
     
-    std::vector<cl_uint> minibatch;
-    
-    std::vector<cl_float> &from1;
-    std::vector<cl_float> &to1;
-    cl_uint stride1;
-    
-    std::vector<cl_float> &from2;
-    std::vector<cl_float> &to2;
-    cl_uint stride2;
+    // rows of the training set selected for the minibatch (the rows are
+    // gathered on the device)
+    std::vector<cl_uint> &minibatch;
     
     void generate();
 public:
     minibatch_generator(cl_uint total_data, 
                         cl_uint minibatch_size,
-                        std::vector<cl_float> &from1,
-                        std::vector<cl_float> &to1,
-                        cl_uint stride1,
-                        std::vector<cl_float> &from2,
-                        std::vector<cl_float> &to2,
-                        cl_uint stride2
+                        std::vector<cl_uint> &minibatch
                        );
    
     void load_generated_minibatch();
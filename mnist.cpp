@@ -76,7 +76,7 @@ void read_mnist_labels_file(const std::string filename,
                             size_t &r, 
                             size_t &c) {
     
-    const uint8_t label_size = 16;
+    const uint8_t label_size = 10;
     
     std::ifstream ifs(filename, std::ios::binary);
     uint8_t buf_header[8];
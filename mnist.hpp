@@ -22,7 +22,7 @@ void read_mnist_labels_file(const std::string filename,
                             size_t &c);
 
 void print_mnist_image_txt(std::vector<float> &v, size_t offset, uint8_t rows = 28, uint8_t cols = 28);
-void print_mnist_label_txt(std::vector<float> &v, size_t offset, uint8_t out = 16);
+void print_mnist_label_txt(std::vector<float> &v, size_t offset, uint8_t out = 10);
 
 #endif	/* MNIST_HPP */
 
@@ -8,35 +8,109 @@
 #include <cassert>
 #include <vector>
 #include <algorithm>
+#include <chrono>
 #include <string>
 #include <iomanip>
 #include <future>
 #include <iostream>
+#include <random>
 
 #include "nn.hpp"
 #include "OpenCLKernels.hpp"
+#include "cpu_backend.hpp"
 // #include "common.hpp"
 #include "mnist.hpp"
 #include "dng.hpp"
 
-nn::nn() : activations(activations_host),
-          activations_test(activations_test_host),
-          bias(bias_host),
-          weights(weights_host),
-          increment_weights(increment_weights_host),
-          // increment_bias(increment_bias_host),
-          deltas(deltas_host),
-          t(t_host),
-          t_test(t_test_host),
-          buffer_error(buffer_error_host) {
+nn::nn(bool dataParallel, bool nativeCPU, bool profiling) :
+          dataParallel(dataParallel),
+          activations(activations_host, "activations"),
+          activations_test(activations_test_host, "activations_test"),
+          bias(bias_host, "bias"),
+          weights(weights_host, "weights"),
+          weights_half(weights_half_host, "weights_half"),
+          increment_weights(increment_weights_host, "increment_weights"),
+          increment_bias(increment_bias_host, "increment_bias"),
+          gradient_weights(gradient_weights_host, "gradient_weights"),
+          gradient_bias(gradient_bias_host, "gradient_bias"),
+          deltas(deltas_host, "deltas"),
+          t(t_host, "t"),
+          t_test(t_test_host, "t_test"),
+          buffer_error(buffer_error_host, "buffer_error"),
+          ce_partial(ce_partial_host, "ce_partial"),
+          eval_counts(eval_counts_host, "eval_counts"),
+          weights_int8(weights_int8_host, "weights_int8"),
+          weights_scale(weights_scale_host, "weights_scale"),
+          activations_int8(activations_int8_host, "activations_int8"),
+          weights_all(weights_all_host, "weights_all"),
+          increment_weights_all(increment_weights_all_host,
+                                "increment_weights_all"),
+          bias_all(bias_all_host, "bias_all"),
+          increment_bias_all(increment_bias_all_host, "increment_bias_all"),
+          dropout_indexes(dropout_indexes_host, "dropout_indexes"),
+          training_inputs(training_data, "training_inputs"),
+          training_outputs(training_data_output, "training_outputs"),
+          minibatch_idx(minibatch_idx_host, "minibatch_idx"),
+          eval_idx(eval_idx_host, "eval_idx") {
     
+    // transfer accounting of the training
+    for (transfer_count *c : {&activations.transfers,
+                              &activations_test.transfers,
+                              &bias.transfers,
+                              &weights.transfers,
+                              &weights_half.transfers,
+                              &increment_weights.transfers,
+                              &increment_bias.transfers,
+                              &gradient_weights.transfers,
+                              &gradient_bias.transfers,
+                              &deltas.transfers,
+                              &t.transfers,
+                              &t_test.transfers,
+                              &buffer_error.transfers,
+                              &ce_partial.transfers,
+                              &eval_counts.transfers,
+                              &weights_int8.transfers,
+                              &weights_scale.transfers,
+                              &activations_int8.transfers,
+                              &weights_all.transfers,
+                              &increment_weights_all.transfers,
+                              &bias_all.transfers,
+                              &increment_bias_all.transfers,
+                              &dropout_indexes.transfers,
+                              &training_inputs.transfers,
+                              &training_outputs.transfers,
+                              &minibatch_idx.transfers,
+                              &eval_idx.transfers}) {
+        stats.add(*c);
+    }
+    
+    if (nativeCPU) {
+        // no OpenCL at all: the operations work on the host vectors
+        context = nullptr;
+        queue = nullptr;
+        backend = new cpu_backend();
+        opt = new optimizer(*backend);
+        if (profiling) {
+            std::cout << "Profiling requires OpenCL, not enabled\n";
+        }
+        return;
+    }
+    if (profiling) prof = new profiler();
     opencl_init();
 }
 
 nn::~nn() {
-    delete openclKernels;
+    // the first replica uses the queue and kernels of nn
+    for (size_t k = 1; k < replicas.size(); k++) {
+        delete replicas[k]->kernels;
+        delete replicas[k]->queue;
+    }
+    for (replica *r : replicas) delete r;
+    delete opt;
+    delete backend;
     delete queue;
     delete context;
+    delete prof;
 }
 
 void nn::opencl_init() {
@@ -44,12 +118,59 @@ void nn::opencl_init() {
     cl::Platform::get(&platforms);  // get available OpenCL platforms
     // get OpenCL devices for first platform
     platforms[0].getDevices(CL_DEVICE_TYPE_ALL, &devices);
+    if (dataParallel) {
+        // device fission: one sub-device per NUMA node of the CPUs (the
+        // only way of using efficiently all the sockets)
+        std::vector<cl::Device> replicaDevices;
+        for (cl::Device &d : devices) {
+            std::vector<cl::Device> sub;
+            if (d.getInfo<CL_DEVICE_TYPE>() & CL_DEVICE_TYPE_CPU) {
+                const cl_device_partition_property numa[] = {
+                    CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN,
+                    CL_DEVICE_AFFINITY_DOMAIN_NUMA,
+                    0};
+                try {
+                    d.createSubDevices(numa, &sub);
+                } catch(const cl::Error &e) {
+                    sub.clear();    // not supported or one node only
+                }
+            }
+            if (sub.size() > 1) {
+                replicaDevices.insert(replicaDevices.end(),
+                                      sub.begin(), sub.end());
+            } else {
+                replicaDevices.push_back(d);
+            }
+        }
+        devices = replicaDevices;
+    }
     // create a context for these devices
     context = new cl::Context(devices);
+    zeroCopy = (devices[0].getInfo<CL_DEVICE_TYPE>() & CL_DEVICE_TYPE_CPU) ||
+               devices[0].getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY>();
+    
+    const cl_command_queue_properties properties =
+                            (prof != nullptr)?CL_QUEUE_PROFILING_ENABLE:0;
     // Create queue of first device
-    queue = new cl::CommandQueue(*context, devices[0]);
+    queue = new cl::CommandQueue(*context, devices[0], properties);
     // instantitate kernels
-    openclKernels = new OpenCLKernels(*context, devices, 0, *queue);
+    OpenCLKernels *kernels = new OpenCLKernels(*context, devices, 0, *queue);
+    kernels->setProfiler(prof);
+    backend = kernels;
+    opt = new optimizer(*backend);
+    
+    if (dataParallel && devices.size() > 1) {
+        replicas.push_back(new replica(queue, backend));
+        for (size_t k = 1; k < devices.size(); k++) {
+            cl::CommandQueue *q = new cl::CommandQueue(*context, devices[k],
+                                                       properties);
+            kernels = new OpenCLKernels(*context, devices, k, *q);
+            kernels->setProfiler(prof);
+            replicas.push_back(new replica(q, kernels));
+        }
+        std::cout << "Data parallel training in " << replicas.size()
+                  << " devices\n";
+    }
 }
 
 void nn::load_MNIST_train_and_test_DATA(
@@ -72,13 +193,13 @@ void nn::load_MNIST_train_and_test_DATA(
                            c);
     
     read_mnist_images_file(test_file,
-                           activations_test.hostData,
+                           test_data,
                            r,
                            c);
     numberOfTestData = static_cast<cl_uint>(r);
     
     read_mnist_labels_file(test_labels_file,
-                           t_test.hostData,
+                           test_data_output,
                            r,
                            c);
     
@@ -102,11 +223,14 @@ void nn::calculate_offsets() {
     for (cl_uint i = 1; i < numberOfLayers; i++) {
       activations_offsets[i] = activations_offsets[i-1] +
                                minibatchSize*elementsPerLayer[i-1];
-      activations_test_offsets[i] = activations_test_offsets[i-1] +
-                               numberOfTestData*elementsPerLayer[i-1];
-      weights_offsets[i] = weights_offsets[i-1] +
-                           elementsPerLayer[i-1]*elementsPerLayer[i];
-      bias_offsets[i] = bias_offsets[i-1] + elementsPerLayer[i];
+      // inference only: layer i in the half i % 2 of the workspace
+      // (ping-pong), the previous layer is the only one FF needs
+      activations_test_offsets[i] = (i % 2)*evalRows*max_layer_width();
+      if (i < numberOfLayers - 1) {
+        weights_offsets[i] = weights_offsets[i-1] +
+                             elementsPerLayer[i-1]*elementsPerLayer[i];
+        bias_offsets[i] = bias_offsets[i-1] + elementsPerLayer[i];
+      }
       deltas_offsets[i] = activations_offsets[i] - activations_offsets[1];
     }
 }
@@ -124,19 +248,33 @@ void nn::allocate_NN_memory_on_host() {
     bias.hostData.resize(numberOfNeurons - elementsPerLayer[0]);
     weights.hostData.resize(numberOfWeights);
     increment_weights.hostData.resize(numberOfWeights);
-    // increment_bias.hostData.resize(numberOfNeurons - elementsPerLayer[0]);
+    increment_bias.hostData.resize(numberOfNeurons - elementsPerLayer[0]);
+    gradient_weights.hostData.resize(numberOfWeights);
+    gradient_bias.hostData.resize(numberOfNeurons - elementsPerLayer[0]);
     // there are no deltas in input layer
     deltas.hostData.resize((numberOfNeurons
                             -elementsPerLayer[0])*minibatchSize);
     buffer_error.hostData.resize(BUFFER_ERROR_SIZE);
+    // upper bound of the number of work-groups of the fused output layer
+    ce_partial.hostData.resize(minibatchSize);
 }
 
 // Call it always after allocate_NN_memory_on_host()
 void nn::allocate_DATA_memory_on_host() {
     activations.hostData.resize(numberOfNeurons * minibatchSize);
     t.hostData.resize(elementsPerLayer[numberOfLayers-1] * minibatchSize);
-    activations_test.hostData.resize(numberOfNeurons * numberOfTestData);
-    t_test.hostData.resize(elementsPerLayer[numberOfLayers-1] * numberOfTestData);
+    // evaluation workspace: one chunk of the largest evaluated data set
+    evalRows = std::min(evalChunkSize,
+                        std::max(numberOfTestData,
+                                 trainDataLoaded?numberOfTrainingData:0));
+    // two layers of evalRows rows (ping-pong)
+    activations_test.hostData.resize(2 * evalRows * max_layer_width());
+    t_test.hostData.resize(elementsPerLayer[numberOfLayers-1] * evalRows);
+    minibatch_idx.hostData.resize(minibatchSize);
+    eval_idx.hostData.resize(evalRows);
+    // correct classifications + confusion matrix
+    const cl_uint N = elementsPerLayer[numberOfLayers-1];
+    eval_counts.hostData.resize(1 + N*N);
 }
 
 void nn::allocate_memory_on_device() {
@@ -145,28 +283,148 @@ void nn::allocate_memory_on_device() {
     // Create buffers with CL_MEM_USE_HOST_PTR to minimize copying and
     // model situation when matrices are hosted by some native library that
     // uses OpenCL to accelerate calculations
-    activations.createBuffer(*context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR);
-    activations_test.createBuffer(*context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR);
-    bias.createBuffer(*context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR);
-    weights.createBuffer(*context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR);
-    increment_weights.createBuffer(*context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR);
-    // increment_bias.createBuffer(*context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR);
-    deltas.createBuffer(*context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR);
-    t.createBuffer(*context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR);
-    t_test.createBuffer(*context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR);
-    buffer_error.createBuffer(*context,
-                                     CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR);
+    // half storage is a format of the device buffers
+    if (backend->host_memory()) halfStorage = false;
+    activations.halfStorage = halfStorage;
+    activations_test.halfStorage = halfStorage;
+    deltas.halfStorage = halfStorage;
+    // written by the kernels (activations, gathers, updates of the bias)
+    create_buffer(activations, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR);
+    create_buffer(activations_test, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR);
+    create_buffer(bias, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR);
+    create_buffer(weights, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR);
+    if (halfStorage) {
+        // refreshed from weights by FF(), never transferred
+        weights_half.hostData.resize(weights.hostData.size());
+        weights_half.halfStorage = true;
+        create_buffer(weights_half, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR);
+    }
+    create_buffer(increment_weights, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR);
+    create_buffer(increment_bias, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR);
+    // only used on the device
+    create_buffer(gradient_weights, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR);
+    create_buffer(gradient_bias, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR);
+    create_buffer(deltas, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR);
+    // written by the minibatch gather
+    create_buffer(t, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR);
+    // uploaded or gathered chunk by chunk
+    create_buffer(t_test, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR);
+    create_buffer(buffer_error, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR);
+    create_buffer(ce_partial, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR);
+    create_buffer(eval_counts, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR);
+    if (trainDataLoaded) {
+        // uploaded once, the minibatches are gathered from them
+        create_buffer(training_inputs, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR);
+        create_buffer(training_outputs, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR);
+        // copied (not used) host memory: the host generates the indexes of
+        // the next minibatch while the device can still be using them
+        create_buffer(minibatch_idx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR);
+        // rows of the chunk of the training set evaluated by evaluate()
+        create_buffer(eval_idx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR);
+    }
+    if (!replicas.empty()) allocate_replicas();
+#if DROPOUT_COMPACTION
+    // whole network, only used on the device
+    weights_all.hostData.resize(weights.hostData.size());
+    increment_weights_all.hostData.resize(increment_weights.hostData.size());
+    bias_all.hostData.resize(bias.hostData.size());
+    increment_bias_all.hostData.resize(increment_bias.hostData.size());
+    create_buffer(weights_all, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR);
+    create_buffer(increment_weights_all,
+                  CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR);
+    create_buffer(bias_all, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR);
+    create_buffer(increment_bias_all, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR);
+    // copied (not used) host memory: the host fills the indexes of the next
+    // minibatch while the device can still be using the previous ones
+    dropout_indexes.hostData.resize(numberOfNeurons);
+    create_buffer(dropout_indexes, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR);
+#endif
     
 }
 
+void nn::allocate_replicas() {
+    const cl_uint n = replicas.size();
+    const cl_uint rows = minibatchSize / n;
+    assert(rows > 0);
+    
+    for (cl_uint k = 0; k < n; k++) {
+        replica &r = *replicas[k];
+        // the first device also gets the remaining rows
+        r.rows = (k == 0) ? minibatchSize - (n - 1)*rows : rows;
+        r.firstRow = (k == 0) ? 0 : minibatchSize - (n - k)*rows;
+        
+        r.activations_offsets.resize(numberOfLayers);
+        r.deltas_offsets.resize(numberOfLayers);
+        r.activations_offsets[0] = 0;
+        r.deltas_offsets[0] = 0;   // never used in the algorithm
+        for (cl_uint i = 1; i < numberOfLayers; i++) {
+            r.activations_offsets[i] = r.activations_offsets[i-1] +
+                                       r.rows*elementsPerLayer[i-1];
+            r.deltas_offsets[i] = r.activations_offsets[i] -
+                                  r.activations_offsets[1];
+        }
+        
+        // the first device uses the buffers of nn
+        if (k == 0) continue;
+        
+        r.activations.hostData.resize(numberOfNeurons * r.rows);
+        r.deltas.hostData.resize((numberOfNeurons - elementsPerLayer[0])
+                                 * r.rows);
+        r.t.hostData.resize(elementsPerLayer[numberOfLayers-1] * r.rows);
+        r.ce_partial.hostData.resize(r.rows);
+        r.gradient_weights.hostData.resize(gradient_weights.hostData.size());
+        r.gradient_bias.hostData.resize(gradient_bias.hostData.size());
+        r.activations.halfStorage = halfStorage;
+        r.deltas.halfStorage = halfStorage;
+        
+        const cl_mem_flags flags = CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR;
+        create_buffer(r.activations, flags);
+        create_buffer(r.deltas, flags);
+        create_buffer(r.t, flags);
+        create_buffer(r.ce_partial, flags);
+        create_buffer(r.gradient_weights, flags);
+        create_buffer(r.gradient_bias, flags);
+        if (halfStorage) {
+            r.weights_half.hostData.resize(weights.hostData.size());
+            r.weights_half.halfStorage = true;
+            create_buffer(r.weights_half, flags);
+        }
+    }
+}
+
+void nn::use_replica(replica &r) {
+    std::swap(queue, r.queue);
+    std::swap(backend, r.kernels);
+    std::swap(minibatchSize, r.rows);
+    std::swap(minibatchFirstRow, r.firstRow);
+    std::swap(activations_offsets, r.activations_offsets);
+    std::swap(deltas_offsets, r.deltas_offsets);
+    
+    if (!r.ownBuffers()) return;
+    std::swap(activations.deviceData, r.activations.deviceData);
+    std::swap(deltas.deviceData, r.deltas.deviceData);
+    std::swap(t.deviceData, r.t.deviceData);
+    std::swap(ce_partial.deviceData, r.ce_partial.deviceData);
+    std::swap(weights_half.deviceData, r.weights_half.deviceData);
+    std::swap(weightsHalfVersion, r.weightsHalfVersion);
+    std::swap(gradient_weights.deviceData, r.gradient_weights.deviceData);
+    std::swap(gradient_bias.deviceData, r.gradient_bias.deviceData);
+}
+
 void nn::load_data_to_device() {
-    activations.writeToDevice(*queue);
-    activations_test.writeToDevice(*queue);
-    bias.writeToDevice(*queue);
-    weights.writeToDevice(*queue);
-    increment_weights.writeToDevice(*queue);
-    t.writeToDevice(*queue);
-    t_test.writeToDevice(*queue);
+    write(activations);
+    // the evaluation workspace (activations_test, t_test) is loaded by
+    // evaluate()
+    write(bias);
+    write(weights);
+    weights_modified();
+    write(increment_weights);
+    write(increment_bias);
+    write(t);
+    if (trainDataLoaded) {
+        write(training_inputs);
+        write(training_outputs);
+    }
 }
 
 /**
@@ -244,15 +502,32 @@ void nn::populate_fixed_weights(const cl_float val) {
     *it = val;
 }
 
-void nn::FF(host_device_memory_map<cl_float> &act,
-            std::vector<cl_uint> &off,
-            cl_uint rows) {
+compute_event nn::FF(host_device_memory_map<cl_float> &act,
+                 std::vector<cl_uint> &off,
+                 cl_uint rows,
+                 const std::vector<compute_event> *waitList,
+                 host_device_memory_map<cl_float> *targets,
+                 bool dropout) {
     const cl_uint N = numberOfLayers - 1;
     
-    matrix_cl_float A(act);
-    matrix_cl_float B(weights);
-    matrix_cl_float C(act);
-    matrix_cl_float bias_val(bias);  // offset set to 0
+    // every layer depends on the result of the previous one
+    std::vector<compute_event> deps;
+    if (waitList != nullptr) deps = *waitList;
+    
+    if (halfStorage && weightsHalfVersion != weightsVersion) {
+        // half copy of the current master weights
+        weightsHalfVersion = weightsVersion;
+        matrix_float W(weights);
+        matrix_float Wh(weights_half);
+        W.set(1, weights_in_use(), 0);
+        Wh.set(1, weights_in_use(), 0);
+        deps.assign(1, backend->runConvertToHalf(W, Wh, &deps));
+    }
+    
+    matrix_float A(act);
+    matrix_float B(halfStorage?weights_half:weights);
+    matrix_float C(act);
+    matrix_float bias_val(bias);  // offset set to 0
     bool calcSigmoid = true;
     for ( cl_uint i = 0; i < N; i++ ) {
         A.set(rows, elementsPerLayer[i], off[i]);
@@ -264,74 +539,108 @@ void nn::FF(host_device_memory_map<cl_float> &act,
             calcSigmoid = false;
         }
         
-        openclKernels->
-                  runMatrixMultiplicationSigmoid(A, B, C, &bias_val, calcSigmoid);
+        // inverted dropout of the hidden layers (mask generated in the GEMM)
+        const dropout_mask mask(dropoutSeed + i + 1, dropoutKeep, false);
+        const bool drop = dropout && i < N-1;
+        
+        deps.assign(1, backend->
+                  runMatrixMultiplicationSigmoid(A, B, C, &bias_val, calcSigmoid,
+                                                 false, 1.0f, 1.0f, nullptr,
+                                                 drop?&mask:nullptr, &deps));
         if (i == N-1) {
-            openclKernels->runSoftMax(C);
+            if (fuseOutputLayer && targets != nullptr) {
+                // softmax + deltas + cross entropy partials in one pass
+                matrix_float tm(*targets);
+                matrix_float del(deltas);
+                matrix_float partials(ce_partial);
+                tm.set(rows, elementsPerLayer[N], 0);
+                del.set(rows, elementsPerLayer[N], deltas_offsets[N]);
+                deps.assign(1, backend->runSoftMaxDeltaCrossEntropy(
+                                    C, tm, del, &partials, delta_scale(),
+                                    &deps));
+            } else {
+                deps.assign(1, backend->runSoftMax(C, &deps));
+            }
         }
     }
+    return deps[0];
 }
 
 cl_float nn::percentage_classification_results(
             host_device_memory_map<cl_float> &act,
             std::vector<cl_uint> &act_off,
             host_device_memory_map<cl_float> &out,
-            cl_uint rows) {
+            cl_uint rows,
+            bool confusion) {
 
-    // out.readFromDevice(*queue); // (doesn't change)
+    const cl_uint N = elementsPerLayer[numberOfLayers-1];
+    
+    // argmax of every row on the device: the activations and targets are
+    // never read
+    clear_classifications(confusion);
+    classify(act, act_off, out, rows, confusion);
+    
+    // blocking read of the counters only: waits for all the pending
+    // kernels of the queue
+    read_range(eval_counts, 0, confusion?(1 + N*N):1);
+    
+    return cl_float(eval_counts.hostData[0])/cl_float(rows)*100;
+}
 
-    act.readFromDevice(*queue);
-    // SE PUEDE ACOTAR PARA NO TANTAS TRANSFERENCIAS SOLO BAJAR OUTPUTS
+compute_event nn::classify(
+            host_device_memory_map<cl_float> &act,
+            std::vector<cl_uint> &act_off,
+            host_device_memory_map<cl_float> &out,
+            cl_uint rows,
+            bool confusion) {
 
     const cl_uint N = elementsPerLayer[numberOfLayers-1];
 
-    const cl_uint off = act_off[numberOfLayers-1];
+    matrix_float y(act);
+    matrix_float tm(out);
+    matrix_uint correct(eval_counts);
+    matrix_uint matrix(eval_counts);
+    y.set(rows, N, act_off[numberOfLayers-1]);
+    tm.set(rows, N, 0);
+    correct.set(1, 1, 0);
+    matrix.set(N, N, 1);
+    
+    return backend->runClassification(y, tm, correct,
+                                      confusion?&matrix:nullptr);
+}
 
-    std::vector<cl_float> &v = out.hostData;
-    std::vector<cl_float> &w = act.hostData;
+compute_event nn::clear_classifications(bool confusion) {
+    const cl_uint N = elementsPerLayer[numberOfLayers-1];
+    matrix_uint counters(eval_counts);
+    counters.set(1, confusion?(1 + N*N):1, 0);
+    return backend->runClearCounters(counters);
+}
 
-    cl_uint good = 0;
-    cl_uint bad = 0;
-    for (cl_uint i = 0; i < rows; i++) {
-        cl_float max1 = 0.0f;
-        cl_uint pos1 = 0;
-        for (cl_uint j = 0; j < N; j++) {
-            const cl_float val = v[i*N+j];
-            if (val > max1) {
-                pos1 = j;
-                max1 = val;
-            }
-        }
-        cl_float max2 = 0.0f;
-        cl_uint pos2 = 0;
+void nn::print_confusion_matrix() {
+    const cl_uint N = elementsPerLayer[numberOfLayers-1];
+    const cl_uint *m = &eval_counts.hostData[1];
+    
+    std::cout << "Confusion matrix (rows: target, columns: predicted)\n";
+    for (cl_uint i = 0; i < N; i++) {
         for (cl_uint j = 0; j < N; j++) {
-            const cl_float val = w[off+i*N+j];
-            if (val > max2) {
-                pos2 = j;
-                max2 = val;
-            }
-        }
-        if (pos1 == pos2) {
-            good++;
-        } else {
-            bad++;
+            std::cout << ((j == 0)?"":"\t") << m[i*N + j];
         }
+        std::cout << "\n";
     }
-    
-    return cl_float(good)/cl_float(good+bad)*100;
 }
 
-void nn::BP() {
+compute_event nn::BP(const std::vector<compute_event> *waitList) {
     
-    matrix_cl_float tm(t);
-    matrix_cl_float act(activations);
-    matrix_cl_float wei(weights);
-    // matrix_cl_float bias_inc(increment_bias);
-    matrix_cl_float del(deltas);
-    matrix_cl_float del_r(deltas);
+    matrix_float tm(t);
+    matrix_float act(activations);
+    // the half copy refreshed by the previous FF_train()
+    matrix_float wei(halfStorage?weights_half:weights);
+    // matrix_float bias_inc(increment_bias);
+    matrix_float del(deltas);
+    matrix_float del_r(deltas);
 
     // first of all calculate the deltas of the last layer
-    // delta {output_layer} = (y - t)
+    // delta {output_layer} = (y - t) (multiplied by the loss scale)
     const cl_uint last = numberOfLayers - 1;
     tm.set(minibatchSize, elementsPerLayer[last], 0);
     act.set(tm.rows, tm.cols, activations_offsets[last]);
@@ -339,7 +648,15 @@ void nn::BP() {
               elementsPerLayer[last],
               deltas_offsets[last]);
 
-    openclKernels->runElementWiseSubstract(act, tm, del_r);
+    std::vector<compute_event> deps;
+    if (fuseOutputLayer) {
+        // already calculated by FF_train()
+        if (waitList != nullptr) deps = *waitList;
+    } else {
+        deps.assign(1,
+            backend->runElementWiseSubstract(act, tm, del_r,
+                                                   delta_scale(), waitList));
+    }
     
     
     // next calculate deltas for next layers
@@ -358,95 +675,138 @@ void nn::BP() {
                 elementsPerLayer[i],
                 weights_offsets[i],
                 true);
-        openclKernels->
-            runMatrixMultiplicationSigmoid(del, wei, del_r);
-        
         act.set(minibatchSize,
                 elementsPerLayer[i],
                 activations_offsets[i]);
-        openclKernels->
-            runElementWiseMultiplicationBySigmoidDerivativeKernel(del_r, act);
+        // del_r = (del * wei^T) .* act .* (1 - act) in one kernel
+        // (with the same dropout mask than FF_train)
+        const dropout_mask mask(dropoutSeed + i, dropoutKeep, true);
+        deps.assign(1, backend->
+            runMatrixMultiplicationSigmoid(del, wei, del_r, nullptr, false,
+                                           false, 1.0f, 1.0f, &act,
+                                           DROPOUT_BY_MASK?&mask:nullptr,
+                                           &deps));
+    }
+    if (deps.empty()) {
+        // nothing enqueued (fused output layer and no hidden layers)
+        deps.assign(1, backend->marker());
     }
+    return deps[0];
 }
 
-void nn::WA() {
-    matrix_cl_float act(activations);
-    matrix_cl_float wei(weights);
-    matrix_cl_float bias_val(bias);
-    matrix_cl_float wei_inc(increment_weights);
-    // matrix_cl_float bias_inc(increment_bias);
-    matrix_cl_float del(deltas);
+compute_event nn::gradients(const std::vector<compute_event> *waitList) {
+    matrix_float act(activations);
+    matrix_float wei_grad(gradient_weights);
+    matrix_float bias_grad(gradient_bias);
+    matrix_float del(deltas);
     
-    // Weight actualization
+    // the gradients of the layers are independent between them,
+    // all of them only wait for the backpropagation
+    std::vector<compute_event> grad_events;
+    
+    // Gradients (sums over the minibatch)
     for (cl_int i = numberOfLayers - 2; i >= 0; i--) {
         // act transposed
         act.set(elementsPerLayer[i], minibatchSize,
                 activations_offsets[i], true);
         del.set(minibatchSize, elementsPerLayer[i+1],
                 deltas_offsets[i+1]);
-        wei.set(elementsPerLayer[i], elementsPerLayer[i+1],
-                weights_offsets[i]);
-        wei_inc.set(elementsPerLayer[i], elementsPerLayer[i+1],
-                    weights_offsets[i]);
-        bias_val.set(1, elementsPerLayer[i+1], bias_offsets[i]);
-
-        const bool sum = true;
-        const cl_float learningRateOverMinibatchSize =
-                            learningRate/cl_float(minibatchSize);
-        openclKernels->runMatrixMultiplicationSigmoid(
+        wei_grad.set(elementsPerLayer[i], elementsPerLayer[i+1],
+                     weights_offsets[i]);
+        bias_grad.set(1, elementsPerLayer[i+1], bias_offsets[i]);
+
+        grad_events.push_back(backend->runMatrixMultiplicationSigmoid(
                             act,
                             del,
-                            wei_inc,
+                            wei_grad,
                             nullptr,
                             false,
-                            sum,
-                            momentum,
-                            -learningRateOverMinibatchSize);
+                            false,
+                            1.0f,
+                            1.0f,
+                            nullptr,
+                            nullptr,
+                            waitList));
         
-        openclKernels->runRowSum(del, bias_val, 1.0f,
-                                 -learningRateOverMinibatchSize);
-                
+        grad_events.push_back(backend->runRowSum(del, bias_grad, 0.0f,
+                                                       1.0f, waitList));
     }
+    
+    // completed when all the gradients have finished
+    return backend->marker(&grad_events);
+}
 
-    const size_t wei_sz = wei.data.hostData.size();
+compute_event nn::WA(const std::vector<compute_event> *waitList) {
+    matrix_float wei(weights);
+    matrix_float bias_val(bias);
+    matrix_float wei_inc(increment_weights);
+    matrix_float bias_inc(increment_bias);
+    matrix_float wei_grad(gradient_weights);
+    matrix_float bias_grad(gradient_bias);
+
+    // Weight actualization: one pass over the weights and one over the bias
+    // (the deltas are scaled by the loss scale)
+    const cl_float gradScale = 1.0f/(cl_float(minibatchSize)*delta_scale());
+    const cl_float l2 = enableL2Regularization ?
+                        lambda/numberOfTrainingData : 0.0f;
+    const size_t wei_sz = weights_in_use();
     wei.set(1, wei_sz, 0);
     wei_inc.set(1, wei_sz, 0);
-    if (enableL2Regularization)  // if L2-regularization
-        openclKernels->runElementWiseSum(wei_inc, wei, wei_inc,
-                     1.0f, - learningRate*lambda/numberOfTrainingData);
-    openclKernels->runElementWiseSum(wei, wei_inc, wei);
+    wei_grad.set(1, wei_sz, 0);
+    const size_t bias_sz = bias_in_use();
+    bias_val.set(1, bias_sz, 0);
+    bias_inc.set(1, bias_sz, 0);
+    bias_grad.set(1, bias_sz, 0);
+    std::vector<compute_event> updates;
+    updates.push_back(opt->update(wei, wei_inc, wei_grad, learningRate,
+                                  momentum, l2, gradScale, waitList));
+    updates.push_back(opt->update(bias_val, bias_inc, bias_grad, learningRate,
+                                  momentum, 0.0f, gradScale, waitList));
+    weights_modified();
+    // completed after the weights and the bias updates
+    return backend->marker(&updates);
 }
 
-
-void nn::NAG_preupdate() {
-    matrix_cl_float wei(weights);
-    matrix_cl_float wei_inc(increment_weights);
-    const size_t wei_size = weights.hostData.size();
+compute_event nn::NAG_lookahead(cl_float factor,
+                            const std::vector<compute_event> *waitList) {
+    matrix_float wei(weights);
+    matrix_float wei_inc(increment_weights);
+    matrix_float bias_val(bias);
+    matrix_float bias_inc(increment_bias);
+    const size_t wei_size = weights_in_use();
     wei.set(1, wei_size, 0);
     wei_inc.set(1, wei_size, 0);
-     
-    openclKernels->runElementWiseSum(
-                            wei,
-                            wei_inc,
-                            wei,
-                            1.0f,
-                            momentum);
+    const size_t bias_size = bias_in_use();
+    bias_val.set(1, bias_size, 0);
+    bias_inc.set(1, bias_size, 0);
+    
+    std::vector<compute_event> shifts;
+    shifts.push_back(opt->shift(wei, wei_inc, factor, waitList));
+    shifts.push_back(opt->shift(bias_val, bias_inc, factor, waitList));
+    weights_modified();
+    // completed after the weights and the bias shifts
+    return backend->marker(&shifts);
 }
 
-void nn::NAG_postupdate() {
-    matrix_cl_float wei(weights);
-    matrix_cl_float wei_inc(increment_weights);
-    const size_t wei_size = weights.hostData.size();
-    wei.set(1, wei_size, 0);
-    wei_inc.set(1, wei_size, 0);
-     
-    openclKernels->runElementWiseSum(
-                            wei,
-                            wei_inc,
-                            wei,
-                            1.0f,
-                            -momentum);
+#if DROPOUT_COMPACTION
+compute_event nn::NAG_lookahead_all(cl_float factor,
+                                const std::vector<compute_event> *waitList) {
+    matrix_float wei(weights_all);
+    matrix_float wei_inc(increment_weights_all);
+    matrix_float bias_val(bias_all);
+    matrix_float bias_inc(increment_bias_all);
+    wei.set(1, weights_all.hostData.size(), 0);
+    wei_inc.set(1, increment_weights_all.hostData.size(), 0);
+    bias_val.set(1, bias_all.hostData.size(), 0);
+    bias_inc.set(1, increment_bias_all.hostData.size(), 0);
+    
+    std::vector<compute_event> shifts;
+    shifts.push_back(opt->shift(wei, wei_inc, factor, waitList));
+    shifts.push_back(opt->shift(bias_val, bias_inc, factor, waitList));
+    // completed after the weights and the bias shifts
+    return backend->marker(&shifts);
 }
+#endif
 
 void nn::print_results_data_header_with_L2_regularization() {
     std::cout << "\tTRAIN\t\t\t\t\t\t\t\tTEST" << std::endl;
@@ -457,11 +817,13 @@ void nn::print_results_data_with_L2_regularization(
                             cl_float ce1,
                             cl_float ce2,
                             cl_float ce,
+                            cl_float training_percentage,
                             cl_float ce1_test,
                             cl_float ce2_test,
-                            cl_float ce_test) {
-    cl_uint ctrain = percentage_classification_results_train();
-    cl_uint ctest = percentage_classification_results_test();
+                            cl_float ce_test,
+                            cl_float test_percentage) {
+    cl_uint ctrain = training_percentage;
+    cl_uint ctest = test_percentage;
     
     std::cout << std::fixed << std::setprecision(6)
               << epoch << "\t"
@@ -482,10 +844,9 @@ void nn::print_results_data_header() {
 
 void nn::print_results_data(
                             cl_float ce,
-                            cl_float ce_test) {
-    const cl_float training_percentage = percentage_classification_results_train();
-    const cl_float test_percentage = percentage_classification_results_test();
-    
+                            cl_float training_percentage,
+                            cl_float ce_test,
+                            cl_float test_percentage) {
     // if(test_percentage > 70) learningRate = 0.01;
     
     std::cout << std::fixed << std::setprecision(6)
@@ -497,10 +858,24 @@ void nn::print_results_data(
 }
 
 void nn::print_data() {
-    const cl_float ce_noreg = CE_train();
+    cl_float ce_noreg;
+    cl_float training_percentage;
+    if (evalTrainingSet) {
+        evaluate(true, ce_noreg, training_percentage);
+    } else {
+        // last minibatch
+        if (!replicas.empty()) {
+            // the last FF_train() was done in slices in every device
+            std::vector<compute_event> ff(1, gather_minibatch());
+            FF_train(&ff);
+        }
+        ce_noreg = CE_train();
+        training_percentage = percentage_classification_results_train();
+    }
 
-    FF_test();
-    const cl_float ce_test_noreg = CE_test();
+    cl_float ce_test_noreg;
+    cl_float test_percentage;
+    evaluate(false, ce_test_noreg, test_percentage);
 
     ce = ce_noreg;
     ce_test = ce_test_noreg;
@@ -512,10 +887,15 @@ void nn::print_data() {
         const cl_float ce_test_reg = reg/cl_float(numberOfTestData);
         ce += ce_reg;
         ce_test += ce_test_reg;
-        print_results_data_with_L2_regularization(ce_noreg, ce_reg, ce, ce_test_noreg, ce_test_reg, ce_test);
+        print_results_data_with_L2_regularization(ce_noreg, ce_reg, ce,
+                                                  training_percentage,
+                                                  ce_test_noreg, ce_test_reg,
+                                                  ce_test, test_percentage);
     } else {
-        print_results_data(ce, ce_test);
+        print_results_data(ce, training_percentage, ce_test, test_percentage);
     }       
+    // filled by the evaluation of the test set
+    if (confusionMatrix) print_confusion_matrix();
 }
 
 void nn::train() {
@@ -525,36 +905,58 @@ void nn::train() {
     
     trainRunning = true;
     
+    assert(trainDataLoaded);
+    
     minibatch_generator mg(numberOfTrainingData,
                            minibatchSize,
-                           training_data,
-                           activations.hostData,
-                           elementsPerLayer[0],
-                           training_data_output,
-                           t.hostData,
-                           elementsPerLayer[numberOfLayers-1]
-                           );
-    const size_t minibatch_size_bytes = minibatchSize*elementsPerLayer[0]*
-                                        sizeof(cl_float);
-    const size_t minibatch_size_output_bytes =
-                     minibatchSize*
-                     elementsPerLayer[numberOfLayers-1]*sizeof(cl_float);
+                           minibatch_idx.hostData);
         
     auto fut = std::async(&minibatch_generator::load_generated_minibatch, &mg);
     
-#if DROPOUT
+    // host work of the step accounted by the profiler
+    typedef std::chrono::steady_clock clock;
+    auto host = [this](const char *name, clock::time_point start) {
+        if (prof == nullptr) return;
+        const std::chrono::duration<double> elapsed = clock::now() - start;
+        prof->recordHost(name, elapsed.count());
+    };
+    
+    opt->setRule(enableNAG ? optimizer::NESTEROV : optimizer::MOMENTUM);
+    // from now on in the lookahead point
+    phase("NAG");
+    if (opt->lookahead()) NAG_lookahead(momentum);
+    
+#if DROPOUT_BY_MASK
+    // new masks every step: random seed of the step
+    std::mt19937 seeds(std::random_device{}());
+#endif
+    
+#if DROPOUT_COMPACTION
+      phase("dropout");
       dng dropout(elementsPerLayer,
-                  weights_host,
                   weights_offsets,
-                  bias_host,
                   bias_offsets,
-                  increment_weights_host);
+                  dropout_indexes.hostData);
+      // the whole network stays on the device
+      auto copy = [this](host_device_memory_map<cl_float> &src,
+                         host_device_memory_map<cl_float> &dst) {
+          matrix_float s(src);
+          matrix_float d(dst);
+          s.set(1, src.hostData.size());
+          d.set(1, dst.hostData.size());
+          backend->runCopy(s, d);
+      };
+      copy(weights, weights_all);
+      copy(increment_weights, increment_weights_all);
+      copy(bias, bias_all);
+      copy(increment_bias, increment_bias_all);
 #endif
     
     if (enableL2Regularization)
         print_results_data_header_with_L2_regularization();
     else
         print_results_data_header();
+    stats.start();
     for (epoch = 0; epoch < maxEpochs; epoch++) {
         
         if (stopTraining) {
@@ -562,70 +964,340 @@ void nn::train() {
             break;
         }
 
+        // lookahead point of the previous momentum
+        const cl_float previousMomentum = momentum;
         if (enableMomentumRule) {
             update_momentum_rule_Hinton2013(epoch);
         }
         
-#if DROPOUT
-          // dropout and load to OpenCL device
+#if DROPOUT_BY_MASK
+        dropoutSeed = seeds();
+#endif
+        
+        clock::time_point hostStart;
+#if DROPOUT_COMPACTION
+          // new selection of neurons (only indexes, sizes and offsets)
+          phase("dropout");
+          hostStart = clock::now();
           dropout.dropout_neurons();
-          weights.writeToDevice(*queue);
-          increment_weights.writeToDevice(*queue);
-          bias.writeToDevice(*queue);
+          host("dng", hostStart);
 #endif
         // wait for minibatch thread to finish
+        phase("upload");
+        hostStart = clock::now();
         fut.get();
-        // load to device the thread calculated minibatch
-        activations.writeToDevice(*queue, minibatch_size_bytes);
-        t.writeToDevice(*queue, minibatch_size_output_bytes);
-        // launch next minibatch calculation
-        fut = std::async(&minibatch_generator::load_generated_minibatch, &mg);
+        host("minibatch wait", hostStart);
+        // load to device the thread calculated minibatch indexes
+        // (non-blocking). The rows are gathered from the training set.
+        std::vector<compute_event> upload(1,
+                                      write_async(minibatch_idx));
+#if DROPOUT_COMPACTION
+        upload.push_back(write_async(dropout_indexes));
+#endif
         
-        if (enableNAG) NAG_preupdate();
-        FF_train();        
-        BP();
-        if (enableNAG) NAG_postupdate();
-        WA();
-
-#if DROPOUT
-        // update weights and bias into dropout class controller    
-        weights.readFromDevice(*queue);
-        increment_weights.readFromDevice(*queue);
-        bias.readFromDevice(*queue);
-        dropout.update_from_last_dropout();
+        // enqueue the whole training step. The host does not wait here.
+        std::vector<compute_event> step(upload);
+        // lookahead point of the new momentum (with dropout the whole
+        // network, before the selected neurons are gathered from it)
+        phase("NAG");
+        if (opt->lookahead() && momentum != previousMomentum) {
+#if DROPOUT_COMPACTION
+            step.assign(1, NAG_lookahead_all(momentum - previousMomentum,
+                                             &step));
+#else
+            step.assign(1, NAG_lookahead(momentum - previousMomentum, &step));
+#endif
+        }
+#if DROPOUT_COMPACTION
+        // selected neurons gathered from the whole network
+        phase("dropout");
+        step.assign(1, dropout_gather_scatter(dropout, false, &step));
+#endif
+        if (replicas.empty()) {
+            step.assign(1, minibatch_gradients(&step));
+        } else {
+            // every device a slice of the minibatch
+            step.assign(1, data_parallel_gradients(&step));
+        }
+        phase("WA");
+        step.assign(1, WA(&step));
+#if DROPOUT_COMPACTION
+        // updated neurons back to the whole network
+        phase("dropout");
+        dropout_gather_scatter(dropout, true, &step);
 #endif
+        backend->flush();
         
+        // the minibatch indexes can be reused when the upload has
+        // finished. Meanwhile the device is running the training step.
+        phase("upload");
+        hostStart = clock::now();
+        backend->wait(upload);
+        host("upload wait", hostStart);
+        // launch next minibatch calculation
+        fut = std::async(&minibatch_generator::load_generated_minibatch, &mg);
+        if (prof != nullptr) prof->step();
+        stats.step(minibatchSize);
+
+
         if (epoch % printEpochs == 0) {
-#if DROPOUT
+            phase("eval");
+#if DROPOUT_COMPACTION
             // if dropout we have to load all the weights and multiply them
             // by 0.5 in order to make the correct inference
-            dropout.transfer_all_weights_to_nn();
-            weights.writeToDevice(*queue);
-            bias.writeToDevice(*queue);
-            matrix_cl_float W(weights);
+            dropout.restore_all_neurons();
+            copy(weights_all, weights);
+            copy(bias_all, bias);
+            if (opt->lookahead()) {
+                copy(increment_weights_all, increment_weights);
+                copy(increment_bias_all, increment_bias);
+                NAG_lookahead(-momentum);
+            }
+            matrix_float W(weights);
             W.set(weights.hostData.size(), 1);            
-            openclKernels->runMatrixScalarMultiplication(W, 0.5f);
-            matrix_cl_float B(bias);
+            backend->runMatrixScalarMultiplication(W, 0.5f);
+            matrix_float B(bias);
             B.set(bias.hostData.size(), 1);
-            openclKernels->runMatrixScalarMultiplication(B, 0.5f);
-#endif
+            backend->runMatrixScalarMultiplication(B, 0.5f);
+            weights_modified();
+            print_data();
+#else
+            // evaluated with the real weights
+            if (opt->lookahead()) NAG_lookahead(-momentum);
             print_data();
+            if (opt->lookahead()) NAG_lookahead(momentum);
+#endif
+            // breakdown of the steps since the previous report
+            if (prof != nullptr) prof->report(std::cout, epoch);
+            // throughput and transfers since the previous report
+            stats.report(std::cout, epoch);
             if (ce < minError) break;
         }        
                 
     }
+    
+#if DROPOUT_COMPACTION
+    // whole network (not scaled) in weights, increment_weights, bias and
+    // increment_bias
+    dropout.restore_all_neurons();
+    copy(weights_all, weights);
+    copy(increment_weights_all, increment_weights);
+    copy(bias_all, bias);
+    copy(increment_bias_all, increment_bias);
+    weights_modified();
+#endif
+    // the real weights again
+    if (opt->lookahead()) NAG_lookahead(-momentum);
       
     trainRunning = false;
 }
 
+compute_event nn::minibatch_gradients(const std::vector<compute_event> *waitList) {
+    phase("upload");
+    std::vector<compute_event> step(1, gather_minibatch(waitList));
+    phase("FF");
+    step.assign(1, FF_train(&step));
+    phase("BP");
+    step.assign(1, BP(&step));
+    phase("gradients");
+    return gradients(&step);
+}
+
+compute_event nn::data_parallel_gradients(const std::vector<compute_event> *waitList) {
+    // different dropout masks in every slice
+    const cl_uint stepSeed = dropoutSeed;
+    
+    // the replicas only wait for the previous work of the first device
+    std::vector<compute_event> slices;
+    for (size_t k = 0; k < replicas.size(); k++) {
+        dropoutSeed = stepSeed + k*numberOfLayers;
+        use_replica(*replicas[k]);
+        slices.push_back(minibatch_gradients(waitList));
+        backend->flush();   // waited by the first device
+        use_replica(*replicas[k]);
+    }
+    dropoutSeed = stepSeed;
+    
+    phase("reduce");
+    // reduce in the first device: the sums of the slices are the sums of
+    // the whole minibatch
+    matrix_float wei_grad(gradient_weights);
+    matrix_float bias_grad(gradient_bias);
+    wei_grad.set(1, weights_in_use(), 0);
+    bias_grad.set(1, bias_in_use(), 0);
+    std::vector<compute_event> reduce(slices);
+    for (size_t k = 1; k < replicas.size(); k++) {
+        matrix_float wei_grad_k(replicas[k]->gradient_weights);
+        matrix_float bias_grad_k(replicas[k]->gradient_bias);
+        wei_grad_k.set(1, weights_in_use(), 0);
+        bias_grad_k.set(1, bias_in_use(), 0);
+        std::vector<compute_event> sums;
+        sums.push_back(backend->runElementWiseSum(wei_grad, wei_grad_k,
+                                                  wei_grad, 1.0f, 1.0f,
+                                                  &reduce));
+        sums.push_back(backend->runElementWiseSum(bias_grad, bias_grad_k,
+                                                  bias_grad, 1.0f, 1.0f,
+                                                  &reduce));
+        // the next sums wait for these ones
+        reduce.assign(1, backend->marker(&sums));
+    }
+    return backend->marker(&reduce);
+}
+
+compute_event nn::gather_minibatch(const std::vector<compute_event> *waitList) {
+    matrix_float inputs(training_inputs);
+    matrix_float outputs(training_outputs);
+    matrix_float act(activations);
+    matrix_float out(t);
+    matrix_uint idx(minibatch_idx);
+    
+    const cl_uint N0 = elementsPerLayer[0];
+    const cl_uint NL = elementsPerLayer[numberOfLayers-1];
+    inputs.set(numberOfTrainingData, N0);
+    outputs.set(numberOfTrainingData, NL);
+    act.set(minibatchSize, N0, activations_offsets[0]);
+    out.set(minibatchSize, NL);
+    idx.set(minibatchSize, 1, minibatchFirstRow);
+    
+    std::vector<compute_event> gathers;
+    gathers.push_back(backend->runGatherRows(inputs, act, idx, waitList));
+    gathers.push_back(backend->runGatherRows(outputs, out, idx, waitList));
+    // completed after the gathers of the inputs and the outputs
+    return backend->marker(&gathers);
+}
+
+compute_event nn::load_eval_chunk(bool trainingSet,
+                              cl_uint begin,
+                              cl_uint rows) {
+    const cl_uint N0 = elementsPerLayer[0];
+    const cl_uint NL = elementsPerLayer[numberOfLayers-1];
+    const size_t off0 = activations_test_offsets[0];
+    
+    if (!trainingSet) {
+        // blocking uploads: the host copies of the previous chunk are free
+        std::copy(test_data.begin() + size_t(begin)*N0,
+                  test_data.begin() + size_t(begin + rows)*N0,
+                  activations_test.hostData.begin() + off0);
+        std::copy(test_data_output.begin() + size_t(begin)*NL,
+                  test_data_output.begin() + size_t(begin + rows)*NL,
+                  t_test.hostData.begin());
+        write_range(activations_test, off0, size_t(rows)*N0);
+        write_range(t_test, 0, size_t(rows)*NL);
+        return compute_event();
+    }
+    
+    // resident in the device: gathered as the minibatches
+    for (cl_uint r = 0; r < rows; r++) eval_idx.hostData[r] = begin + r;
+    write_range(eval_idx, 0, rows);
+    
+    matrix_float inputs(training_inputs);
+    matrix_float outputs(training_outputs);
+    matrix_float act(activations_test);
+    matrix_float out(t_test);
+    matrix_uint idx(eval_idx);
+    inputs.set(numberOfTrainingData, N0);
+    outputs.set(numberOfTrainingData, NL);
+    act.set(rows, N0, off0);
+    out.set(rows, NL);
+    idx.set(rows, 1, 0);
+    
+    backend->runGatherRows(inputs, act, idx);
+    return backend->runGatherRows(outputs, out, idx);
+}
+
+void nn::evaluate(bool trainingSet,
+                  cl_float &ce,
+                  cl_float &percentage,
+                  bool int8) {
+    assert(!trainingSet || trainDataLoaded);
+    
+    const cl_uint N = elementsPerLayer[numberOfLayers-1];
+    const cl_uint total = trainingSet?numberOfTrainingData:numberOfTestData;
+    const bool confusion = confusionMatrix && !trainingSet;
+    
+    // classifications accumulated on the device over all the chunks
+    clear_classifications(confusion);
+    
+    double sum = 0.0;
+    for (cl_uint begin = 0; begin < total; begin += evalRows) {
+        const cl_uint rows = std::min(evalRows, total - begin);
+        
+        std::vector<compute_event> loaded(1, load_eval_chunk(trainingSet,
+                                                         begin,
+                                                         rows));
+        if (int8) {
+            FF_int8_test(rows, &loaded);
+        } else {
+            FF_test(rows, &loaded);
+        }
+        classify(activations_test, activations_test_offsets, t_test, rows,
+                 confusion);
+        // mean of the chunk, blocking: the workspace can be reused
+        sum += double(CE(activations_test, activations_test_offsets, t_test,
+                         rows))*rows;
+    }
+    
+    read_range(eval_counts, 0, confusion?(1 + N*N):1);
+    
+    ce = cl_float(sum/total);
+    percentage = cl_float(eval_counts.hostData[0])/cl_float(total)*100;
+}
+
+compute_event nn::dropout_gather_scatter(const dng &dropout,
+                                     bool scatter,
+                                     const std::vector<compute_event> *waitList) {
+    const std::vector<cl_uint> &all_elements = dropout.all_elements_per_layer();
+    const std::vector<cl_uint> &all_weights_offsets =
+                                            dropout.all_weights_offsets();
+    const std::vector<cl_uint> &all_bias_offsets = dropout.all_bias_offsets();
+    
+    matrix_float w_all(weights_all);
+    matrix_float w(weights);
+    matrix_float inc_all(increment_weights_all);
+    matrix_float inc(increment_weights);
+    matrix_float b_all(bias_all);
+    matrix_float b(bias);
+    matrix_float b_inc_all(increment_bias_all);
+    matrix_float b_inc(increment_bias);
+    matrix_uint row_idx(dropout_indexes);
+    matrix_uint col_idx(dropout_indexes);
+    
+    // the copies of the layers are independent between them
+    std::vector<compute_event> copies;
+    for (cl_uint i = 0; i < numberOfLayers - 1; i++) {
+        w_all.set(all_elements[i], all_elements[i+1], all_weights_offsets[i]);
+        inc_all.set(all_elements[i], all_elements[i+1], all_weights_offsets[i]);
+        w.set(elementsPerLayer[i], elementsPerLayer[i+1], weights_offsets[i]);
+        inc.set(elementsPerLayer[i], elementsPerLayer[i+1], weights_offsets[i]);
+        row_idx.set(1, elementsPerLayer[i], dropout.indexes_offset(i));
+        col_idx.set(1, elementsPerLayer[i+1], dropout.indexes_offset(i+1));
+        copies.push_back(backend->runDropoutGatherScatter(
+                                        w_all, w, &inc_all, &inc, &row_idx,
+                                        col_idx, scatter, waitList));
+        
+        b_all.set(1, all_elements[i+1], all_bias_offsets[i]);
+        b.set(1, elementsPerLayer[i+1], bias_offsets[i]);
+        b_inc_all.set(1, all_elements[i+1], all_bias_offsets[i]);
+        b_inc.set(1, elementsPerLayer[i+1], bias_offsets[i]);
+        copies.push_back(backend->runDropoutGatherScatter(
+                                        b_all, b, &b_inc_all, &b_inc, nullptr,
+                                        col_idx, scatter, waitList));
+    }
+    
+    // the gather changes the compact network
+    if (!scatter) weights_modified();
+    // completed when all the copies have finished
+    return backend->marker(&copies);
+}
+
 cl_float nn::CE(
         host_device_memory_map<cl_float> &activ,
         std::vector<cl_uint> &off,
         host_device_memory_map<cl_float> &out,
         cl_uint rows) {
-    matrix_cl_float tm(out);
-    matrix_cl_float act(activ);
-    matrix_cl_float ce(buffer_error);
+    matrix_float tm(out);
+    matrix_float act(activ);
+    matrix_float ce(buffer_error);
 
     const cl_uint elemLastLayer = elementsPerLayer[numberOfLayers-1];
     
@@ -637,16 +1309,164 @@ cl_float nn::CE(
     // print(act, "y");
     // print(tm, "t");
 
-    return openclKernels->runCrossEntropy(tm, act, ce);
+    return backend->runCrossEntropy(tm, act, ce);
+}
+
+void nn::quantize_int8(cl_uint calibrationRows) {
+    const cl_uint N = numberOfLayers - 1;
+    calibrationRows = std::min(calibrationRows, numberOfTestData);
+    
+    // weights: symmetric quantization, w = scale * q with |q| <= 127
+    read(weights);
+    weights_int8.hostData.resize(weights.hostData.size());
+    weights_scale.hostData.resize(bias.hostData.size());
+    for (cl_uint i = 0; i < N; i++) {
+        const cl_uint rows = elementsPerLayer[i];
+        const cl_uint cols = elementsPerLayer[i+1];
+        const cl_float *w = &weights.hostData[weights_offsets[i]];
+        cl_char *q = &weights_int8.hostData[weights_offsets[i]];
+        cl_float *scale = &weights_scale.hostData[bias_offsets[i]];
+        
+        for (cl_uint c = 0; c < cols; c++) {
+            cl_float maximum = 0.0f;
+            for (cl_uint r = 0; r < rows; r++)
+                maximum = std::max(maximum, std::fabs(w[r*cols + c]));
+            scale[c] = maximum;
+        }
+        if (!int8PerColumnScales) {
+            std::fill(scale, scale + cols, *std::max_element(scale,
+                                                             scale + cols));
+        }
+        for (cl_uint c = 0; c < cols; c++) {
+            // any scale is valid for a column of zeros
+            scale[c] = (scale[c] > 0.0f)?scale[c]/127.0f:1.0f;
+        }
+        for (cl_uint r = 0; r < rows; r++) {
+            for (cl_uint c = 0; c < cols; c++) {
+                q[r*cols + c] = cl_char(std::lround(w[r*cols + c]/scale[c]));
+            }
+        }
+    }
+    
+    // activations: maximum absolute value of every layer in the fp32 FF of
+    // the calibration rows. The evaluation workspace only keeps two layers
+    // (ping-pong): FF in minibatches of the test set through the training
+    // workspace, where every layer is kept.
+    const cl_uint N0 = elementsPerLayer[0];
+    const size_t off0 = activations_offsets[0];
+    std::vector<cl_float> maximum(N, 0.0f);
+    for (cl_uint begin = 0; begin < calibrationRows; begin += minibatchSize) {
+        const cl_uint rows = std::min(minibatchSize, calibrationRows - begin);
+        std::copy(test_data.begin() + size_t(begin)*N0,
+                  test_data.begin() + size_t(begin + rows)*N0,
+                  activations.hostData.begin() + off0);
+        write_range(activations, off0, size_t(rows)*N0);
+        FF(activations, activations_offsets, rows);
+        for (cl_uint i = 0; i < N; i++) {
+            const size_t n = size_t(rows)*elementsPerLayer[i];
+            read_range(activations, activations_offsets[i], n);
+            const cl_float *a = &activations.hostData[activations_offsets[i]];
+            for (size_t k = 0; k < n; k++)
+                maximum[i] = std::max(maximum[i], std::fabs(a[k]));
+        }
+    }
+    activations_scale.resize(N);
+    for (cl_uint i = 0; i < N; i++) {
+        activations_scale[i] = (maximum[i] > 0.0f)?maximum[i]/127.0f:1.0f;
+    }
+    
+    if (weights_int8.deviceData == nullptr) {
+        // same layout than activations_test (ping-pong)
+        activations_int8.hostData.resize(activations_test.hostData.size());
+        create_buffer(weights_int8, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR);
+        create_buffer(weights_scale, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR);
+        create_buffer(activations_int8,
+                      CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR);
+    }
+    write(weights_int8);
+    write(weights_scale);
+    
+    int8Quantized = true;
+}
+
+compute_event nn::FF_int8_test(cl_uint rows,
+                           const std::vector<compute_event> *waitList) {
+    assert(int8Quantized);
+    
+    const cl_uint N = numberOfLayers - 1;
+    std::vector<cl_uint> &off = activations_test_offsets;
+    
+    std::vector<compute_event> deps;
+    if (waitList != nullptr) deps = *waitList;
+    
+    // input layer quantized on device
+    matrix_float input(activations_test);
+    matrix_char A(activations_int8);
+    input.set(rows, elementsPerLayer[0], off[0]);
+    A.set(rows, elementsPerLayer[0], off[0]);
+    deps.assign(1, backend->runQuantize(input, A,
+                                              1.0f/activations_scale[0],
+                                              &deps));
+    
+    matrix_char B(weights_int8);
+    matrix_char C(activations_int8);
+    matrix_float output(activations_test);
+    matrix_float bias_val(bias);
+    matrix_float scale_val(weights_scale);
+    for (cl_uint i = 0; i < N; i++) {
+        A.set(rows, elementsPerLayer[i], off[i]);
+        B.set(elementsPerLayer[i], elementsPerLayer[i+1], weights_offsets[i]);
+        bias_val.offset = bias_offsets[i];
+        scale_val.offset = bias_offsets[i];
+        
+        if (i < N-1) {
+            // sigmoid quantized with the scale of the next layer
+            C.set(rows, elementsPerLayer[i+1], off[i+1]);
+            deps.assign(1, backend->runMatrixMultiplicationInt8(
+                                A, B, C, bias_val, scale_val,
+                                activations_scale[i],
+                                1.0f/activations_scale[i+1],
+                                true, &deps));
+        } else {
+            // logits in floats and softmax as in FF()
+            output.set(rows, elementsPerLayer[N], off[N]);
+            deps.assign(1, backend->runMatrixMultiplicationInt8(
+                                A, B, output, bias_val, scale_val,
+                                activations_scale[i], false, &deps));
+            deps.assign(1, backend->runSoftMax(output, &deps));
+        }
+    }
+    return deps[0];
+}
+
+void nn::compare_int8_inference() {
+    if (!int8Quantized) quantize_int8();
+    
+    cl_float ce_fp32;
+    cl_float percentage_fp32;
+    evaluate(false, ce_fp32, percentage_fp32);
+    
+    cl_float ce_int8;
+    cl_float percentage_int8;
+    evaluate(false, ce_int8, percentage_int8, true);
+    
+    std::cout << "\tWeights (bytes)\tCE\t\t%Test\n";
+    std::cout << std::fixed << std::setprecision(6)
+              << "fp32\t" << weights.hostData.size()*sizeof(cl_float) << "\t\t"
+              << ce_fp32 << "\t" << percentage_fp32 << "%\n"
+              << "int8\t" << weights_int8.hostData.size()*sizeof(cl_char)
+              << "\t\t" << ce_int8 << "\t" << percentage_int8 << "%\n"
+              << "diff\t\t\t" << ce_int8 - ce_fp32 << "\t"
+              << percentage_int8 - percentage_fp32 << "%\n";
 }
 
 cl_float nn::L2_regularization() {
-    matrix_cl_float w(weights);
-    matrix_cl_float ce(buffer_error);
+    matrix_float w(weights);
+    matrix_float ce(buffer_error);
     
-    w.set(1, weights.hostData.size(), 0);
+    w.set(1, weights_in_use(), 0);
     
-    return openclKernels->runL2Regularization(w, ce);
+    return backend->runL2Regularization(w, ce);
 }
 
 
@@ -674,10 +1494,10 @@ void nn::save_NN(const std::string filename) {
     const bool weightsPresent = true;
     saveFile.write(reinterpret_cast<const char*>(&weightsPresent),
                    sizeof(weightsPresent));
-    bias.readFromDevice(*queue);
+    read(bias);
     saveFile.write(reinterpret_cast<const char*>(&bias.hostData[0]),
                    bias.hostData.size()*sizeof(cl_float));
-    weights.readFromDevice(*queue);
+    read(weights);
     saveFile.write(reinterpret_cast<const char*>(&weights.hostData[0]),
                    weights.hostData.size()*sizeof(cl_float));
 }
@@ -700,7 +1520,6 @@ void nn::load_NN(const std::string filename) {
     if (weightsPresent) {
         loadFile.read(reinterpret_cast<char*>(&bias.hostData[0]),
                       bias.hostData.size()*sizeof(cl_float));
-        weights.readFromDevice(*queue);
         loadFile.read(reinterpret_cast<char*>(&weights.hostData[0]),
                       weights.hostData.size()*sizeof(cl_float));
     }
@@ -715,9 +1534,9 @@ void nn::load_NN(const std::string filename) {
 //  boost::random::mt19937 gen;
 //  boost::random::uniform_real_distribution<> dist(-5.0f, 5.0f);
 //  
-//    matrix_cl_float A(deltas);
-//    matrix_cl_float B(activations);
-//    matrix_cl_float C(weights);
+//    matrix_float A(deltas);
+//    matrix_float B(activations);
+//    matrix_float C(weights);
 //    
 //    assert(nr_rows_A % 4 == 0 &&
 //           nr_rows_B % 4 == 0 &&
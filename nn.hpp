@@ -6,6 +6,12 @@
 #define NOT_IN_USE 0
 
 #define DROPOUT IN_USE
+// Dropout with a mask generated inside the GEMM kernels (the layers keep
+// their shape) instead of the compaction of the neurons done by dng
+#define DROPOUT_MASK NOT_IN_USE
+
+#define DROPOUT_BY_MASK (DROPOUT && DROPOUT_MASK)
+#define DROPOUT_COMPACTION (DROPOUT && !DROPOUT_MASK)
 
 #define __CL_ENABLE_EXCEPTIONS  // enable use of exceptions of the OpenCL API
 
@@ -18,7 +24,13 @@
 
 #include "common.hpp"
 #include "mg.hpp"
-#include "OpenCLKernels.hpp"
+#include "compute_backend.hpp"
+#include "optimizer.hpp"
+#include "replica.hpp"
+#include "profiler.hpp"
+#include "train_stats.hpp"
+
+class dng;
 
 class nn {
     bool neuralNetworkDefined = false;
@@ -41,6 +53,50 @@ class nn {
     // enableNAG true uses Nesterov-accelerated gradient.
     // enableNAG false uses Classical Momentum
     bool enableNAG = true;
+    
+    // output layer softmax, deltas and cross entropy in one kernel
+    bool fuseOutputLayer = true;
+    
+    // data parallel training: one replica of the model in every device of
+    // the platform (the CPUs split into one sub-device per NUMA node), each
+    // one with a slice of the minibatch. Set by the constructor.
+    bool dataParallel;
+    std::vector<replica *> replicas;
+    // first row of the minibatch slice of the device in use
+    cl_uint minibatchFirstRow = 0;
+    
+    // activations, deltas and the copy of the weights used by the GEMMs
+    // stored in halfs (16 bits). Accumulation, weights updates and the
+    // master weights stay in floats.
+    bool halfStorage = false;
+    // the deltas are multiplied by lossScale (only with halfStorage) to keep
+    // the small ones representable in half. The weight update divides by it.
+    cl_float lossScale = 256.0f;
+    // weights_half is converted again by FF() only if the weights have
+    // been modified (weights_modified()) since its last conversion
+    size_t weightsVersion = 1;
+    size_t weightsHalfVersion = 0;  // weightsVersion of weights_half
+    
+    // DROPOUT_BY_MASK: keep probability of the hidden neurons and seed of
+    // the masks of the actual training step (layer l uses dropoutSeed + l)
+    cl_float dropoutKeep = 0.5f;
+    cl_uint dropoutSeed = 0;
+    
+    // int8 inference: one weight scale per output neuron (true) or one per
+    // layer (false)
+    bool int8PerColumnScales = true;
+    bool int8Quantized = false;
+    
+    // confusion matrix of the test set printed every printEpochs
+    bool confusionMatrix = false;
+    
+    // evaluation in chunks of evalChunkSize rows through the activations_test
+    // workspace (evalRows rows: evalChunkSize or less if the data sets are
+    // smaller). evalTrainingSet: print_data() evaluates the whole training
+    // set instead of the last minibatch.
+    cl_uint evalChunkSize = 10000;
+    cl_uint evalRows = 0;
+    bool evalTrainingSet = false;
  
 #if DROPOUT
     bool enableL2Regularization = false;
@@ -63,31 +119,71 @@ class nn {
     
     std::vector<cl_uint> elementsPerLayer;
     
-    // Whole training data set
+    // Whole training data set (resident in the device, the minibatches are
+    // gathered from it)
     std::vector<cl_float> training_data;
     std::vector<cl_float> training_data_output;
+    // rows of the training data set of the minibatch
+    std::vector<cl_uint> minibatch_idx_host;
+    // Whole test data set (only in the host, uploaded in chunks)
+    std::vector<cl_float> test_data;
+    std::vector<cl_float> test_data_output;
+    // rows of the training data set of the evaluated chunk
+    std::vector<cl_uint> eval_idx_host;
     
     // activations of all the neurons for all the training data for one epoch
     std::vector<cl_float> activations_host;
-    // activations of all the neurons for all the test data for one epoch
+    // activations of a chunk of the evaluated data set (evalRows rows):
+    // inference only, so just two layers, the input of the actual GEMM and
+    // its output, alternating between two halves sized to the widest layer
     std::vector<cl_float> activations_test_host;
     // bias
     std::vector<cl_float> bias_host;
     // weights of all neurons
     std::vector<cl_float> weights_host;
+    // weights in halfs used by FF and BP if halfStorage (copy of weights)
+    std::vector<cl_float> weights_half_host;
     // last weight increment calculated from back propagation
     std::vector<cl_float> increment_weights_host;
     // last bias increment calculated from back propagation
-    // std::vector<cl_float> increment_bias_host;
+    std::vector<cl_float> increment_bias_host;
+    // gradients of the weights and bias of the minibatch (sums over the
+    // minibatch, used by the optimizer)
+    std::vector<cl_float> gradient_weights_host;
+    std::vector<cl_float> gradient_bias_host;
     // deltas of all activation layers
     std::vector<cl_float> deltas_host;
     // output values of the training data
     std::vector<cl_float> t_host;
-    // output values of the test data
+    // output values of the evaluated chunk
     std::vector<cl_float> t_test_host;
     // vector required for the host side calculation of the cross entropy
     // after first reduce in device
     std::vector<cl_float> buffer_error_host;
+    // cross entropy partial sums of the last training minibatch
+    // (calculated with the fused output layer)
+    std::vector<cl_float> ce_partial_host;
+    // classification counters of the device: correct classifications and
+    // the confusion matrix (target rows x predicted columns) after it
+    std::vector<cl_uint> eval_counts_host;
+    
+    // int8 inference (quantize_int8()): weights, weight scales (one per
+    // output neuron, same offsets than bias) and test activations
+    std::vector<cl_char> weights_int8_host;
+    std::vector<cl_float> weights_scale_host;
+    std::vector<cl_char> activations_int8_host;
+    // calibrated scale of the activations of every layer (input of every GEMM)
+    std::vector<cl_float> activations_scale;
+    
+    // Dropout training: whole network (weights, increments and bias). The
+    // weights, increment_weights and bias maps contain only the neurons
+    // selected for the minibatch, gathered from these ones on the device.
+    std::vector<cl_float> weights_all_host;
+    std::vector<cl_float> increment_weights_all_host;
+    std::vector<cl_float> bias_all_host;
+    std::vector<cl_float> increment_bias_all_host;
+    // indexes of the selected neurons of every layer (filled by dng)
+    std::vector<cl_uint> dropout_indexes_host;
     
     // offsets required for finding activation values over the vector
     std::vector<cl_uint> activations_offsets;
@@ -102,20 +198,103 @@ class nn {
     host_device_memory_map<cl_float> bias;
     // inputs and calculated activations
     host_device_memory_map<cl_float> weights;  // all the weights of the NN
+    host_device_memory_map<cl_float> weights_half;  // weights stored in halfs
     host_device_memory_map<cl_float> increment_weights;  // all the inc weights of the NN
-    // host_device_memory_map<cl_float> increment_bias;  // all the inc bias of the NN
+    host_device_memory_map<cl_float> increment_bias;  // all the inc bias of the NN
+    host_device_memory_map<cl_float> gradient_weights;
+    host_device_memory_map<cl_float> gradient_bias;
     host_device_memory_map<cl_float> deltas;   // delta errors (Backprop)
     host_device_memory_map<cl_float> t;        // real output value
     host_device_memory_map<cl_float> t_test;        // real output value
     host_device_memory_map<cl_float> buffer_error;  // real output value
-    
-    // host_device_memory_map<cl_uint> minibatch_idx;
-    
+    host_device_memory_map<cl_float> ce_partial;
+    host_device_memory_map<cl_uint> eval_counts;
+    host_device_memory_map<cl_char> weights_int8;
+    host_device_memory_map<cl_float> weights_scale;
+    host_device_memory_map<cl_char> activations_int8;
+    host_device_memory_map<cl_float> weights_all;
+    host_device_memory_map<cl_float> increment_weights_all;
+    host_device_memory_map<cl_float> bias_all;
+    host_device_memory_map<cl_float> increment_bias_all;
+    host_device_memory_map<cl_uint> dropout_indexes;
+    host_device_memory_map<cl_float> training_inputs;
+    host_device_memory_map<cl_float> training_outputs;
+    host_device_memory_map<cl_uint> minibatch_idx;
+    host_device_memory_map<cl_uint> eval_idx;
+    
+    // nullptr with the native CPU backend
     cl::Context *context;   // unique OpenCL context
     std::vector<cl::Device> devices;
     cl::CommandQueue *queue;   // unique OpenCL command queue;
 
-    OpenCLKernels *openclKernels;
+    // OpenCLKernels or cpu_backend (nativeCPU)
+    compute_backend *backend;
+    // the device of queue shares the memory with the host (CPU or unified
+    // memory): the blocking reads map the buffers instead of copying
+    bool zeroCopy = false;
+    optimizer *opt;     // weights and bias update
+    
+    // device profiling (nullptr if not enabled). Set by the constructor.
+    profiler *prof = nullptr;
+    // throughput, host time per phase and transfers of the training
+    train_stats stats;
+    // phase of the step of the operations enqueued from now on
+    inline void phase(const char *p) {
+        if (prof != nullptr) prof->setPhase(p);
+        stats.phase(p);
+    }
+    
+    // Buffers and transfers of the maps. Nothing to do if the backend works
+    // on the host vectors.
+    template<typename T>
+    inline void create_buffer(host_device_memory_map<T> &m,
+                              cl_mem_flags flags) {
+        if (!backend->host_memory()) m.createBuffer(*context, flags);
+    }
+    // Blocking transfers of count elements from offset. Reads are zero-copy
+    // (map and unmap) if the device shares the memory with the host
+    template<typename T>
+    inline void read_range(host_device_memory_map<T> &m,
+                           size_t offset,
+                           size_t count) {
+        if (backend->host_memory() || count == 0) return;
+        if (zeroCopy) {
+            cl::Event map, unmap;
+            m.readRangeByMap(*queue, offset, count, nullptr, &map, &unmap);
+            if (prof != nullptr) {
+                prof->record("mapBuffer", map);
+                prof->record("unmapMemObject", unmap);
+            }
+            return;
+        }
+        cl::Event event;
+        m.readRangeFromDevice(*queue, offset, count, nullptr, &event);
+        if (prof != nullptr) prof->record("readBuffer", event);
+    }
+    template<typename T>
+    inline void write_range(host_device_memory_map<T> &m,
+                            size_t offset,
+                            size_t count) {
+        if (backend->host_memory()) return;
+        cl::Event event;
+        m.writeRangeToDevice(*queue, offset, count, nullptr, &event);
+        if (prof != nullptr) prof->record("writeBuffer", event);
+    }
+    template<typename T>
+    inline void read(host_device_memory_map<T> &m) {
+        read_range(m, 0, m.hostData.size());
+    }
+    template<typename T>
+    inline void write(host_device_memory_map<T> &m) {
+        write_range(m, 0, m.hostData.size());
+    }
+    template<typename T>
+    inline compute_event write_async(host_device_memory_map<T> &m) {
+        if (backend->host_memory()) return compute_event();
+        cl::Event event = m.writeToDeviceAsync(*queue);
+        if (prof != nullptr) prof->record("writeBuffer", event);
+        return to_compute_event(event);
+    }
         
     /*
      * Momentum update rule extracted from "On the importance of
@@ -139,18 +318,96 @@ class nn {
                             cl_float ce1,
                             cl_float ce2,
                             cl_float ce,
+                            cl_float training_percentage,
                             cl_float ce1_test,
                             cl_float ce2_test,
-                            cl_float ce_test);
+                            cl_float ce_test,
+                            cl_float test_percentage);
 
     void print_results_data_header();
     void print_results_data(cl_float ce,
-                            cl_float ce_test);
+                            cl_float training_percentage,
+                            cl_float ce_test,
+                            cl_float test_percentage);
+    // of the last evaluate() of the test set (or
+    // percentage_classification_results(..., true))
+    void print_confusion_matrix();
     void print_data();
     
-    // Nesterov Accelerated Gradient functions
-    void NAG_preupdate();
-    void NAG_postupdate();
+    // Nesterov Accelerated Gradient: the training keeps the weights and the
+    // bias in the lookahead point. weights += factor*increment_weights (and
+    // the same with the bias): momentum moves them to the lookahead point,
+    // -momentum back to the real values.
+    compute_event NAG_lookahead(cl_float factor,
+                            const std::vector<compute_event> *waitList = nullptr);
+#if DROPOUT_COMPACTION
+    // Same shift of the whole network kept on the device (weights_all,
+    // bias_all and their increments), the neurons not selected included
+    compute_event NAG_lookahead_all(
+                            cl_float factor,
+                            const std::vector<compute_event> *waitList = nullptr);
+#endif
+    
+    // the weights on the device have changed: weights_half is stale
+    inline void weights_modified() { weightsVersion++; }
+    
+    // Data parallel training: queue, kernels, minibatch slice and buffers of
+    // the replica r exchanged with the ones of nn, so FF, BP and gradients
+    // are enqueued in its device. A second call restores them.
+    void use_replica(replica &r);
+    void allocate_replicas();
+    // gather, FF, BP and gradients of the minibatch in the device in use
+    compute_event minibatch_gradients(
+                            const std::vector<compute_event> *waitList = nullptr);
+    // minibatch_gradients() of every replica and sum of their gradients in
+    // the first device
+    compute_event data_parallel_gradients(
+                            const std::vector<compute_event> *waitList = nullptr);
+    
+    // Input activations and targets of the minibatch (rows minibatch_idx of
+    // the training set) gathered on the device
+    compute_event gather_minibatch(
+                            const std::vector<compute_event> *waitList = nullptr);
+    
+    // Input activations and targets of rows [begin, begin + rows) of the
+    // evaluated data set in the activations_test and t_test workspace: test
+    // set uploaded from the host, training set gathered on the device
+    compute_event load_eval_chunk(bool trainingSet,
+                              cl_uint begin,
+                              cl_uint rows);
+    
+    // Dropout on the device. scatter == false copies the selected neurons
+    // of the whole network into weights, increment_weights, bias and
+    // increment_bias.
+    // scatter == true copies them back after the weights actualization.
+    compute_event dropout_gather_scatter(
+                            const dng &dropout,
+                            bool scatter,
+                            const std::vector<compute_event> *waitList = nullptr);
+    
+    // number of weights of the actual layer sizes (only the ones of the
+    // selected neurons during the dropout training)
+    inline cl_uint weights_in_use() const {
+        const cl_uint N = numberOfLayers - 1;
+        return weights_offsets[N-1] + elementsPerLayer[N-1]*elementsPerLayer[N];
+    }
+    
+    // number of bias of the actual layer sizes
+    inline cl_uint bias_in_use() const {
+        const cl_uint N = numberOfLayers - 1;
+        return bias_offsets[N-1] + elementsPerLayer[N];
+    }
+    
+    // elements of the widest layer
+    inline cl_uint max_layer_width() const {
+        return *std::max_element(elementsPerLayer.begin(),
+                                 elementsPerLayer.end());
+    }
+    
+    // factor of the deltas (loss scaling only with halfStorage)
+    inline cl_float delta_scale() const {
+        return halfStorage?lossScale:1.0f;
+    }
     
     // OpenCL initialization
     void opencl_init();
@@ -163,15 +420,37 @@ class nn {
     void allocate_memory_on_device();
     void load_data_to_device();
     
-    void FF(host_device_memory_map<cl_float> &act,
-            std::vector<cl_uint> &off,
-            cl_uint rows);
+    // Returns the event of the last kernel launched. Nothing is waited on
+    // the host side.
+    // If targets is given and fuseOutputLayer is enabled, the deltas of the
+    // output layer and the cross entropy partials are also calculated.
+    // dropout applies the DROPOUT_BY_MASK masks to the hidden layers.
+    // Layer i+1 only reads layer i: off can reuse the memory of the older
+    // layers (ping-pong offsets of activations_test, inference only).
+    compute_event FF(host_device_memory_map<cl_float> &act,
+                 std::vector<cl_uint> &off,
+                 cl_uint rows,
+                 const std::vector<compute_event> *waitList = nullptr,
+                 host_device_memory_map<cl_float> *targets = nullptr,
+                 bool dropout = false);
 
+    // Counted on the device: only the counters are read (confusion: also
+    // the confusion matrix)
     cl_float percentage_classification_results(
             host_device_memory_map<cl_float> &act,
             std::vector<cl_uint> &act_off,
             host_device_memory_map<cl_float> &out,
-            cl_uint rows);
+            cl_uint rows,
+            bool confusion = false);
+    // adds the rows of act (output layer) to the counters of eval_counts
+    compute_event classify(
+            host_device_memory_map<cl_float> &act,
+            std::vector<cl_uint> &act_off,
+            host_device_memory_map<cl_float> &out,
+            cl_uint rows,
+            bool confusion);
+    // eval_counts = 0 (confusion: also the confusion matrix)
+    compute_event clear_classifications(bool confusion);
     
     // Cross Entropy Error Function Calculation
     cl_float CE(
@@ -184,7 +463,14 @@ class nn {
     
  public:
     
-    nn();
+    // nativeCPU: cpu_backend instead of OpenCL (no OpenCL runtime
+    // required, dataParallel and halfStorage are not used)
+    // profiling: queues with CL_QUEUE_PROFILING_ENABLE and a breakdown of
+    // the device time per kernel and per phase every printEpochs (OpenCL
+    // only)
+    explicit nn(bool dataParallel = false,
+                bool nativeCPU = false,
+                bool profiling = false);
     ~nn();
 
     
@@ -196,6 +482,17 @@ class nn {
     inline void setLR(cl_float lr) { learningRate = lr; }
     inline void setM(cl_float m) { momentum = m; }
     
+    // Call them before init_training()
+    inline void setHalfStorage(bool h) { halfStorage = h; }
+    inline void setLossScale(cl_float s) { lossScale = s; }
+    
+    inline void setInt8PerColumnScales(bool c) { int8PerColumnScales = c; }
+    
+    inline void setConfusionMatrix(bool c) { confusionMatrix = c; }
+    // Call them before init_training()
+    inline void setEvalChunkSize(cl_uint rows) { evalChunkSize = rows; }
+    inline void setEvalTrainingSet(bool e) { evalTrainingSet = e; }
+    
     void populate_normal_sparse_weights(const cl_float mean = 0.0f,
                                         const cl_float stddev = 0.1f,
                                         const cl_uint initElementsPerLayer = 15);
@@ -218,11 +515,17 @@ class nn {
         save_csv_vector(filename, v);
     }
     
-    inline void FF_train() {
-        FF(activations, activations_offsets, minibatchSize);
+    inline compute_event FF_train(
+                    const std::vector<compute_event> *waitList = nullptr) {
+        return FF(activations, activations_offsets, minibatchSize, waitList,
+                  &t, DROPOUT_BY_MASK);
     }
-    inline void FF_test() {
-        FF(activations_test, activations_test_offsets, numberOfTestData);
+    // FF of the first rows of the activations_test workspace
+    inline compute_event FF_test(
+                    cl_uint rows,
+                    const std::vector<compute_event> *waitList = nullptr) {
+        return FF(activations_test, activations_test_offsets,
+                  rows, waitList);
     }
 
     inline cl_float percentage_classification_results_train() {
@@ -233,15 +536,16 @@ class nn {
                 minibatchSize);
     }
 
-    inline cl_float percentage_classification_results_test() {
-        return percentage_classification_results(
-                activations_test,
-                activations_test_offsets,
-                t_test,
-                numberOfTestData);
-    }
     
     inline cl_float CE_train() {
+        if (fuseOutputLayer) {
+            // already calculated by the last FF_train()
+            matrix_float partials(ce_partial);
+            return backend->readCrossEntropyPartials(
+                                partials,
+                                minibatchSize,
+                                elementsPerLayer[numberOfLayers-1]);
+        }
         return CE(
                 activations,
                 activations_offsets,
@@ -249,18 +553,38 @@ class nn {
                 minibatchSize);
     }
 
-    inline cl_float CE_test() {
-        return CE(
-                activations_test,
-                activations_test_offsets,
-                t_test,
-                numberOfTestData);
-    }
+    // Cross entropy and percentage of correct classifications of the whole
+    // test set (or training set) evaluated in chunks of evalRows rows:
+    // upload, FF (int8: FF_int8_test()), CE and classification of every
+    // chunk. Only the activations of one chunk are stored.
+    void evaluate(bool trainingSet,
+                  cl_float &ce,
+                  cl_float &percentage,
+                  bool int8 = false);
 
     cl_float L2_regularization();
     
-    void BP();  // Backpropagation calculation (all sigmoid))
-    void WA();  // weight actualization
+    // Int8 inference. quantize_int8() quantizes the current weights
+    // (symmetric, per column or per layer scales) and calibrates the scale
+    // of the activations of every layer with the fp32 FF of the first
+    // calibrationRows of the test set (at most evalRows). Call it after
+    // init_training().
+    void quantize_int8(cl_uint calibrationRows = 1000);
+    // FF of the first rows of the activations_test workspace with int8
+    // weights and activations (int32 accumulation). Output softmax in
+    // activations_test.
+    compute_event FF_int8_test(cl_uint rows,
+                           const std::vector<compute_event> *waitList = nullptr);
+    // Prints the cross entropy and the accuracy of the test set with the
+    // fp32 and the int8 FF
+    void compare_int8_inference();
+    
+    // Backpropagation calculation (all sigmoid))
+    compute_event BP(const std::vector<compute_event> *waitList = nullptr);
+    // gradients of the weights and bias (sums over the minibatch)
+    compute_event gradients(const std::vector<compute_event> *waitList = nullptr);
+    // weight actualization from the gradients
+    compute_event WA(const std::vector<compute_event> *waitList = nullptr);
     
     void train();   // Training for all sigmoid + output softmax
     
@@ -0,0 +1,961 @@
+/*
+ * File:   opencl_loader.cpp
+ *
+ * Created on 17 de octubre de 2026
+ */
+
+/*
+ * The executable is not linked with libOpenCL: these definitions of the
+ * OpenCL 1.2 API (the functions called by cl.hpp) load the library with
+ * dlopen the first time one of them is called and forward the call to it.
+ * The native CPU backend (--cpu) never calls them, so it runs in the
+ * machines without an OpenCL runtime (ICD loader).
+ */
+
+#define CL_TARGET_OPENCL_VERSION 120
+#define CL_USE_DEPRECATED_OPENCL_1_1_APIS
+
+#include <CL/cl.h>
+#include <dlfcn.h>
+
+#include <cstdlib>
+#include <iostream>
+
+namespace {
+
+void * open_library() {
+    void *library = dlopen("libOpenCL.so.1", RTLD_NOW | RTLD_LOCAL);
+    if (library == nullptr) {
+        library = dlopen("libOpenCL.so", RTLD_NOW | RTLD_LOCAL);
+    }
+    if (library == nullptr) {
+        std::cerr << "OpenCL runtime not found (" << dlerror() << ").\n"
+                  << "Use --cpu to train with the native CPU backend.\n";
+        std::exit(EXIT_FAILURE);
+    }
+    return library;
+}
+
+void * opencl_symbol(const char *name) {
+    static void * const library = open_library();
+    void *function = dlsym(library, name);
+    if (function == nullptr) {
+        std::cerr << "OpenCL runtime without " << name << "\n";
+        std::exit(EXIT_FAILURE);
+    }
+    return function;
+}
+
+}  // namespace
+
+// function of the library resolved once, then called with the arguments
+#define CL_FORWARD(name, ...)                                               \
+    static const auto function =                                            \
+        reinterpret_cast<decltype(&name)>(opencl_symbol(#name));           \
+    return function(__VA_ARGS__)
+
+extern "C" {
+
+// Platform and devices
+
+CL_API_ENTRY cl_int CL_API_CALL
+clGetPlatformIDs(cl_uint num_entries,
+                 cl_platform_id *platforms,
+                 cl_uint *num_platforms) {
+    CL_FORWARD(clGetPlatformIDs, num_entries, platforms, num_platforms);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clGetPlatformInfo(cl_platform_id platform,
+                  cl_platform_info param_name,
+                  size_t param_value_size,
+                  void *param_value,
+                  size_t *param_value_size_ret) {
+    CL_FORWARD(clGetPlatformInfo, platform, param_name, param_value_size,
+               param_value, param_value_size_ret);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clGetDeviceIDs(cl_platform_id platform,
+               cl_device_type device_type,
+               cl_uint num_entries,
+               cl_device_id *devices,
+               cl_uint *num_devices) {
+    CL_FORWARD(clGetDeviceIDs, platform, device_type, num_entries, devices,
+               num_devices);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clGetDeviceInfo(cl_device_id device,
+                cl_device_info param_name,
+                size_t param_value_size,
+                void *param_value,
+                size_t *param_value_size_ret) {
+    CL_FORWARD(clGetDeviceInfo, device, param_name, param_value_size,
+               param_value, param_value_size_ret);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clCreateSubDevices(cl_device_id in_device,
+                   const cl_device_partition_property *properties,
+                   cl_uint num_devices,
+                   cl_device_id *out_devices,
+                   cl_uint *num_devices_ret) {
+    CL_FORWARD(clCreateSubDevices, in_device, properties, num_devices,
+               out_devices, num_devices_ret);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clRetainDevice(cl_device_id device) {
+    CL_FORWARD(clRetainDevice, device);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clReleaseDevice(cl_device_id device) {
+    CL_FORWARD(clReleaseDevice, device);
+}
+
+// Contexts and command queues
+
+CL_API_ENTRY cl_context CL_API_CALL
+clCreateContext(const cl_context_properties *properties,
+                cl_uint num_devices,
+                const cl_device_id *devices,
+                void (CL_CALLBACK *pfn_notify)(const char *,
+                                               const void *,
+                                               size_t,
+                                               void *),
+                void *user_data,
+                cl_int *errcode_ret) {
+    CL_FORWARD(clCreateContext, properties, num_devices, devices, pfn_notify,
+               user_data, errcode_ret);
+}
+
+CL_API_ENTRY cl_context CL_API_CALL
+clCreateContextFromType(const cl_context_properties *properties,
+                        cl_device_type device_type,
+                        void (CL_CALLBACK *pfn_notify)(const char *,
+                                                       const void *,
+                                                       size_t,
+                                                       void *),
+                        void *user_data,
+                        cl_int *errcode_ret) {
+    CL_FORWARD(clCreateContextFromType, properties, device_type, pfn_notify,
+               user_data, errcode_ret);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clRetainContext(cl_context context) {
+    CL_FORWARD(clRetainContext, context);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clReleaseContext(cl_context context) {
+    CL_FORWARD(clReleaseContext, context);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clGetContextInfo(cl_context context,
+                 cl_context_info param_name,
+                 size_t param_value_size,
+                 void *param_value,
+                 size_t *param_value_size_ret) {
+    CL_FORWARD(clGetContextInfo, context, param_name, param_value_size,
+               param_value, param_value_size_ret);
+}
+
+CL_API_ENTRY cl_command_queue CL_API_CALL
+clCreateCommandQueue(cl_context context,
+                     cl_device_id device,
+                     cl_command_queue_properties properties,
+                     cl_int *errcode_ret) {
+    CL_FORWARD(clCreateCommandQueue, context, device, properties,
+               errcode_ret);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clRetainCommandQueue(cl_command_queue command_queue) {
+    CL_FORWARD(clRetainCommandQueue, command_queue);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clReleaseCommandQueue(cl_command_queue command_queue) {
+    CL_FORWARD(clReleaseCommandQueue, command_queue);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clGetCommandQueueInfo(cl_command_queue command_queue,
+                      cl_command_queue_info param_name,
+                      size_t param_value_size,
+                      void *param_value,
+                      size_t *param_value_size_ret) {
+    CL_FORWARD(clGetCommandQueueInfo, command_queue, param_name,
+               param_value_size, param_value, param_value_size_ret);
+}
+
+// Memory objects
+
+CL_API_ENTRY cl_mem CL_API_CALL
+clCreateBuffer(cl_context context,
+               cl_mem_flags flags,
+               size_t size,
+               void *host_ptr,
+               cl_int *errcode_ret) {
+    CL_FORWARD(clCreateBuffer, context, flags, size, host_ptr, errcode_ret);
+}
+
+CL_API_ENTRY cl_mem CL_API_CALL
+clCreateSubBuffer(cl_mem buffer,
+                  cl_mem_flags flags,
+                  cl_buffer_create_type buffer_create_type,
+                  const void *buffer_create_info,
+                  cl_int *errcode_ret) {
+    CL_FORWARD(clCreateSubBuffer, buffer, flags, buffer_create_type,
+               buffer_create_info, errcode_ret);
+}
+
+CL_API_ENTRY cl_mem CL_API_CALL
+clCreateImage(cl_context context,
+              cl_mem_flags flags,
+              const cl_image_format *image_format,
+              const cl_image_desc *image_desc,
+              void *host_ptr,
+              cl_int *errcode_ret) {
+    CL_FORWARD(clCreateImage, context, flags, image_format, image_desc,
+               host_ptr, errcode_ret);
+}
+
+CL_API_ENTRY cl_mem CL_API_CALL
+clCreateImage2D(cl_context context,
+                cl_mem_flags flags,
+                const cl_image_format *image_format,
+                size_t image_width,
+                size_t image_height,
+                size_t image_row_pitch,
+                void *host_ptr,
+                cl_int *errcode_ret) {
+    CL_FORWARD(clCreateImage2D, context, flags, image_format, image_width,
+               image_height, image_row_pitch, host_ptr, errcode_ret);
+}
+
+CL_API_ENTRY cl_mem CL_API_CALL
+clCreateImage3D(cl_context context,
+                cl_mem_flags flags,
+                const cl_image_format *image_format,
+                size_t image_width,
+                size_t image_height,
+                size_t image_depth,
+                size_t image_row_pitch,
+                size_t image_slice_pitch,
+                void *host_ptr,
+                cl_int *errcode_ret) {
+    CL_FORWARD(clCreateImage3D, context, flags, image_format, image_width,
+               image_height, image_depth, image_row_pitch, image_slice_pitch,
+               host_ptr, errcode_ret);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clRetainMemObject(cl_mem memobj) {
+    CL_FORWARD(clRetainMemObject, memobj);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clReleaseMemObject(cl_mem memobj) {
+    CL_FORWARD(clReleaseMemObject, memobj);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clGetSupportedImageFormats(cl_context context,
+                           cl_mem_flags flags,
+                           cl_mem_object_type image_type,
+                           cl_uint num_entries,
+                           cl_image_format *image_formats,
+                           cl_uint *num_image_formats) {
+    CL_FORWARD(clGetSupportedImageFormats, context, flags, image_type,
+               num_entries, image_formats, num_image_formats);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clGetMemObjectInfo(cl_mem memobj,
+                   cl_mem_info param_name,
+                   size_t param_value_size,
+                   void *param_value,
+                   size_t *param_value_size_ret) {
+    CL_FORWARD(clGetMemObjectInfo, memobj, param_name, param_value_size,
+               param_value, param_value_size_ret);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clGetImageInfo(cl_mem image,
+               cl_image_info param_name,
+               size_t param_value_size,
+               void *param_value,
+               size_t *param_value_size_ret) {
+    CL_FORWARD(clGetImageInfo, image, param_name, param_value_size,
+               param_value, param_value_size_ret);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clSetMemObjectDestructorCallback(cl_mem memobj,
+                                 void (CL_CALLBACK *pfn_notify)(cl_mem,
+                                                                void *),
+                                 void *user_data) {
+    CL_FORWARD(clSetMemObjectDestructorCallback, memobj, pfn_notify,
+               user_data);
+}
+
+// Samplers
+
+CL_API_ENTRY cl_sampler CL_API_CALL
+clCreateSampler(cl_context context,
+                cl_bool normalized_coords,
+                cl_addressing_mode addressing_mode,
+                cl_filter_mode filter_mode,
+                cl_int *errcode_ret) {
+    CL_FORWARD(clCreateSampler, context, normalized_coords, addressing_mode,
+               filter_mode, errcode_ret);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clRetainSampler(cl_sampler sampler) {
+    CL_FORWARD(clRetainSampler, sampler);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clReleaseSampler(cl_sampler sampler) {
+    CL_FORWARD(clReleaseSampler, sampler);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clGetSamplerInfo(cl_sampler sampler,
+                 cl_sampler_info param_name,
+                 size_t param_value_size,
+                 void *param_value,
+                 size_t *param_value_size_ret) {
+    CL_FORWARD(clGetSamplerInfo, sampler, param_name, param_value_size,
+               param_value, param_value_size_ret);
+}
+
+// Programs
+
+CL_API_ENTRY cl_program CL_API_CALL
+clCreateProgramWithSource(cl_context context,
+                          cl_uint count,
+                          const char **strings,
+                          const size_t *lengths,
+                          cl_int *errcode_ret) {
+    CL_FORWARD(clCreateProgramWithSource, context, count, strings, lengths,
+               errcode_ret);
+}
+
+CL_API_ENTRY cl_program CL_API_CALL
+clCreateProgramWithBinary(cl_context context,
+                          cl_uint num_devices,
+                          const cl_device_id *device_list,
+                          const size_t *lengths,
+                          const unsigned char **binaries,
+                          cl_int *binary_status,
+                          cl_int *errcode_ret) {
+    CL_FORWARD(clCreateProgramWithBinary, context, num_devices, device_list,
+               lengths, binaries, binary_status, errcode_ret);
+}
+
+CL_API_ENTRY cl_program CL_API_CALL
+clCreateProgramWithBuiltInKernels(cl_context context,
+                                  cl_uint num_devices,
+                                  const cl_device_id *device_list,
+                                  const char *kernel_names,
+                                  cl_int *errcode_ret) {
+    CL_FORWARD(clCreateProgramWithBuiltInKernels, context, num_devices,
+               device_list, kernel_names, errcode_ret);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clRetainProgram(cl_program program) {
+    CL_FORWARD(clRetainProgram, program);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clReleaseProgram(cl_program program) {
+    CL_FORWARD(clReleaseProgram, program);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clBuildProgram(cl_program program,
+               cl_uint num_devices,
+               const cl_device_id *device_list,
+               const char *options,
+               void (CL_CALLBACK *pfn_notify)(cl_program, void *),
+               void *user_data) {
+    CL_FORWARD(clBuildProgram, program, num_devices, device_list, options,
+               pfn_notify, user_data);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clCompileProgram(cl_program program,
+                 cl_uint num_devices,
+                 const cl_device_id *device_list,
+                 const char *options,
+                 cl_uint num_input_headers,
+                 const cl_program *input_headers,
+                 const char **header_include_names,
+                 void (CL_CALLBACK *pfn_notify)(cl_program, void *),
+                 void *user_data) {
+    CL_FORWARD(clCompileProgram, program, num_devices, device_list, options,
+               num_input_headers, input_headers, header_include_names,
+               pfn_notify, user_data);
+}
+
+CL_API_ENTRY cl_program CL_API_CALL
+clLinkProgram(cl_context context,
+              cl_uint num_devices,
+              const cl_device_id *device_list,
+              const char *options,
+              cl_uint num_input_programs,
+              const cl_program *input_programs,
+              void (CL_CALLBACK *pfn_notify)(cl_program, void *),
+              void *user_data,
+              cl_int *errcode_ret) {
+    CL_FORWARD(clLinkProgram, context, num_devices, device_list, options,
+               num_input_programs, input_programs, pfn_notify, user_data,
+               errcode_ret);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clUnloadPlatformCompiler(cl_platform_id platform) {
+    CL_FORWARD(clUnloadPlatformCompiler, platform);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clUnloadCompiler(void) {
+    CL_FORWARD(clUnloadCompiler);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clGetProgramInfo(cl_program program,
+                 cl_program_info param_name,
+                 size_t param_value_size,
+                 void *param_value,
+                 size_t *param_value_size_ret) {
+    CL_FORWARD(clGetProgramInfo, program, param_name, param_value_size,
+               param_value, param_value_size_ret);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clGetProgramBuildInfo(cl_program program,
+                      cl_device_id device,
+                      cl_program_build_info param_name,
+                      size_t param_value_size,
+                      void *param_value,
+                      size_t *param_value_size_ret) {
+    CL_FORWARD(clGetProgramBuildInfo, program, device, param_name,
+               param_value_size, param_value, param_value_size_ret);
+}
+
+// Kernels
+
+CL_API_ENTRY cl_kernel CL_API_CALL
+clCreateKernel(cl_program program,
+               const char *kernel_name,
+               cl_int *errcode_ret) {
+    CL_FORWARD(clCreateKernel, program, kernel_name, errcode_ret);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clCreateKernelsInProgram(cl_program program,
+                         cl_uint num_kernels,
+                         cl_kernel *kernels,
+                         cl_uint *num_kernels_ret) {
+    CL_FORWARD(clCreateKernelsInProgram, program, num_kernels, kernels,
+               num_kernels_ret);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clRetainKernel(cl_kernel kernel) {
+    CL_FORWARD(clRetainKernel, kernel);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clReleaseKernel(cl_kernel kernel) {
+    CL_FORWARD(clReleaseKernel, kernel);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clSetKernelArg(cl_kernel kernel,
+               cl_uint arg_index,
+               size_t arg_size,
+               const void *arg_value) {
+    CL_FORWARD(clSetKernelArg, kernel, arg_index, arg_size, arg_value);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clGetKernelInfo(cl_kernel kernel,
+                cl_kernel_info param_name,
+                size_t param_value_size,
+                void *param_value,
+                size_t *param_value_size_ret) {
+    CL_FORWARD(clGetKernelInfo, kernel, param_name, param_value_size,
+               param_value, param_value_size_ret);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clGetKernelArgInfo(cl_kernel kernel,
+                   cl_uint arg_indx,
+                   cl_kernel_arg_info param_name,
+                   size_t param_value_size,
+                   void *param_value,
+                   size_t *param_value_size_ret) {
+    CL_FORWARD(clGetKernelArgInfo, kernel, arg_indx, param_name,
+               param_value_size, param_value, param_value_size_ret);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clGetKernelWorkGroupInfo(cl_kernel kernel,
+                         cl_device_id device,
+                         cl_kernel_work_group_info param_name,
+                         size_t param_value_size,
+                         void *param_value,
+                         size_t *param_value_size_ret) {
+    CL_FORWARD(clGetKernelWorkGroupInfo, kernel, device, param_name,
+               param_value_size, param_value, param_value_size_ret);
+}
+
+// Events
+
+CL_API_ENTRY cl_int CL_API_CALL
+clWaitForEvents(cl_uint num_events,
+                const cl_event *event_list) {
+    CL_FORWARD(clWaitForEvents, num_events, event_list);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clGetEventInfo(cl_event event,
+               cl_event_info param_name,
+               size_t param_value_size,
+               void *param_value,
+               size_t *param_value_size_ret) {
+    CL_FORWARD(clGetEventInfo, event, param_name, param_value_size,
+               param_value, param_value_size_ret);
+}
+
+CL_API_ENTRY cl_event CL_API_CALL
+clCreateUserEvent(cl_context context,
+                  cl_int *errcode_ret) {
+    CL_FORWARD(clCreateUserEvent, context, errcode_ret);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clRetainEvent(cl_event event) {
+    CL_FORWARD(clRetainEvent, event);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clReleaseEvent(cl_event event) {
+    CL_FORWARD(clReleaseEvent, event);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clSetUserEventStatus(cl_event event,
+                     cl_int execution_status) {
+    CL_FORWARD(clSetUserEventStatus, event, execution_status);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clSetEventCallback(cl_event event,
+                   cl_int command_exec_callback_type,
+                   void (CL_CALLBACK *pfn_notify)(cl_event, cl_int, void *),
+                   void *user_data) {
+    CL_FORWARD(clSetEventCallback, event, command_exec_callback_type,
+               pfn_notify, user_data);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clGetEventProfilingInfo(cl_event event,
+                        cl_profiling_info param_name,
+                        size_t param_value_size,
+                        void *param_value,
+                        size_t *param_value_size_ret) {
+    CL_FORWARD(clGetEventProfilingInfo, event, param_name, param_value_size,
+               param_value, param_value_size_ret);
+}
+
+// Flush and finish
+
+CL_API_ENTRY cl_int CL_API_CALL
+clFlush(cl_command_queue command_queue) {
+    CL_FORWARD(clFlush, command_queue);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clFinish(cl_command_queue command_queue) {
+    CL_FORWARD(clFinish, command_queue);
+}
+
+// Enqueued commands
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueReadBuffer(cl_command_queue command_queue,
+                    cl_mem buffer,
+                    cl_bool blocking_read,
+                    size_t offset,
+                    size_t size,
+                    void *ptr,
+                    cl_uint num_events_in_wait_list,
+                    const cl_event *event_wait_list,
+                    cl_event *event) {
+    CL_FORWARD(clEnqueueReadBuffer, command_queue, buffer, blocking_read,
+               offset, size, ptr, num_events_in_wait_list, event_wait_list,
+               event);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueReadBufferRect(cl_command_queue command_queue,
+                        cl_mem buffer,
+                        cl_bool blocking_read,
+                        const size_t *buffer_offset,
+                        const size_t *host_offset,
+                        const size_t *region,
+                        size_t buffer_row_pitch,
+                        size_t buffer_slice_pitch,
+                        size_t host_row_pitch,
+                        size_t host_slice_pitch,
+                        void *ptr,
+                        cl_uint num_events_in_wait_list,
+                        const cl_event *event_wait_list,
+                        cl_event *event) {
+    CL_FORWARD(clEnqueueReadBufferRect, command_queue, buffer, blocking_read,
+               buffer_offset, host_offset, region, buffer_row_pitch,
+               buffer_slice_pitch, host_row_pitch, host_slice_pitch, ptr,
+               num_events_in_wait_list, event_wait_list, event);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueWriteBuffer(cl_command_queue command_queue,
+                     cl_mem buffer,
+                     cl_bool blocking_write,
+                     size_t offset,
+                     size_t size,
+                     const void *ptr,
+                     cl_uint num_events_in_wait_list,
+                     const cl_event *event_wait_list,
+                     cl_event *event) {
+    CL_FORWARD(clEnqueueWriteBuffer, command_queue, buffer, blocking_write,
+               offset, size, ptr, num_events_in_wait_list, event_wait_list,
+               event);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueWriteBufferRect(cl_command_queue command_queue,
+                         cl_mem buffer,
+                         cl_bool blocking_write,
+                         const size_t *buffer_offset,
+                         const size_t *host_offset,
+                         const size_t *region,
+                         size_t buffer_row_pitch,
+                         size_t buffer_slice_pitch,
+                         size_t host_row_pitch,
+                         size_t host_slice_pitch,
+                         const void *ptr,
+                         cl_uint num_events_in_wait_list,
+                         const cl_event *event_wait_list,
+                         cl_event *event) {
+    CL_FORWARD(clEnqueueWriteBufferRect, command_queue, buffer,
+               blocking_write, buffer_offset, host_offset, region,
+               buffer_row_pitch, buffer_slice_pitch, host_row_pitch,
+               host_slice_pitch, ptr, num_events_in_wait_list,
+               event_wait_list, event);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueFillBuffer(cl_command_queue command_queue,
+                    cl_mem buffer,
+                    const void *pattern,
+                    size_t pattern_size,
+                    size_t offset,
+                    size_t size,
+                    cl_uint num_events_in_wait_list,
+                    const cl_event *event_wait_list,
+                    cl_event *event) {
+    CL_FORWARD(clEnqueueFillBuffer, command_queue, buffer, pattern,
+               pattern_size, offset, size, num_events_in_wait_list,
+               event_wait_list, event);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueCopyBuffer(cl_command_queue command_queue,
+                    cl_mem src_buffer,
+                    cl_mem dst_buffer,
+                    size_t src_offset,
+                    size_t dst_offset,
+                    size_t size,
+                    cl_uint num_events_in_wait_list,
+                    const cl_event *event_wait_list,
+                    cl_event *event) {
+    CL_FORWARD(clEnqueueCopyBuffer, command_queue, src_buffer, dst_buffer,
+               src_offset, dst_offset, size, num_events_in_wait_list,
+               event_wait_list, event);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueCopyBufferRect(cl_command_queue command_queue,
+                        cl_mem src_buffer,
+                        cl_mem dst_buffer,
+                        const size_t *src_origin,
+                        const size_t *dst_origin,
+                        const size_t *region,
+                        size_t src_row_pitch,
+                        size_t src_slice_pitch,
+                        size_t dst_row_pitch,
+                        size_t dst_slice_pitch,
+                        cl_uint num_events_in_wait_list,
+                        const cl_event *event_wait_list,
+                        cl_event *event) {
+    CL_FORWARD(clEnqueueCopyBufferRect, command_queue, src_buffer,
+               dst_buffer, src_origin, dst_origin, region, src_row_pitch,
+               src_slice_pitch, dst_row_pitch, dst_slice_pitch,
+               num_events_in_wait_list, event_wait_list, event);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueReadImage(cl_command_queue command_queue,
+                   cl_mem image,
+                   cl_bool blocking_read,
+                   const size_t *origin,
+                   const size_t *region,
+                   size_t row_pitch,
+                   size_t slice_pitch,
+                   void *ptr,
+                   cl_uint num_events_in_wait_list,
+                   const cl_event *event_wait_list,
+                   cl_event *event) {
+    CL_FORWARD(clEnqueueReadImage, command_queue, image, blocking_read,
+               origin, region, row_pitch, slice_pitch, ptr,
+               num_events_in_wait_list, event_wait_list, event);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueWriteImage(cl_command_queue command_queue,
+                    cl_mem image,
+                    cl_bool blocking_write,
+                    const size_t *origin,
+                    const size_t *region,
+                    size_t input_row_pitch,
+                    size_t input_slice_pitch,
+                    const void *ptr,
+                    cl_uint num_events_in_wait_list,
+                    const cl_event *event_wait_list,
+                    cl_event *event) {
+    CL_FORWARD(clEnqueueWriteImage, command_queue, image, blocking_write,
+               origin, region, input_row_pitch, input_slice_pitch, ptr,
+               num_events_in_wait_list, event_wait_list, event);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueFillImage(cl_command_queue command_queue,
+                   cl_mem image,
+                   const void *fill_color,
+                   const size_t *origin,
+                   const size_t *region,
+                   cl_uint num_events_in_wait_list,
+                   const cl_event *event_wait_list,
+                   cl_event *event) {
+    CL_FORWARD(clEnqueueFillImage, command_queue, image, fill_color, origin,
+               region, num_events_in_wait_list, event_wait_list, event);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueCopyImage(cl_command_queue command_queue,
+                   cl_mem src_image,
+                   cl_mem dst_image,
+                   const size_t *src_origin,
+                   const size_t *dst_origin,
+                   const size_t *region,
+                   cl_uint num_events_in_wait_list,
+                   const cl_event *event_wait_list,
+                   cl_event *event) {
+    CL_FORWARD(clEnqueueCopyImage, command_queue, src_image, dst_image,
+               src_origin, dst_origin, region, num_events_in_wait_list,
+               event_wait_list, event);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueCopyImageToBuffer(cl_command_queue command_queue,
+                           cl_mem src_image,
+                           cl_mem dst_buffer,
+                           const size_t *src_origin,
+                           const size_t *region,
+                           size_t dst_offset,
+                           cl_uint num_events_in_wait_list,
+                           const cl_event *event_wait_list,
+                           cl_event *event) {
+    CL_FORWARD(clEnqueueCopyImageToBuffer, command_queue, src_image,
+               dst_buffer, src_origin, region, dst_offset,
+               num_events_in_wait_list, event_wait_list, event);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueCopyBufferToImage(cl_command_queue command_queue,
+                           cl_mem src_buffer,
+                           cl_mem dst_image,
+                           size_t src_offset,
+                           const size_t *dst_origin,
+                           const size_t *region,
+                           cl_uint num_events_in_wait_list,
+                           const cl_event *event_wait_list,
+                           cl_event *event) {
+    CL_FORWARD(clEnqueueCopyBufferToImage, command_queue, src_buffer,
+               dst_image, src_offset, dst_origin, region,
+               num_events_in_wait_list, event_wait_list, event);
+}
+
+CL_API_ENTRY void * CL_API_CALL
+clEnqueueMapBuffer(cl_command_queue command_queue,
+                   cl_mem buffer,
+                   cl_bool blocking_map,
+                   cl_map_flags map_flags,
+                   size_t offset,
+                   size_t size,
+                   cl_uint num_events_in_wait_list,
+                   const cl_event *event_wait_list,
+                   cl_event *event,
+                   cl_int *errcode_ret) {
+    CL_FORWARD(clEnqueueMapBuffer, command_queue, buffer, blocking_map,
+               map_flags, offset, size, num_events_in_wait_list,
+               event_wait_list, event, errcode_ret);
+}
+
+CL_API_ENTRY void * CL_API_CALL
+clEnqueueMapImage(cl_command_queue command_queue,
+                  cl_mem image,
+                  cl_bool blocking_map,
+                  cl_map_flags map_flags,
+                  const size_t *origin,
+                  const size_t *region,
+                  size_t *image_row_pitch,
+                  size_t *image_slice_pitch,
+                  cl_uint num_events_in_wait_list,
+                  const cl_event *event_wait_list,
+                  cl_event *event,
+                  cl_int *errcode_ret) {
+    CL_FORWARD(clEnqueueMapImage, command_queue, image, blocking_map,
+               map_flags, origin, region, image_row_pitch, image_slice_pitch,
+               num_events_in_wait_list, event_wait_list, event, errcode_ret);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueUnmapMemObject(cl_command_queue command_queue,
+                        cl_mem memobj,
+                        void *mapped_ptr,
+                        cl_uint num_events_in_wait_list,
+                        const cl_event *event_wait_list,
+                        cl_event *event) {
+    CL_FORWARD(clEnqueueUnmapMemObject, command_queue, memobj, mapped_ptr,
+               num_events_in_wait_list, event_wait_list, event);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueMigrateMemObjects(cl_command_queue command_queue,
+                           cl_uint num_mem_objects,
+                           const cl_mem *mem_objects,
+                           cl_mem_migration_flags flags,
+                           cl_uint num_events_in_wait_list,
+                           const cl_event *event_wait_list,
+                           cl_event *event) {
+    CL_FORWARD(clEnqueueMigrateMemObjects, command_queue, num_mem_objects,
+               mem_objects, flags, num_events_in_wait_list, event_wait_list,
+               event);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueNDRangeKernel(cl_command_queue command_queue,
+                       cl_kernel kernel,
+                       cl_uint work_dim,
+                       const size_t *global_work_offset,
+                       const size_t *global_work_size,
+                       const size_t *local_work_size,
+                       cl_uint num_events_in_wait_list,
+                       const cl_event *event_wait_list,
+                       cl_event *event) {
+    CL_FORWARD(clEnqueueNDRangeKernel, command_queue, kernel, work_dim,
+               global_work_offset, global_work_size, local_work_size,
+               num_events_in_wait_list, event_wait_list, event);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueTask(cl_command_queue command_queue,
+              cl_kernel kernel,
+              cl_uint num_events_in_wait_list,
+              const cl_event *event_wait_list,
+              cl_event *event) {
+    CL_FORWARD(clEnqueueTask, command_queue, kernel, num_events_in_wait_list,
+               event_wait_list, event);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueNativeKernel(cl_command_queue command_queue,
+                      void (CL_CALLBACK *user_func)(void *),
+                      void *args,
+                      size_t cb_args,
+                      cl_uint num_mem_objects,
+                      const cl_mem *mem_list,
+                      const void **args_mem_loc,
+                      cl_uint num_events_in_wait_list,
+                      const cl_event *event_wait_list,
+                      cl_event *event) {
+    CL_FORWARD(clEnqueueNativeKernel, command_queue, user_func, args,
+               cb_args, num_mem_objects, mem_list, args_mem_loc,
+               num_events_in_wait_list, event_wait_list, event);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueMarkerWithWaitList(cl_command_queue command_queue,
+                            cl_uint num_events_in_wait_list,
+                            const cl_event *event_wait_list,
+                            cl_event *event) {
+    CL_FORWARD(clEnqueueMarkerWithWaitList, command_queue,
+               num_events_in_wait_list, event_wait_list, event);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueBarrierWithWaitList(cl_command_queue command_queue,
+                             cl_uint num_events_in_wait_list,
+                             const cl_event *event_wait_list,
+                             cl_event *event) {
+    CL_FORWARD(clEnqueueBarrierWithWaitList, command_queue,
+               num_events_in_wait_list, event_wait_list, event);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueMarker(cl_command_queue command_queue,
+                cl_event *event) {
+    CL_FORWARD(clEnqueueMarker, command_queue, event);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueWaitForEvents(cl_command_queue command_queue,
+                       cl_uint num_events,
+                       const cl_event *event_list) {
+    CL_FORWARD(clEnqueueWaitForEvents, command_queue, num_events,
+               event_list);
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueBarrier(cl_command_queue command_queue) {
+    CL_FORWARD(clEnqueueBarrier, command_queue);
+}
+
+// Extensions
+
+CL_API_ENTRY void * CL_API_CALL
+clGetExtensionFunctionAddressForPlatform(cl_platform_id platform,
+                                         const char *func_name) {
+    CL_FORWARD(clGetExtensionFunctionAddressForPlatform, platform,
+               func_name);
+}
+
+CL_API_ENTRY void * CL_API_CALL
+clGetExtensionFunctionAddress(const char *func_name) {
+    CL_FORWARD(clGetExtensionFunctionAddress, func_name);
+}
+
+}  // extern "C"
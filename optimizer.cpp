@@ -0,0 +1,30 @@
+/*
+ * File:   optimizer.cpp
+ *
+ * Created on 17 de octubre de 2026
+ */
+
+#include <vector>
+
+#include "optimizer.hpp"
+
+compute_event optimizer::shift(matrix_float &param,
+                           matrix_float const &state,
+                           float factor,
+                           const std::vector<compute_event> *waitList) {
+    return kernels.runElementWiseSum(param, state, param, 1.0f, factor,
+                                     waitList);
+}
+
+compute_event optimizer::update(matrix_float const &param,
+                            matrix_float const &state,
+                            matrix_float const &gradient,
+                            float learningRate,
+                            float momentum,
+                            float l2,
+                            float gradScale,
+                            const std::vector<compute_event> *waitList) {
+    return kernels.runOptimizerUpdate(param, state, gradient, int32_t(rule),
+                                      learningRate, momentum, l2, gradScale,
+                                      waitList);
+}
@@ -0,0 +1,68 @@
+/*
+ * File:   optimizer.hpp
+ *
+ * Created on 17 de octubre de 2026
+ */
+
+#ifndef OPTIMIZER_HPP
+#define OPTIMIZER_HPP
+
+#include <vector>
+
+#include "compute_types.hpp"
+#include "compute_backend.hpp"
+
+/*
+ * Parameter update of the training. Every step is a single pass over the
+ * parameters (optimizerUpdateKernel): the gradient, the state (increments)
+ * and the parameters are read once and the state and the parameters are
+ * written once, momentum, Nesterov and L2 are applied in registers.
+ * The rules are the OPTIMIZER_* of NN_Kernels.cl, a new rule is a new value
+ * here and a new case in optimizer_rule() of the kernels.
+ */
+class optimizer {
+ public:
+    // same values than the OPTIMIZER_* defines of the kernels
+    enum rule_t {
+        MOMENTUM = 0,   // classical momentum
+        NESTEROV = 1    // Nesterov accelerated gradient
+    };
+
+    inline optimizer(compute_backend &k, rule_t r = MOMENTUM) :
+                     kernels(k), rule(r) {}
+
+    inline void setRule(rule_t r) { rule = r; }
+    inline rule_t getRule() const { return rule; }
+
+    // The NESTEROV parameters are kept in the lookahead point
+    // (parameters + momentum*state) during the training, so the gradient is
+    // calculated with them without any extra pass.
+    inline bool lookahead() const { return rule == NESTEROV; }
+
+    // param = param + factor*state: momentum moves the real parameters to
+    // the lookahead point and -momentum back. Only required by lookahead()
+    // rules, at the start and at the end of the training and when the
+    // momentum changes (factor = new - old).
+    compute_event shift(matrix_float &param,
+                    matrix_float const &state,
+                    float factor,
+                    const std::vector<compute_event> *waitList = nullptr);
+
+    // One step of the rule:
+    //   g = gradScale*gradient + l2*param and new param and state from g.
+    // param, state and gradient have the same layout.
+    compute_event update(matrix_float const &param,
+                     matrix_float const &state,
+                     matrix_float const &gradient,
+                     float learningRate,
+                     float momentum,
+                     float l2,
+                     float gradScale,
+                     const std::vector<compute_event> *waitList = nullptr);
+
+ private:
+    compute_backend &kernels;
+    rule_t rule;
+};
+
+#endif  /* OPTIMIZER_HPP */
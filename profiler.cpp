@@ -0,0 +1,135 @@
+/*
+ * File:   profiler.cpp
+ *
+ * Created on 17 de octubre de 2026
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "profiler.hpp"
+
+profiler::profiler(const std::string &file) : csvFile(file) {
+    std::ofstream csv(csvFile.c_str());
+    if (!csv.is_open()) {
+        std::cout << "Profiler: unable to write " << csvFile << "\n";
+        return;
+    }
+    csv << "epoch,section,name,calls,total_ms,per_step_ms,"
+        << "queued_us,launch_us\n";
+}
+
+void profiler::record(const std::string &name, const cl::Event &event) {
+    operations.push_back(operation{name, phase, event});
+}
+
+void profiler::recordHost(const std::string &name, double seconds) {
+    std::pair<size_t, double> &h = host[phase + ":" + name];
+    h.first++;
+    h.second += seconds;
+}
+
+void profiler::report(std::ostream &out, size_t epoch) {
+    std::map<std::string, totals> kernels;
+    std::map<std::string, totals> phases;
+    cl_ulong total = 0;
+
+    for (operation &op : operations) {
+        op.event.wait();
+        const cl_ulong queued =
+            op.event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+        const cl_ulong submit =
+            op.event.getProfilingInfo<CL_PROFILING_COMMAND_SUBMIT>();
+        const cl_ulong start =
+            op.event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+        const cl_ulong end =
+            op.event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+
+        for (totals *t : {&kernels[op.name], &phases[op.phase]}) {
+            t->calls++;
+            t->device += end - start;
+            t->queued += submit - queued;
+            t->launch += start - submit;
+        }
+        total += end - start;
+    }
+
+    std::ofstream csv(csvFile.c_str(), std::ios::app);
+    csv << std::fixed << std::setprecision(3);
+
+    out << "Profile (" << steps << " steps, "
+        << operations.size() << " operations, "
+        << std::fixed << std::setprecision(3) << total*1e-6
+        << " ms of device time)\n";
+    print(out, csv, epoch, "kernel", kernels, total);
+    print(out, csv, epoch, "phase", phases, total);
+
+    if (!host.empty()) {
+        out << std::left << std::setw(40) << "host" << std::right
+            << std::setw(8) << "calls"
+            << std::setw(12) << "total ms"
+            << std::setw(12) << "ms/step" << "\n";
+    }
+    const double perStep = 1.0/std::max<size_t>(steps, 1);
+    for (const auto &h : host) {
+        out << std::left << std::setw(40) << h.first << std::right
+            << std::setw(8) << h.second.first
+            << std::setw(12) << h.second.second*1e3
+            << std::setw(12) << h.second.second*1e3*perStep << "\n";
+        csv << epoch << ",host," << h.first << ","
+            << h.second.first << ","
+            << h.second.second*1e3 << ","
+            << h.second.second*1e3*perStep << ",,\n";
+    }
+
+    operations.clear();
+    host.clear();
+    steps = 0;
+}
+
+void profiler::print(std::ostream &out,
+                     std::ostream &csv,
+                     size_t epoch,
+                     const std::string &section,
+                     const std::map<std::string, totals> &t,
+                     cl_ulong total) const {
+    // most expensive first
+    std::vector<std::pair<std::string, totals> > sorted(t.begin(), t.end());
+    std::sort(sorted.begin(), sorted.end(),
+              [](const std::pair<std::string, totals> &a,
+                 const std::pair<std::string, totals> &b) {
+                  return a.second.device > b.second.device;
+              });
+
+    out << std::left << std::setw(40) << section << std::right
+        << std::setw(8) << "calls"
+        << std::setw(12) << "total ms"
+        << std::setw(12) << "ms/step"
+        << std::setw(8) << "%"
+        << std::setw(12) << "queued us"
+        << std::setw(12) << "launch us" << "\n";
+
+    const double perStep = 1.0/std::max<size_t>(steps, 1);
+    for (const auto &s : sorted) {
+        const totals &k = s.second;
+        const double ms = k.device*1e-6;
+        const double queued = k.queued*1e-3/k.calls;
+        const double launch = k.launch*1e-3/k.calls;
+        out << std::left << std::setw(40) << s.first << std::right
+            << std::setw(8) << k.calls
+            << std::setw(12) << ms
+            << std::setw(12) << ms*perStep
+            << std::setw(8) << std::setprecision(1)
+            << ((total == 0)?0.0:100.0*k.device/total)
+            << std::setprecision(3)
+            << std::setw(12) << queued
+            << std::setw(12) << launch << "\n";
+        csv << epoch << "," << section << "," << s.first << ","
+            << k.calls << "," << ms << "," << ms*perStep << ","
+            << queued << "," << launch << "\n";
+    }
+}
@@ -0,0 +1,87 @@
+/*
+ * File:   profiler.hpp
+ *
+ * Created on 17 de octubre de 2026
+ */
+
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#define __CL_ENABLE_EXCEPTIONS  // enable use of exceptions of the OpenCL API
+
+#include <CL/cl.hpp>
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+ * Device profiling of the training (queues created with
+ * CL_QUEUE_PROFILING_ENABLE). Every kernel launch and buffer transfer is
+ * recorded with its event, the name of the kernel (or readBuffer,
+ * writeBuffer, copyBuffer, fillBuffer, mapBuffer, unmapMemObject) and the
+ * phase of the step that enqueued it (FF, BP, WA, NAG, dropout, upload,
+ * eval...). The host side work of the step (dng, waits) is recorded with
+ * its wall-clock time.
+ *
+ * report() waits for the recorded events, reads their QUEUED, SUBMIT, START
+ * and END times and prints the totals per kernel and per phase of the
+ * interval (also appended to a CSV file). Then the records are cleared.
+ *
+ * CSV file format (one line per kernel, phase or host entry):
+ *   epoch,section,name,calls,total_ms,per_step_ms,queued_us,launch_us
+ * queued_us: mean time between QUEUED and SUBMIT (host side of the queue)
+ * launch_us: mean time between SUBMIT and START (waiting for the device)
+ */
+class profiler {
+ public:
+    explicit profiler(const std::string &file = "nn-opencl.profile.csv");
+
+    // the operations recorded from now on belong to phase p
+    inline void setPhase(const std::string &p) { phase = p; }
+
+    // a training step of the interval (per step times of the report)
+    inline void step() { steps++; }
+
+    // operation enqueued with event (the event has to be of a queue with
+    // profiling enabled)
+    void record(const std::string &name, const cl::Event &event);
+    // host work of the actual phase that took seconds
+    void recordHost(const std::string &name, double seconds);
+
+    // Prints the breakdown of the operations recorded since the previous
+    // report (epoch is the one of the training when it is called)
+    void report(std::ostream &out, size_t epoch);
+
+ private:
+    struct operation {
+        std::string name;
+        std::string phase;
+        cl::Event event;
+    };
+
+    struct totals {
+        size_t calls = 0;
+        cl_ulong device = 0;    // START -> END (ns)
+        cl_ulong queued = 0;    // QUEUED -> SUBMIT (ns)
+        cl_ulong launch = 0;    // SUBMIT -> START (ns)
+    };
+
+    std::string csvFile;
+    std::string phase = "other";
+    size_t steps = 0;
+
+    std::vector<operation> operations;
+    // host wall-clock seconds of every phase:name of the interval
+    std::map<std::string, std::pair<size_t, double> > host;
+
+    void print(std::ostream &out,
+               std::ostream &csv,
+               size_t epoch,
+               const std::string &section,
+               const std::map<std::string, totals> &t,
+               cl_ulong total) const;
+};
+
+#endif  /* PROFILER_HPP */
@@ -0,0 +1,94 @@
+/*
+ * File:   program_cache.cpp
+ *
+ * Created on 17 de octubre de 2026
+ */
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "program_cache.hpp"
+#include "common.hpp"
+
+program_cache::program_cache(const cl::Device &dev,
+                             const std::string &source,
+                             const std::string &opts,
+                             const std::string &prefix)
+                             : device(dev), options(opts) {
+    const std::string deviceName = device_string(device, CL_DEVICE_NAME);
+    const std::string driverVersion = device_string(device,
+                                                    CL_DRIVER_VERSION);
+
+    // the null characters separate the fields in the hashed data
+    uint64_t h = 14695981039346656037ULL;
+    h = hash(deviceName + '\0', h);
+    h = hash(driverVersion + '\0', h);
+    h = hash(options + '\0', h);
+    h = hash(source, h);
+
+    std::ostringstream name;
+    name << prefix << std::hex << std::setw(16) << std::setfill('0') << h
+         << ".bin";
+    cacheFile = name.str();
+}
+
+uint64_t program_cache::hash(const std::string &data, uint64_t h) {
+    for (const char c : data) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+cl::Program * program_cache::load(const cl::Context &context) const {
+    std::ifstream in(cacheFile.c_str(), std::ios::binary);
+    if (!in.is_open()) return nullptr;  // never compiled
+
+    const std::vector<char> binary((std::istreambuf_iterator<char>(in)),
+                                   std::istreambuf_iterator<char>());
+    if (binary.empty()) return nullptr;
+
+    const std::vector<cl::Device> devices(1, device);
+    cl::Program::Binaries binaries(1, std::make_pair(
+                                        static_cast<const void *>(&binary[0]),
+                                        binary.size()));
+    cl::Program *program = nullptr;
+    try {
+        program = new cl::Program(context, devices, binaries);
+        // required even for binaries (links the device executable)
+        program->build(devices, options.c_str());
+    } catch(const cl::Error &e) {
+        // corrupted file or binary not accepted by the driver
+        std::cout << "Program cache: ignoring " << cacheFile << " ("
+                  << e.what() << " " << e.err() << ")\n";
+        delete program;
+        return nullptr;
+    }
+    return program;
+}
+
+void program_cache::save(const cl::Program &program) const {
+    const std::vector<size_t> sizes =
+                            program.getInfo<CL_PROGRAM_BINARY_SIZES>();
+    if (sizes.size() != 1 || sizes[0] == 0) return;
+
+    // cl.hpp does not allocate the binaries, the C API is used instead
+    std::vector<unsigned char> binary(sizes[0]);
+    unsigned char *ptr = &binary[0];
+    if (clGetProgramInfo(program(), CL_PROGRAM_BINARIES, sizeof(ptr), &ptr,
+                         nullptr) != CL_SUCCESS) {
+        return;
+    }
+
+    std::ofstream out(cacheFile.c_str(), std::ios::binary);
+    if (!out.is_open()) {
+        std::cout << "Program cache: unable to write " << cacheFile << "\n";
+        return;
+    }
+    out.write(reinterpret_cast<const char *>(&binary[0]), binary.size());
+}
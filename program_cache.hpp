@@ -0,0 +1,51 @@
+/*
+ * File:   program_cache.hpp
+ *
+ * Created on 17 de octubre de 2026
+ */
+
+#ifndef PROGRAM_CACHE_HPP
+#define PROGRAM_CACHE_HPP
+
+#define __CL_ENABLE_EXCEPTIONS  // enable use of exceptions of the OpenCL API
+
+#include <CL/cl.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * On disk cache of compiled OpenCL program binaries.
+ * The binary of a program is saved into a file whose name contains a hash of
+ * the device name, the driver version, the build options and the source, so
+ * any change of them uses a different file and a stale binary is never
+ * loaded. Next runs build the program from the binary
+ * (clCreateProgramWithBinary) instead of compiling the source.
+ */
+class program_cache {
+ public:
+    program_cache(const cl::Device &device,
+                  const std::string &source,
+                  const std::string &options,
+                  const std::string &prefix = "nn-opencl-");
+
+    // Program built from the cached binary or nullptr if there is no valid
+    // binary for the device (the caller has to compile the source)
+    cl::Program * load(const cl::Context &context) const;
+
+    // Saves the binary of a program built for the device of the cache
+    void save(const cl::Program &program) const;
+
+    inline const std::string & file() const { return cacheFile; }
+
+ private:
+    const cl::Device device;
+    const std::string options;
+    std::string cacheFile;
+
+    // FNV-1a 64 bits
+    static uint64_t hash(const std::string &data, uint64_t h);
+};
+
+#endif  /* PROGRAM_CACHE_HPP */
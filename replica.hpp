@@ -0,0 +1,73 @@
+/*
+ * File:   replica.hpp
+ *
+ * Created on 17 de octubre de 2026
+ */
+
+#ifndef REPLICA_HPP
+#define REPLICA_HPP
+
+#define __CL_ENABLE_EXCEPTIONS  // enable use of exceptions of the OpenCL API
+
+#include <CL/cl.hpp>
+
+#include <vector>
+
+#include "common.hpp"
+#include "compute_backend.hpp"
+
+/*
+ * Data parallel training: state of one device (replica of the model).
+ * Every replica calculates the gradients of a slice of the minibatch with
+ * its own queue, kernels and buffers. The weights, the bias and the training
+ * set are shared (same context, only read by the replicas) and the gradients
+ * are summed into the ones of the first device, that updates the weights.
+ * The replica of the first device uses the queue, kernels and buffers of nn
+ * (its maps are never created), only its rows and offsets are its own.
+ */
+struct replica {
+    cl::CommandQueue *queue;
+    compute_backend *kernels;
+
+    cl_uint rows;       // rows of the slice of the minibatch
+    cl_uint firstRow;   // first row of the slice inside the minibatch
+
+    // offsets of the layers inside activations and deltas (rows of the slice)
+    std::vector<cl_uint> activations_offsets;
+    std::vector<cl_uint> deltas_offsets;
+
+    // only used on the device
+    std::vector<cl_float> activations_host;
+    std::vector<cl_float> deltas_host;
+    std::vector<cl_float> t_host;
+    std::vector<cl_float> ce_partial_host;
+    std::vector<cl_float> weights_half_host;
+    std::vector<cl_float> gradient_weights_host;
+    std::vector<cl_float> gradient_bias_host;
+
+    host_device_memory_map<cl_float> activations;
+    host_device_memory_map<cl_float> deltas;
+    host_device_memory_map<cl_float> t;
+    host_device_memory_map<cl_float> ce_partial;
+    host_device_memory_map<cl_float> weights_half;
+    host_device_memory_map<cl_float> gradient_weights;
+    host_device_memory_map<cl_float> gradient_bias;
+
+    // weightsVersion of nn converted into weights_half
+    size_t weightsHalfVersion = 0;
+
+    inline replica(cl::CommandQueue *q, compute_backend *k) :
+                   queue(q), kernels(k), rows(0), firstRow(0),
+                   activations(activations_host),
+                   deltas(deltas_host),
+                   t(t_host),
+                   ce_partial(ce_partial_host),
+                   weights_half(weights_half_host),
+                   gradient_weights(gradient_weights_host),
+                   gradient_bias(gradient_bias_host) {}
+
+    // false for the replica of the first device
+    inline bool ownBuffers() const { return activations.deviceData != nullptr; }
+};
+
+#endif  /* REPLICA_HPP */
@@ -0,0 +1,111 @@
+/*
+ * File:   thread_pool.cpp
+ *
+ * Created on 17 de octubre de 2026
+ */
+
+#include <algorithm>
+
+#include "thread_pool.hpp"
+
+thread_pool::thread_pool(size_t threads) :
+                         queues(std::max<size_t>(threads, 1)),
+                         queued(0) {
+    for (size_t q = 0; q + 1 < queues.size(); q++) {
+        workers.push_back(std::thread(&thread_pool::worker, this, q));
+    }
+}
+
+thread_pool::~thread_pool() {
+    {
+        std::lock_guard<std::mutex> l(sleepLock);
+        stop = true;
+    }
+    wake.notify_all();
+    for (std::thread &w : workers) w.join();
+}
+
+void thread_pool::parallel_for(size_t n,
+                               size_t grain,
+                               const std::function<void(size_t, size_t)> &fn) {
+    if (n == 0) return;
+    grain = std::max<size_t>(grain, 1);
+    const size_t chunks = (n + grain - 1) / grain;
+
+    if (chunks == 1 || workers.empty()) {
+        for (size_t begin = 0; begin < n; begin += grain) {
+            fn(begin, std::min(n, begin + grain));
+        }
+        return;
+    }
+
+    job j;
+    j.fn = &fn;
+    j.pending = chunks;
+
+    // round robin: every thread starts with consecutive chunks of its own
+    for (size_t c = 0; c < chunks; c++) {
+        task_queue &tq = queues[c % queues.size()];
+        std::lock_guard<std::mutex> l(tq.lock);
+        tq.tasks.push_back(task{&j, c*grain, std::min(n, (c + 1)*grain)});
+        queued++;
+    }
+    {
+        // a worker checks queued with sleepLock taken before sleeping
+        std::lock_guard<std::mutex> l(sleepLock);
+    }
+    wake.notify_all();
+
+    // the calling thread works too until the last chunk has finished
+    const size_t self = queues.size() - 1;
+    task t;
+    while (j.pending.load() > 0) {
+        if (pop(self, t) || steal(self, t)) {
+            run(t);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+bool thread_pool::pop(size_t q, task &t) {
+    task_queue &tq = queues[q];
+    std::lock_guard<std::mutex> l(tq.lock);
+    if (tq.tasks.empty()) return false;
+    t = tq.tasks.back();
+    tq.tasks.pop_back();
+    queued--;
+    return true;
+}
+
+bool thread_pool::steal(size_t q, task &t) {
+    for (size_t i = 1; i < queues.size(); i++) {
+        task_queue &tq = queues[(q + i) % queues.size()];
+        std::lock_guard<std::mutex> l(tq.lock);
+        if (tq.tasks.empty()) continue;
+        t = tq.tasks.front();
+        tq.tasks.pop_front();
+        queued--;
+        return true;
+    }
+    return false;
+}
+
+void thread_pool::run(const task &t) {
+    (*t.j->fn)(t.begin, t.end);
+    // the job is not touched after this point (parallel_for can return)
+    t.j->pending--;
+}
+
+void thread_pool::worker(size_t q) {
+    task t;
+    while (true) {
+        if (pop(q, t) || steal(q, t)) {
+            run(t);
+            continue;
+        }
+        std::unique_lock<std::mutex> l(sleepLock);
+        wake.wait(l, [this] { return stop || queued.load() > 0; });
+        if (stop) return;
+    }
+}
@@ -0,0 +1,76 @@
+/*
+ * File:   thread_pool.hpp
+ *
+ * Created on 17 de octubre de 2026
+ */
+
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Work-stealing thread pool of the native CPU backend.
+ * Every thread (the workers and the thread that calls parallel_for) has its
+ * own deque of tasks. parallel_for distributes the chunks of the range
+ * between the deques, every thread takes the tasks of its own deque from the
+ * back and, when it is empty, steals from the front of the others, so the
+ * load is balanced when the tasks have different costs (edges of the GEMM,
+ * other processes in the machine).
+ * Only one parallel_for at a time: fn can not call parallel_for.
+ */
+class thread_pool {
+ public:
+    // threads including the calling one (at least 1)
+    explicit thread_pool(size_t threads);
+    ~thread_pool();
+
+    inline size_t size() const { return queues.size(); }
+
+    // fn(begin, end) for the chunks of grain elements of [0, n). Returns
+    // when all of them have finished.
+    void parallel_for(size_t n,
+                      size_t grain,
+                      const std::function<void(size_t, size_t)> &fn);
+
+ private:
+    struct job {
+        const std::function<void(size_t, size_t)> *fn;
+        std::atomic<size_t> pending;   // chunks not finished
+    };
+
+    struct task {
+        job *j;
+        size_t begin;
+        size_t end;
+    };
+
+    struct task_queue {
+        std::mutex lock;
+        std::deque<task> tasks;
+    };
+
+    // one per worker, the last one is the one of the calling thread
+    std::vector<task_queue> queues;
+    std::vector<std::thread> workers;
+
+    // tasks in the deques (the workers sleep when there are none)
+    std::atomic<size_t> queued;
+    std::mutex sleepLock;
+    std::condition_variable wake;
+    bool stop = false;
+
+    bool pop(size_t q, task &t);
+    bool steal(size_t q, task &t);
+    void run(const task &t);
+    void worker(size_t q);
+};
+
+#endif  /* THREAD_POOL_HPP */
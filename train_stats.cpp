@@ -0,0 +1,70 @@
+/*
+ * File:   train_stats.cpp
+ *
+ * Created on 17 de octubre de 2026
+ */
+
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+#include "train_stats.hpp"
+
+train_stats::train_stats() : intervalStart(clock::now()),
+                             phaseStart(intervalStart) {}
+
+void train_stats::start() {
+    intervalStart = phaseStart = clock::now();
+    steps = 0;
+    samples = 0;
+    host.clear();
+    for (transfer_count *c : counters) c->reset();
+}
+
+void train_stats::phase(const std::string &p) {
+    const clock::time_point now = clock::now();
+    const std::chrono::duration<double> elapsed = now - phaseStart;
+    host[current] += elapsed.count();
+    current = p;
+    phaseStart = now;
+}
+
+void train_stats::report(std::ostream &out, size_t epoch) {
+    // closes the actual phase (it goes on in the next interval)
+    phase(current);
+    const double seconds =
+        std::chrono::duration<double>(phaseStart - intervalStart).count();
+
+    // one line: the stream state of out is not changed
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(3)
+         << "{\"epoch\": " << epoch
+         << ", \"seconds\": " << seconds
+         << ", \"steps\": " << steps
+         << ", \"samples\": " << samples
+         << ", \"steps_per_s\": " << ((seconds > 0)?steps/seconds:0.0)
+         << ", \"samples_per_s\": " << ((seconds > 0)?samples/seconds:0.0)
+         << ", \"host_ms\": {";
+    bool first = true;
+    for (const auto &h : host) {
+        line << (first?"":", ") << "\"" << h.first << "\": "
+             << h.second*1e3;
+        first = false;
+    }
+    line << "}, \"transfers\": {";
+    size_t read = 0;
+    size_t written = 0;
+    first = true;
+    for (transfer_count *c : counters) {
+        line << (first?"":", ") << "\"" << c->name << "\": {\"read\": "
+             << c->bytesRead << ", \"written\": " << c->bytesWritten << "}";
+        read += c->bytesRead;
+        written += c->bytesWritten;
+        first = false;
+    }
+    line << "}, \"read_bytes\": " << read
+         << ", \"written_bytes\": " << written << "}\n";
+    out << line.str();
+
+    start();
+}
@@ -0,0 +1,65 @@
+/*
+ * File:   train_stats.hpp
+ *
+ * Created on 17 de octubre de 2026
+ */
+
+#ifndef TRAIN_STATS_HPP
+#define TRAIN_STATS_HPP
+
+#include <chrono>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "common.hpp"
+
+/*
+ * End-to-end accounting of the training between two reports: training
+ * steps and samples, host wall-clock time of every phase of the step (the
+ * time from a phase() call to the next one, enqueueing included and waits
+ * for the device) and bytes transferred by the registered maps.
+ *
+ * report() writes one JSON line and starts a new interval:
+ *   {"epoch": 500, "seconds": 12.3, "steps": 500, "samples": 128000,
+ *    "steps_per_s": 40.6, "samples_per_s": 10406.5,
+ *    "host_ms": {"FF": 1.2, ...},
+ *    "transfers": {"weights": {"read": 0, "written": 0}, ...},
+ *    "read_bytes": 0, "written_bytes": 0}
+ */
+class train_stats {
+ public:
+    train_stats();
+
+    // new interval: counters to 0 (also the ones of the maps)
+    void start();
+
+    // the host time from now on belongs to phase p
+    void phase(const std::string &p);
+    // a training step of samples has been enqueued
+    inline void step(size_t samples) {
+        steps++;
+        this->samples += samples;
+    }
+
+    // transfers of a map (the map has to outlive the stats)
+    inline void add(transfer_count &c) { counters.push_back(&c); }
+
+    void report(std::ostream &out, size_t epoch);
+
+ private:
+    typedef std::chrono::steady_clock clock;
+
+    clock::time_point intervalStart;
+    clock::time_point phaseStart;
+    std::string current = "other";
+
+    size_t steps = 0;
+    size_t samples = 0;
+    // host seconds of every phase of the interval
+    std::map<std::string, double> host;
+    std::vector<transfer_count *> counters;
+};
+
+#endif  /* TRAIN_STATS_HPP */
@@ -0,0 +1,143 @@
+/* 
+ * File:   tuner.cpp
+ *
+ * Created on 17 de octubre de 2026
+ */
+
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdio>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "tuner.hpp"
+#include "common.hpp"
+
+kernel_tuner::kernel_tuner(const cl::Device &device,
+                           const std::string &file)
+                           : cacheFile(file) {
+    deviceName = device_string(device, CL_DEVICE_NAME);
+    driverVersion = device_string(device, CL_DRIVER_VERSION);
+    std::vector<std::string> otherDevices;
+    load(winners, otherDevices);
+}
+
+void kernel_tuner::load(std::map<std::string, cl_uint> &deviceWinners,
+                        std::vector<std::string> &otherDevices) const {
+    std::ifstream in(cacheFile.c_str());
+    if (!in.is_open()) return;  // nothing tuned yet
+    
+    std::string line;
+    while (getline(in, line)) {
+        if (line.empty()) continue;
+        std::istringstream is(line);
+        std::string name, driver, key, value;
+        getline(is, name, '\t');
+        getline(is, driver, '\t');
+        getline(is, key, '\t');
+        getline(is, value);
+        if (name == deviceName && driver == driverVersion) {
+            try {
+                deviceWinners[key] = std::stoul(value);
+            } catch(const std::exception &e) {
+                std::cout << "Tuning cache: ignoring line " << line << "\n";
+            }
+        } else {
+            otherDevices.push_back(line);
+        }
+    }
+}
+
+void kernel_tuner::save() const {
+    // other instances (replicas, other processes) can have saved winners
+    // since the load, merge them with ours
+    std::map<std::string, cl_uint> deviceWinners;
+    std::vector<std::string> otherDevices;
+    load(deviceWinners, otherDevices);
+    for (const auto &w : winners) deviceWinners[w.first] = w.second;
+    
+    // written aside and renamed, readers never see a partial file
+    std::ostringstream tmp;
+    tmp << cacheFile << "." << getpid() << "." << this << ".tmp";
+    {
+        std::ofstream out(tmp.str().c_str());
+        if (!out.is_open()) {
+            std::cout << "Tuning cache: unable to write " << tmp.str() << "\n";
+            return;
+        }
+        for (const std::string &line : otherDevices) {
+            out << line << "\n";
+        }
+        for (const auto &w : deviceWinners) {
+            out << deviceName << "\t" << driverVersion << "\t"
+                << w.first << "\t" << w.second << "\n";
+        }
+        if (!out) {
+            std::cout << "Tuning cache: unable to write " << tmp.str() << "\n";
+            out.close();
+            std::remove(tmp.str().c_str());
+            return;
+        }
+    }
+    if (std::rename(tmp.str().c_str(), cacheFile.c_str()) != 0) {
+        std::cout << "Tuning cache: unable to write " << cacheFile << "\n";
+        std::remove(tmp.str().c_str());
+    }
+}
+
+bool kernel_tuner::lookup(const std::string &key, cl_uint &value) const {
+    auto it = winners.find(key);
+    if (it == winners.end()) return false;
+    value = it->second;
+    return true;
+}
+
+cl_uint kernel_tuner::tune(const std::string &key,
+                           const std::vector<cl_uint> &candidates,
+                           const std::function<void(cl_uint)> &trial,
+                           const cl::CommandQueue &queue) {
+    assert(!candidates.empty());
+    
+    typedef std::chrono::high_resolution_clock clock;
+    
+    cl_uint best = candidates[0];
+    double best_time = std::numeric_limits<double>::max();
+    
+    // pending work of the queue must not be timed
+    queue.finish();
+    for (cl_uint c : candidates) {
+        try {
+            // warm up (first execution can include lazy initializations)
+            trial(c);
+            queue.finish();
+            
+            double t = std::numeric_limits<double>::max();
+            for (size_t r = 0; r < repetitions; r++) {
+                const auto start = clock::now();
+                trial(c);
+                queue.finish();
+                const std::chrono::duration<double> elapsed =
+                    clock::now() - start;
+                t = std::min(t, elapsed.count());
+            }
+            if (t < best_time) {
+                best_time = t;
+                best = c;
+            }
+        } catch(const cl::Error &e) {
+            // configuration not valid for this device
+            queue.finish();
+        }
+    }
+    
+    winners[key] = best;
+    save();
+    return best;
+}
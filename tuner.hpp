@@ -0,0 +1,67 @@
+/* 
+ * File:   tuner.hpp
+ *
+ * Created on 17 de octubre de 2026
+ */
+
+#ifndef TUNER_HPP
+#define TUNER_HPP
+
+#define __CL_ENABLE_EXCEPTIONS  // enable use of exceptions of the OpenCL API
+
+#include <CL/cl.hpp>
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+ * Kernel launch configuration autotuner.
+ * The first time a (kernel, shape) key is used on a device every candidate
+ * configuration is timed and the fastest one is kept. Winners are saved into
+ * a cache file keyed by device name and driver version so that next runs
+ * reuse them without tuning again.
+ *
+ * The file is shared by every instance (one per replica, the benchmark, ...):
+ * save() merges the winners already in the file with its own ones.
+ *
+ * Cache file format (one line per winner, tab separated):
+ *   device_name  driver_version  key  value
+ */
+class kernel_tuner {
+ public:
+    kernel_tuner(const cl::Device &device,
+                 const std::string &file = "nn-opencl.tuning");
+    
+    // Returns true and the winner configuration if the key is already tuned
+    bool lookup(const std::string &key, cl_uint &value) const;
+    
+    // Times every candidate (trial must enqueue one execution with the given
+    // configuration) and returns the fastest one. Candidates that throw an
+    // OpenCL error (invalid work-group size, out of resources, ...) are
+    // discarded.
+    cl_uint tune(const std::string &key,
+                 const std::vector<cl_uint> &candidates,
+                 const std::function<void(cl_uint)> &trial,
+                 const cl::CommandQueue &queue);
+    
+    void save() const;
+    
+ private:
+    const size_t repetitions = 3;   // timed executions per candidate
+    
+    std::string cacheFile;
+    std::string deviceName;
+    std::string driverVersion;
+    
+    // winners of the device in use
+    std::map<std::string, cl_uint> winners;
+    
+    // reads the cache file: winners of the device in use and lines of other
+    // devices (kept when saving)
+    void load(std::map<std::string, cl_uint> &deviceWinners,
+              std::vector<std::string> &otherDevices) const;
+};
+
+#endif  /* TUNER_HPP */